@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+#include "player.h"
+
+// Converts ticks of an arbitrary fixed-rate clock (a hardware timer, a host sample counter)
+// into the player's two time bases: 64ths at bpm * 16 / 60 per second, and envelope frames
+// at 59.73 per second. Both are integer accumulators, so neither rate drifts against the
+// other or against the source clock.
+class SeqClock {
+public:
+    // unitsPerSecond: rate of the source clock
+    void configure(uint32_t unitsPerSecond, int bpm) {
+        if (bpm <= 0) bpm = 120;
+        sixtyFourthLimit = (uint64_t)unitsPerSecond * 60;
+        sixtyFourthRate = (uint64_t)bpm * 16;
+        frameLimit = (uint64_t)unitsPerSecond * 100;
+        frameRate = ENVELOPE_FRAME_RATE_X100;
+        sixtyFourthAcc = sixtyFourthLimit; // the first 64th is due immediately
+        frameAcc = 0;
+    }
+
+    // Advance by units source ticks, stepping the player in time order. When a 64th and a
+    // frame fall due together the 64th runs first, so new notes get their first envelope step.
+    template<class T> void advance(uint32_t units, T& player) {
+        sixtyFourthAcc += sixtyFourthRate * units;
+        frameAcc += frameRate * units;
+
+        while (sixtyFourthAcc >= sixtyFourthLimit || frameAcc >= frameLimit) {
+            // Source time elapsed since each step fell due, cross-multiplied to compare
+            bool sixtyFourthFirst;
+            if (sixtyFourthAcc < sixtyFourthLimit) sixtyFourthFirst = false;
+            else if (frameAcc < frameLimit) sixtyFourthFirst = true;
+            else sixtyFourthFirst = (sixtyFourthAcc - sixtyFourthLimit) * frameRate >= (frameAcc - frameLimit) * sixtyFourthRate;
+
+            if (sixtyFourthFirst) {
+                sixtyFourthAcc -= sixtyFourthLimit;
+                player.step64th();
+            } else {
+                frameAcc -= frameLimit;
+                player.stepFrame();
+            }
+        }
+    }
+
+private:
+    uint64_t sixtyFourthLimit = 1, sixtyFourthRate = 0, sixtyFourthAcc = 0;
+    uint64_t frameLimit = 1, frameRate = 0, frameAcc = 0;
+};
@@ -0,0 +1,145 @@
+#include "engine.h"
+
+SoundEngine::SoundEngine() {
+    for (int i = 0; i <= SFX_SLOTS; i++) {
+        gates[i].engine = this;
+        gates[i].index = i;
+    }
+    for (int ch = 0; ch < PSG_CHANNELS; ch++) musicPriority[ch] = 0;
+    resetOwners();
+}
+
+void SoundEngine::begin(const EnvelopeBank* envelopes, PsgBackend* o, uint32_t clockHz) {
+    env = envelopes;
+    out = o;
+    hz = clockHz;
+}
+
+void SoundEngine::resetOwners() {
+    for (int ch = 0; ch < PSG_CHANNELS; ch++) owner[ch] = 0;
+}
+
+void SoundEngine::stopEffects() {
+    for (int i = 0; i < SFX_SLOTS; i++) sfx[i].playing = false;
+
+    // The music starts from silence, so nothing an effect left sounding may stay on
+    for (int ch = 0; ch < PSG_CHANNELS; ch++)
+        if (owner[ch]) out->kill(ch);
+    resetOwners();
+}
+
+void SoundEngine::startMusic(const Sequence* seq) {
+    stopEffects();
+    musicPlayer.start(seq, env, &gates[0]);
+    musicClock.configure(hz, musicPlayer.bpm());
+}
+
+void SoundEngine::startMusic(SeqStream* stream) {
+    stopEffects();
+    musicPlayer.start(stream, env, &gates[0]);
+    musicClock.configure(hz, musicPlayer.bpm());
+}
+
+void SoundEngine::startMusic(const PatternSequence* song) {
+    stopEffects();
+    musicPlayer.start(song, env, &gates[0]);
+    musicClock.configure(hz, musicPlayer.bpm());
+}
+
+void SoundEngine::replaceMusic(const Sequence* seq) {
+    int bpm = musicPlayer.bpm();
+    musicPlayer.replaceSequence(seq);
+    if (musicPlayer.bpm() != bpm) musicClock.configure(hz, musicPlayer.bpm());
+}
+
+void SoundEngine::setEnvelopes(const EnvelopeBank* envelopes) {
+    env = envelopes;
+    musicPlayer.setEnvelopes(envelopes);
+    for (int i = 0; i < SFX_SLOTS; i++) sfx[i].player.setEnvelopes(envelopes);
+}
+
+int SoundEngine::playSfx(const Sequence* seq, int priority) {
+    int slot = -1;
+    for (int i = 0; i < SFX_SLOTS && slot < 0; i++)
+        if (!sfx[i].playing) slot = i;
+
+    if (slot < 0) {
+        for (int i = 0; i < SFX_SLOTS; i++) {
+            const Sfx& s = sfx[i];
+            if (s.priority > priority) continue;
+            if (slot < 0 || s.priority < sfx[slot].priority ||
+                (s.priority == sfx[slot].priority && s.started - sfx[slot].started > 0x80000000u))
+                slot = i;
+        }
+        if (slot < 0) return -1;
+        stopSfx(slot);
+    }
+
+    Sfx& s = sfx[slot];
+    s.player.start(seq, env, &gates[slot + 1]);
+    s.clock.configure(hz, s.player.bpm());
+    s.priority = priority;
+    s.started = ++triggers;
+    s.playing = true;
+    return slot;
+}
+
+void SoundEngine::stopSfx(int slot) {
+    sfx[slot].playing = false;
+
+    // The music takes its channels back as it is sounding them now
+    for (int ch = 0; ch < PSG_CHANNELS; ch++) {
+        if (owner[ch] != slot + 1) continue;
+        owner[ch] = 0;
+        musicPlayer.resendVoice(ch);
+    }
+}
+
+void SoundEngine::advance(uint32_t units) {
+    // A seek replays its preroll one slice per call, with the music's time stopped meanwhile
+    if (musicPlayer.seekInProgress()) musicPlayer.continueSeek();
+    else musicClock.advance(units, musicPlayer);
+
+    for (int i = 0; i < SFX_SLOTS; i++) {
+        Sfx& s = sfx[i];
+        if (!s.playing) continue;
+        s.clock.advance(units, s.player);
+        if (s.player.finished()) stopSfx(i);
+    }
+}
+
+bool SoundEngine::claim(int index, int channel) {
+    if (owner[channel] == index) return true;
+    if (index == 0) return false;
+
+    int held = owner[channel] ? sfx[owner[channel] - 1].priority : musicPriority[channel];
+    if (sfx[index - 1].priority < held) return false;
+    owner[channel] = (uint8_t)index;
+    return true;
+}
+
+// A key-on may take the channel; anything else only gets through for the owner
+
+void SoundEngine::Gate::playTone(int channel, int duty, uint16_t freq, uint8_t volume, uint8_t pan) {
+    if (engine->claim(index, channel)) engine->out->playTone(channel, duty, freq, volume, pan);
+}
+
+void SoundEngine::Gate::playNoise(int channel, uint16_t freq, uint8_t volume, uint8_t pan) {
+    if (engine->claim(index, channel)) engine->out->playNoise(channel, freq, volume, pan);
+}
+
+void SoundEngine::Gate::setFreq(int channel, uint16_t freq) {
+    if (engine->owner[channel] == index) engine->out->setFreq(channel, freq);
+}
+
+void SoundEngine::Gate::setVolume(int channel, uint8_t volume) {
+    if (engine->owner[channel] == index) engine->out->setVolume(channel, volume);
+}
+
+void SoundEngine::Gate::setPan(int channel, uint8_t pan) {
+    if (engine->owner[channel] == index) engine->out->setPan(channel, pan);
+}
+
+void SoundEngine::Gate::kill(int channel) {
+    if (engine->owner[channel] == index) engine->out->kill(channel);
+}
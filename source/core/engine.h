@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+
+#include "clock.h"
+#include "envelope.h"
+#include "player.h"
+#include "psg.h"
+#include "seqstream.h"
+#include "sequence.h"
+
+// Sound effects that can play at once on top of the music. A tick steps at most the music
+// and this many effects, however many are triggered.
+#define SFX_SLOTS 4
+
+// Plays one music sequence and up to SFX_SLOTS sound effect sequences on the same PSG
+// channels. Each is an ordinary Player with its own clock; their writes pass through a gate
+// that lets a channel's owner through and drops everyone else's.
+//
+// The music owns every channel to begin with. An effect takes a channel when it starts a
+// note there, if its priority is at least that of the channel's owner: the music's priority
+// for that channel, or the other effect's. It keeps the channel until it ends, then the music
+// gets it back. The music player never stops tracking a channel it has lost, so handing it
+// back writes the voice exactly as the music would have it at that moment.
+class SoundEngine {
+public:
+    SoundEngine();
+
+    // out receives every write; clockHz is the rate of the units given to advance()
+    void begin(const EnvelopeBank* envelopes, PsgBackend* out, uint32_t clockHz);
+
+    // Start the music from the beginning and stop every effect
+    void startMusic(const Sequence* seq);
+    void startMusic(SeqStream* stream);
+    void startMusic(const PatternSequence* song);
+
+    // Continue the music from the same 64th with seq's events (see Player::replaceSequence)
+    void replaceMusic(const Sequence* seq);
+
+    // New envelope tables for the music and every effect, from the next frame on
+    void setEnvelopes(const EnvelopeBank* envelopes);
+
+    // The music's claim on a hardware channel (0 by default)
+    void setChannelPriority(int channel, int priority) { musicPriority[channel] = priority; }
+
+    // Start an effect (seq must outlive it). A free slot is used if there is one, else the
+    // lowest-priority effect at or below priority gives way, the oldest of those on a tie.
+    // Returns the slot, or -1 when every effect playing outranks this one.
+    int playSfx(const Sequence* seq, int priority);
+
+    // Stop an effect at once and give its channels back to the music
+    void stopSfx(int slot);
+
+    bool sfxPlaying(int slot) const { return sfx[slot].playing; }
+
+    // Advance the music and every effect by units clock ticks. None of the calls above may
+    // run meanwhile.
+    void advance(uint32_t units);
+
+    Player& music() { return musicPlayer; }
+    const Player& music() const { return musicPlayer; }
+
+    // Slot the channel belongs to, or -1 for the music
+    int channelOwner(int channel) const { return owner[channel] - 1; }
+
+private:
+    // Output of one player: index 0 is the music, slot N is index N + 1
+    class Gate : public PsgBackend {
+    public:
+        SoundEngine* engine = nullptr;
+        int index = 0;
+
+        void playTone(int channel, int duty, uint16_t freq, uint8_t volume, uint8_t pan) override;
+        void playNoise(int channel, uint16_t freq, uint8_t volume, uint8_t pan) override;
+        void setFreq(int channel, uint16_t freq) override;
+        void setVolume(int channel, uint8_t volume) override;
+        void setPan(int channel, uint8_t pan) override;
+        void kill(int channel) override;
+    };
+
+    struct Sfx {
+        Player player;
+        SeqClock clock;
+        int priority = 0;
+        uint32_t started = 0;
+        bool playing = false;
+    };
+
+    // True if gate index may write to channel from now on
+    bool claim(int index, int channel);
+    void resetOwners();
+    void stopEffects();
+
+    const EnvelopeBank* env = nullptr;
+    PsgBackend* out = nullptr;
+    uint32_t hz = 0;
+
+    Player musicPlayer;
+    SeqClock musicClock;
+    Sfx sfx[SFX_SLOTS];
+    Gate gates[SFX_SLOTS + 1];
+
+    uint8_t owner[PSG_CHANNELS];    // gate index
+    int musicPriority[PSG_CHANNELS];
+    uint32_t triggers = 0;          // playSfx calls, to find the oldest effect
+};
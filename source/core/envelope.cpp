@@ -0,0 +1,181 @@
+#include "envelope.h"
+
+// round(32767 * sin(2 * pi * i / 256)), plus a wrap-around entry for interpolation
+static const int16_t sineTable[257] = {
+    0, 804, 1608, 2410, 3212, 4011, 4808, 5602, 6393, 7179, 7962, 8739,
+    9512, 10278, 11039, 11793, 12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+    18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594, 23170, 23731, 24279, 24811,
+    25329, 25832, 26319, 26790, 27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+    30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971, 32137, 32285, 32412, 32521,
+    32609, 32678, 32728, 32757, 32767, 32757, 32728, 32678, 32609, 32521, 32412, 32285,
+    32137, 31971, 31785, 31580, 31356, 31113, 30852, 30571, 30273, 29956, 29621, 29268,
+    28898, 28510, 28105, 27683, 27245, 26790, 26319, 25832, 25329, 24811, 24279, 23731,
+    23170, 22594, 22005, 21403, 20787, 20159, 19519, 18868, 18204, 17530, 16846, 16151,
+    15446, 14732, 14010, 13279, 12539, 11793, 11039, 10278, 9512, 8739, 7962, 7179,
+    6393, 5602, 4808, 4011, 3212, 2410, 1608, 804, 0, -804, -1608, -2410,
+    -3212, -4011, -4808, -5602, -6393, -7179, -7962, -8739, -9512, -10278, -11039, -11793,
+    -12539, -13279, -14010, -14732, -15446, -16151, -16846, -17530, -18204, -18868, -19519, -20159,
+    -20787, -21403, -22005, -22594, -23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790,
+    -27245, -27683, -28105, -28510, -28898, -29268, -29621, -29956, -30273, -30571, -30852, -31113,
+    -31356, -31580, -31785, -31971, -32137, -32285, -32412, -32521, -32609, -32678, -32728, -32757,
+    -32767, -32757, -32728, -32678, -32609, -32521, -32412, -32285, -32137, -31971, -31785, -31580,
+    -31356, -31113, -30852, -30571, -30273, -29956, -29621, -29268, -28898, -28510, -28105, -27683,
+    -27245, -26790, -26319, -25832, -25329, -24811, -24279, -23731, -23170, -22594, -22005, -21403,
+    -20787, -20159, -19519, -18868, -18204, -17530, -16846, -16151, -15446, -14732, -14010, -13279,
+    -12539, -11793, -11039, -10278, -9512, -8739, -7962, -7179, -6393, -5602, -4808, -4011,
+    -3212, -2410, -1608, -804, 0,
+};
+
+static int atLeastOne(int v) {
+    return v < 1 ? 1 : v;
+}
+
+VolumeEnv makeVolumeEnv(int A, int D, int S, int R) {
+    VolumeEnv env;
+    env.A = A; env.D = D; env.S = S; env.R = R;
+    env.attackStep = ENV_AMP_MAX / atLeastOne(A);
+    env.decayStep = ((127 - S) << 16) / atLeastOne(D);
+    // The release step has always been a whole number of levels per frame (S / R in integers)
+    env.releaseStep = (S / atLeastOne(R)) << 16;
+    return env;
+}
+
+PitchEnv makePitchEnv(int delay, int rate, int32_t depthQ16, int ramp) {
+    PitchEnv env;
+    env.delay = delay; env.rate = rate; env.depth = depthQ16; env.ramp = ramp;
+    env.phaseStep = (uint32_t)((1ull << 32) / atLeastOne(rate));
+    env.rampStep = depthQ16 / atLeastOne(ramp);
+    return env;
+}
+
+void EnvelopeBank::setDefaults() {
+    for (int i = 0; i < 16; i++) {
+        volume[i] = makeVolumeEnv(4, 8, 100, 12);
+        pitch[i] = makePitchEnv(0, 1, 0, 0);
+    }
+    clearSlides();
+}
+
+void EnvelopeBank::clearSlides() {
+    for (int i = 0; i < 16; i++) slide[i] = SlideKit();
+    slideNotes.clear();
+}
+
+// Overrides of kit below note: the note's place in the kit's slice
+static int slideRank(const SlideKit& kit, int note) {
+    int rank = 0;
+    for (int w = 0; w < note / 32; w++) rank += __builtin_popcount(kit.overridden[w]);
+    uint32_t below = (1u << (note % 32)) - 1;
+    return rank + __builtin_popcount(kit.overridden[note / 32] & below);
+}
+
+static bool slideOverridden(const SlideKit& kit, int note) {
+    return kit.overridden[note / 32] & (1u << (note % 32));
+}
+
+void EnvelopeBank::setSlideFallback(int k, const SlideNote& note) {
+    SlideKit& kit = slide[k];
+    kit.fallback = note;
+    kit.fallback.relative = true;
+    kit.hasFallback = true;
+
+    // Drop the kit's slice from the pool
+    slideNotes.erase(slideNotes.begin() + kit.first, slideNotes.begin() + kit.first + kit.count);
+    for (int i = k + 1; i < 16; i++) slide[i].first -= kit.count;
+    kit.count = 0;
+    for (int w = 0; w < MAX_DRUM_NOTES / 32; w++) kit.overridden[w] = 0;
+}
+
+void EnvelopeBank::setSlideNote(int k, int note, const SlideNote& value) {
+    SlideKit& kit = slide[k];
+    int at = kit.first + slideRank(kit, note);
+    if (!slideOverridden(kit, note)) {
+        // Open a place in the slice; the kits after it move up by one
+        slideNotes.insert(slideNotes.begin() + at, value);
+        for (int i = k + 1; i < 16; i++) slide[i].first++;
+        kit.count++;
+        kit.overridden[note / 32] |= 1u << (note % 32);
+    }
+    slideNotes[at] = value;
+    slideNotes[at].relative = false;
+}
+
+const SlideNote* EnvelopeBank::findSlide(int k, int note) const {
+    const SlideKit& kit = slide[k];
+    if (slideOverridden(kit, note)) return &slideNotes[kit.first + slideRank(kit, note)];
+    return kit.hasFallback ? &kit.fallback : nullptr;
+}
+
+int32_t sineQ15(uint32_t phase) {
+    uint32_t index = phase >> 24;
+    int32_t frac = (phase >> 8) & 0xFFFF;
+    int32_t a = sineTable[index];
+    int32_t b = sineTable[index + 1];
+    return a + (((b - a) * frac) >> 16);
+}
+
+int updateVolumeEnv(NoteState& state, const VolumeEnv& env, int baseVol, bool& released) {
+    released = false;
+    state.envCounter++;
+
+    int32_t sustain = env.S << 16;
+    switch (state.envPhase) {
+        case ENV_ATTACK:
+            state.amp += env.attackStep;
+            if (state.amp >= ENV_AMP_MAX) { state.amp = ENV_AMP_MAX; state.envPhase = ENV_DECAY; state.envCounter = 0; }
+            break;
+        case ENV_DECAY:
+            state.amp -= env.decayStep;
+            if (state.amp <= sustain) { state.amp = sustain; state.envPhase = ENV_SUSTAIN; }
+            break;
+        case ENV_RELEASE:
+            state.amp -= env.releaseStep;
+            if (state.amp <= 0) { state.amp = 0; state.envPhase = ENV_OFF; released = true; }
+            break;
+    }
+
+    int vol = (state.amp * baseVol) / ENV_AMP_MAX;
+    if (vol < 0) vol = 0;
+    if (vol > 127) vol = 127;
+    return vol;
+}
+
+bool updatePitchEnv(PitchState& state, const PitchEnv& env, int32_t& offsetQ8) {
+    state.counter++;
+    if (state.phaseState == 0 && state.counter >= env.delay) {
+        state.phaseState = 1; state.counter = 0;
+    }
+    if (state.phaseState != 1) return false;
+
+    if (state.currDepth < env.depth) {
+        state.currDepth += env.rampStep;
+        if (state.currDepth > env.depth) state.currDepth = env.depth;
+    }
+    state.phase += env.phaseStep;
+
+    // Q15 * Q16 -> Q8
+    offsetQ8 = (int32_t)(((int64_t)sineQ15(state.phase) * state.currDepth) >> 23);
+    return true;
+}
+
+void startSlide(SlideState& state, int startNote, int endNote, int duration64, int32_t framesPer64th) {
+    state.active = true;
+    state.startNote = startNote;
+    state.endNote = endNote;
+    state.duration64 = duration64;
+    state.counter = 0;
+    state.length = (int64_t)framesPer64th * duration64;
+    state.step = (state.length > 0) ? ((int64_t)(endNote - startNote) << 48) / state.length : 0;
+}
+
+int updateSlide(SlideState& state) {
+    int64_t elapsed = state.counter++;
+    if ((elapsed << 16) >= state.length) {
+        state.active = false;
+        return state.endNote;
+    }
+
+    // Truncate toward zero, as the old float-to-int conversion did
+    int64_t note = ((int64_t)state.startNote << 32) + elapsed * state.step;
+    return (int)(note / (1ll << 32));
+}
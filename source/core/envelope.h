@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Integer envelope engine. Amplitudes, depths and pitches are Q16 fixed point; every step
+// value is precomputed when the envelope is loaded, so a per-frame update is a handful of
+// integer adds and compares per active voice.
+
+#define MAX_DRUM_NOTES 128  // Support all MIDI notes as potential triggers
+
+#define ENV_ONE      (1 << 16)
+#define ENV_AMP_MAX  (127 << 16)
+
+enum EnvPhase { ENV_OFF = 0, ENV_ATTACK = 1, ENV_DECAY = 2, ENV_SUSTAIN = 3, ENV_RELEASE = 4 };
+
+// ADSR; attack, decay, and release are measured in 64ths, while sustain is measured in level from 0-127
+struct VolumeEnv {
+    int A, D, S, R; // Attack, Decay, Sustain, Release (64ths)
+
+    // Per-frame amplitude steps (Q16), filled in by makeVolumeEnv
+    int32_t attackStep, decayStep, releaseStep;
+};
+
+// Struct for tracking the current state of the *volume* envelope
+struct NoteState {
+    int envPhase = ENV_OFF; // EnvPhase
+    int32_t amp = 0;        // Current amplitude 0–127 (Q16)
+    int envCounter = 0;     // Counter for current phase
+};
+
+// Envelope for pitch
+struct PitchEnv {
+    int delay;          // in 64ths
+    int rate;           // in 64ths (period)
+    int32_t depth;      // in Hz (Q16)
+    int ramp;           // in 64ths (fade-in)
+
+    // Per-frame steps, filled in by makePitchEnv
+    uint32_t phaseStep; // fraction of a full LFO cycle (2^32 = one cycle)
+    int32_t rampStep;   // depth increase (Q16 Hz)
+};
+
+// Struct for tracking the state of the *pitch* envelope
+struct PitchState {
+    bool active = false;
+    int phaseState = 0;     // 0 = delay, 1 = running
+    uint32_t phase = 0;     // LFO phase, 2^32 = one cycle
+    int32_t currDepth = 0;  // Q16 Hz
+    int counter = 0;
+};
+
+// One slide a kit plays for a trigger note. Relative slides offset start and end from the
+// played note.
+struct SlideNote {
+    int32_t duration64;
+    int16_t startNote;
+    int16_t endNote;
+    bool relative;
+};
+
+// A slide kit: an optional relative default for every note, plus the trigger notes that
+// override it. The overrides sit sorted by note in the bank's slideNotes, shared by all 16
+// kits, each kit's as one slice of it; the bitmask says
+// which notes have one, and the number of bits set below a note is its place in the slice.
+struct SlideKit {
+    SlideNote fallback;
+    bool hasFallback;
+    uint32_t overridden[MAX_DRUM_NOTES / 32];
+    uint16_t first;     // slice start in the pool
+    uint16_t count;
+};
+
+struct SlideState {
+    bool active = false;
+    int startNote = 0;
+    int endNote = 0;
+    int counter = 0;        // frames since the slide started
+    int duration64 = 0;     // duration of the slide
+    int64_t length = 0;     // duration in frames (Q16)
+    int64_t step = 0;       // semitones per frame (Q32)
+};
+
+// Every envelope a song can select through CC74-76
+struct EnvelopeBank {
+    VolumeEnv volume[16];
+    PitchEnv pitch[16];
+    SlideKit slide[16];
+    std::vector<SlideNote> slideNotes;  // grows as envelopes.txt is loaded, never while playing
+
+    // The values used for envelopes envelopes.txt does not define
+    void setDefaults();
+
+    // Empty every slide kit
+    void clearSlides();
+
+    // The relative slide for every note of a kit, replacing the kit's overrides, as the
+    // definitions before it are replaced
+    void setSlideFallback(int kit, const SlideNote& slide);
+
+    // The absolute slide for one trigger note
+    void setSlideNote(int kit, int note, const SlideNote& slide);
+
+    // Slide a kit plays for note, or nullptr
+    const SlideNote* findSlide(int kit, int note) const;
+};
+
+VolumeEnv makeVolumeEnv(int A, int D, int S, int R);
+PitchEnv makePitchEnv(int delay, int rate, int32_t depthQ16, int ramp);
+
+// Sine of a 2^32-per-cycle phase, Q15, from a 256-entry table with linear interpolation
+int32_t sineQ15(uint32_t phase);
+
+// Volume envelope frame step; returns the channel volume (0-127) for a base volume.
+// released is set when the release phase reaches zero (the channel should be killed).
+int updateVolumeEnv(NoteState& state, const VolumeEnv& env, int baseVol, bool& released);
+
+// Pitch envelope frame step; returns true and the vibrato offset (Q8 Hz) once past the delay
+bool updatePitchEnv(PitchState& state, const PitchEnv& env, int32_t& offsetQ8);
+
+// Begin a slide; framesPer64th is Q16
+void startSlide(SlideState& state, int startNote, int endNote, int duration64, int32_t framesPer64th);
+
+// Slide frame step; returns the current whole note and clears active when the slide ends
+int updateSlide(SlideState& state);
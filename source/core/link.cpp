@@ -0,0 +1,139 @@
+#include "link.h"
+
+uint32_t SequencerLink::post(const SeqCommand& command) {
+    if (!commands.push(command)) {
+        rejectedCount++;
+        return 0;
+    }
+    // Ticket 0 means "not sent", so it is skipped when the count wraps
+    if (++posted == 0) posted = 1;
+    return posted;
+}
+
+uint32_t SequencerLink::playSfx(const Sequence* seq, int priority) {
+    SeqCommand c;
+    c.type = SEQCMD_PLAY_SFX;
+    c.seq = seq;
+    c.value = priority;
+    return post(c);
+}
+
+uint32_t SequencerLink::stopSfx(int slot) {
+    SeqCommand c;
+    c.type = SEQCMD_STOP_SFX;
+    c.value = slot;
+    return post(c);
+}
+
+uint32_t SequencerLink::seek(uint32_t time) {
+    SeqCommand c;
+    c.type = SEQCMD_SEEK;
+    c.value = (int32_t)time;
+    return post(c);
+}
+
+uint32_t SequencerLink::replaceMusic(const Sequence* seq) {
+    SeqCommand c;
+    c.type = SEQCMD_REPLACE_MUSIC;
+    c.seq = seq;
+    return post(c);
+}
+
+uint32_t SequencerLink::setEnvelopes(const EnvelopeBank* envelopes) {
+    SeqCommand c;
+    c.type = SEQCMD_SET_ENVELOPES;
+    c.envelopes = envelopes;
+    return post(c);
+}
+
+bool SequencerLink::latest(SeqStatus& s) {
+    bool any = false;
+    while (statuses.pop(s)) any = true;
+    return any;
+}
+
+void SequencerLink::apply(const SeqCommand& c) {
+    switch (c.type) {
+        case SEQCMD_PLAY_SFX:
+            engine.playSfx(c.seq, c.value);
+            break;
+        case SEQCMD_STOP_SFX:
+            if (c.value >= 0 && c.value < SFX_SLOTS && engine.sfxPlaying(c.value)) engine.stopSfx(c.value);
+            break;
+        case SEQCMD_SEEK:
+            // The preroll is replayed by the next few ticks, not all in this one
+            engine.music().startSeek((uint32_t)c.value);
+            break;
+        case SEQCMD_REPLACE_MUSIC:
+            engine.replaceMusic(c.seq);
+            break;
+        case SEQCMD_SET_ENVELOPES:
+            engine.setEnvelopes(c.envelopes);
+            break;
+    }
+}
+
+void SequencerLink::publish() {
+    const Player& player = engine.music();
+    status.published = ++statusCount;
+    status.position = player.position();
+    status.commands = applied.load(std::memory_order_relaxed);
+    status.steals = player.voiceSteals();
+    status.loops = player.loopCount();
+    status.bpm = (uint16_t)player.bpm();
+    status.sfxMask = 0;
+    for (int i = 0; i < SFX_SLOTS; i++)
+        if (engine.sfxPlaying(i)) status.sfxMask |= 1 << i;
+
+    for (int v = 0; v < 16; v++) {
+        const PlayerChannel& pc = player.channel(v);
+        SeqChannelStatus& cs = status.channels[v];
+        cs.note = (int16_t)pc.notePlaying;
+        cs.baseVolume = (uint8_t)pc.baseVolume;
+        cs.pan = (uint8_t)pc.pan;
+        cs.cc74 = (int8_t)pc.cc74;
+        cs.cc75 = (int8_t)pc.cc75;
+        cs.envPhase = (uint8_t)pc.volEnv.envPhase;
+        cs.level = (uint8_t)(pc.volEnv.amp >> 16);
+        cs.active = pc.active;
+    }
+
+    status.underruns = countedStream ? countedStream->underruns() : 0;
+    if (prof) {
+        status.overruns = prof->overruns();
+        for (int s = 0; s < PROF_SECTIONS; s++) {
+            if (s == PROF_DISPLAY) continue;
+            const ProfileStats& from = prof->section(s);
+            SeqProfileSection& to = status.profile[s];
+            to.calls = from.calls;
+            to.total = from.total;
+            to.max = from.max;
+        }
+        const uint32_t* events = prof->eventHistogram();
+        for (int i = 0; i < PROFILE_EVENT_BUCKETS; i++) status.events[i] = events[i];
+    }
+
+    // A reader that has fallen behind gets the next status that fits instead
+    statuses.push(status);
+}
+
+void SequencerLink::tick(uint32_t units) {
+    SeqCommand c;
+    bool changed = false;
+    while (commands.pop(c)) {
+        apply(c);
+        uint32_t n = applied.load(std::memory_order_relaxed) + 1;
+        if (n == 0) n = 1;
+        applied.store(n, std::memory_order_release);
+        changed = true;
+    }
+
+    engine.advance(units);
+
+    // Right after a command, so the UI sees a seek or a new song on its next frame
+    if (changed || ticksUntilStatus == 0) {
+        publish();
+        ticksUntilStatus = SEQ_STATUS_TICKS;
+    }
+    ticksUntilStatus--;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "engine.h"
+#include "ring.h"
+
+// Requests the UI side can make of a running SoundEngine
+enum SeqCommandType {
+    SEQCMD_PLAY_SFX,        // seq, value = priority
+    SEQCMD_STOP_SFX,        // value = slot
+    SEQCMD_SEEK,            // value = 64th
+    SEQCMD_REPLACE_MUSIC,   // seq
+    SEQCMD_SET_ENVELOPES,   // envelopes
+};
+
+struct SeqCommand {
+    uint8_t type = SEQCMD_SEEK;     // SeqCommandType
+    int32_t value = 0;
+    const Sequence* seq = nullptr;
+    const EnvelopeBank* envelopes = nullptr;
+};
+
+// Commands that can wait for the sequencer at once
+#define SEQ_COMMAND_QUEUE 16
+
+// What the status shows of one song channel (hardware voice when allocating)
+struct SeqChannelStatus {
+    int16_t note = 0;
+    uint8_t baseVolume = 0;
+    uint8_t pan = 64;
+    int8_t cc74 = -1;
+    int8_t cc75 = -1;
+    uint8_t envPhase = 0;   // EnvPhase
+    uint8_t level = 0;      // volume envelope amplitude, 0-127
+    bool active = false;
+};
+
+// What the status shows of one profiler section, in profiler clock ticks
+struct SeqProfileSection {
+    uint32_t calls = 0;
+    uint64_t total = 0;
+    uint32_t max = 0;
+};
+
+// Copy of the playback state taken by the sequencer
+struct SeqStatus {
+    uint32_t published = 0;     // count of statuses taken, so a reader can tell a new one
+    uint32_t position = 0;      // 64th
+    uint32_t commands = 0;      // commands carried out so far
+    uint32_t steals = 0;
+    int32_t loops = 0;
+    uint16_t bpm = 0;
+    uint8_t sfxMask = 0;        // bit N: effect slot N is playing
+    SeqChannelStatus channels[16];
+
+    // Counters of the stream and profiler given to setCounters(); zero without them
+    uint32_t underruns = 0;
+    uint32_t overruns = 0;
+    SeqProfileSection profile[PROF_SECTIONS];   // PROF_DISPLAY is the UI side's and left out
+    uint32_t events[PROFILE_EVENT_BUCKETS] = {};
+};
+
+// Take a status at most this often, in advance() calls (16 = 64 Hz at a 1024 Hz timer)
+#define SEQ_STATUS_TICKS 16
+
+// Statuses that can wait for the reader; older ones are not taken while it is full
+#define SEQ_STATUS_QUEUE 4
+
+// Splits a SoundEngine between a sequencer side that advances it (the timer IRQ on the DS, a
+// thread on a host) and a UI side that loads songs, reads input and draws. They talk through
+// two SpscRings and the count of commands carried out: commands go one way and are carried
+// out at the start of the next tick, statuses come back the other way. Neither side ever
+// waits for or holds off the other, so a slow card read or redraw cannot delay a note. The
+// UI never reads the player, the profiler's sequencer sections or the stream's counters
+// while ticks run; everything it shows of them comes in a status. The sequencer in turn only
+// reads what was handed to it before ticks began or in a command, and a SeqStream's chunks,
+// which have a handoff of their own.
+//
+// The engine must be set up and its music started before ticks begin. From then on the UI
+// side may only use the calls marked for it, and the sequencer side only tick().
+//
+// Carrying out a command only swaps pointers and moves cursors: a sequence sent to the engine
+// must be loaded whole, keyframes included, on the UI side first. A tick then never touches
+// the heap (the DS's malloc is not safe in the timer IRQ) and costs the same for a song of
+// any length.
+class SequencerLink {
+public:
+    explicit SequencerLink(SoundEngine& engine) : engine(engine) {}
+
+    // UI side. Each returns a ticket for done(), or 0 when the queue is full and the command
+    // was not sent. Sequences and envelope banks must outlive their use by the engine.
+    uint32_t playSfx(const Sequence* seq, int priority);
+    uint32_t stopSfx(int slot);
+    uint32_t seek(uint32_t time);
+    uint32_t replaceMusic(const Sequence* seq);
+    uint32_t setEnvelopes(const EnvelopeBank* envelopes);
+
+    // UI side: true once the command with ticket, and every one before it, has been carried
+    // out. After replaceMusic() or setEnvelopes() is done, the engine no longer reads the
+    // sequence or bank it replaced.
+    bool done(uint32_t ticket) const {
+        return (int32_t)(applied.load(std::memory_order_acquire) - ticket) >= 0;
+    }
+
+    // UI side: the newest status into status. False if none was taken since the last call.
+    bool latest(SeqStatus& status);
+
+    // Sequencer side: carry out the waiting commands, advance the engine by units clock ticks
+    // and now and then take a status
+    void tick(uint32_t units);
+
+    // Commands the UI side could not send because the queue was full
+    uint32_t rejected() const { return rejectedCount; }
+
+    // Before ticks begin: the profiler the sequencer side records into and the stream being
+    // played, whose counters are copied into every status (either may be nullptr)
+    void setCounters(const Profiler* profiler, const SeqStream* stream) {
+        prof = profiler;
+        countedStream = stream;
+    }
+
+private:
+    uint32_t post(const SeqCommand& command);
+    void apply(const SeqCommand& command);
+    void publish();
+
+    SoundEngine& engine;
+    const Profiler* prof = nullptr;
+    const SeqStream* countedStream = nullptr;
+    SpscRing<SeqCommand, SEQ_COMMAND_QUEUE> commands;
+    SpscRing<SeqStatus, SEQ_STATUS_QUEUE> statuses;
+
+    // UI side only
+    uint32_t posted = 0;
+    uint32_t rejectedCount = 0;
+
+    // Sequencer side only, apart from applied
+    std::atomic<uint32_t> applied{0};
+    uint32_t ticksUntilStatus = 0;
+    uint32_t statusCount = 0;
+    SeqStatus status;
+};
@@ -0,0 +1,230 @@
+#include "loader.h"
+
+#include <cstring>
+#include <sys/stat.h>
+
+#include "textreader.h"
+
+// Shortest note row m2text.py writes ("0,0,0,0,0,0,0,0,0,0,0,0" plus a line ending), used to
+// reserve the note array once from the file size
+#define MIN_NOTE_ROW_BYTES 24
+
+static void badLine(TextLoadReport* report, int line, const char* problem) {
+    if (!report) return;
+    if (report->badLines++ == 0) {
+        report->firstBadLine = line;
+        report->firstProblem = problem;
+    }
+}
+
+// CC74-76 are stored 1-based in the file, 0 meaning none
+static int envelopeIndex(int value) {
+    return value > 0 ? value - 1 : -1;
+}
+
+bool loadSongText(const std::string& path, std::vector<Note>& notes, int& BPM,
+                  int& loopStart64th, int& loopEnd64th, TextLoadReport* report) {
+    loopStart64th = -1;
+    loopEnd64th = -1;
+
+    LineReader reader(path.c_str());
+    if (!reader.isOpen()) return false;
+    if (reader.size() > 0) notes.reserve(notes.size() + reader.size() / MIN_NOTE_ROW_BYTES);
+
+    const char* begin;
+    const char* end;
+    while (reader.next(begin, end)) {
+        int line = reader.lineNumber();
+        trimSpace(begin, end);
+        if (begin == end) continue;
+
+        if (reader.tooLong()) {
+            badLine(report, line, "line too long");
+            continue;
+        }
+
+        if (line == 1 && end - begin >= 4 && memcmp(begin, "BPM:", 4) == 0) {
+            FieldReader bpm(begin + 4, end);
+            int value;
+            if (bpm.nextInt(value) && bpm.atEnd() && value > 0) BPM = value;
+            else badLine(report, line, bpm.problem() ? bpm.problem() : "BPM must be positive");
+            continue;
+        }
+
+        FieldReader f(begin, end);
+        Note n;
+        int cc74, cc75, cc76;
+        if (!(f.nextInt(n.channel) && f.nextInt(n.program) && f.nextInt(n.noteNumber) &&
+              f.nextInt(n.velocity) && f.nextInt(n.startDiv) && f.nextInt(n.endDiv) &&
+              f.nextInt(n.pan) && f.nextInt(n.pitchBend) && f.nextInt(n.channelVolume) &&
+              f.nextInt(cc74) && f.nextInt(cc75) && f.nextInt(cc76) && f.atEnd())) {
+            badLine(report, line, f.problem());
+            continue;
+        }
+        n.cc74 = envelopeIndex(cc74);
+        n.cc75 = envelopeIndex(cc75);
+        n.cc76 = envelopeIndex(cc76);
+
+        // Loop marker notes (C0 = MIDI 0 start, C#0 = MIDI 1 end) are not played
+        if (n.noteNumber == 0) {
+            if (loopStart64th == -1) loopStart64th = n.startDiv;
+            continue;
+        }
+        if (n.noteNumber == 1) {
+            if (loopEnd64th == -1) loopEnd64th = n.startDiv;
+            continue;
+        }
+
+        n.startDivFrames = 0;
+        n.endDivFrames = 0;
+        notes.push_back(n);
+    }
+
+    if (report) report->lines = reader.lineNumber();
+    return true;
+}
+
+bool loadSequenceText(const std::string& path, Sequence& seq, TextLoadReport* report,
+                      SeqOptimizeStats* optimized) {
+    int BPM = 120;
+    std::vector<Note> notes;
+    if (!loadSongText(path, notes, BPM, seq.loopStart64th, seq.loopEnd64th, report)) return false;
+    seq.bpm = BPM;
+    optimizeNotes(notes, 0, optimized);
+    fitRamps(notes, 0, optimized);
+    return packSequence(notes, seq);
+}
+
+// "Volume_Env3" -> 2. The label may have text before it; -1 if the number is missing or not 1-16.
+static int labelIndex(const char* label, const char* colon, size_t prefixLen) {
+    const char* p = label + prefixLen;
+    const char* end = colon;
+    trimSpace(p, end);
+    FieldReader number(p, end);
+    int n;
+    if (!number.nextInt(n) || !number.atEnd() || n < 1 || n > 16) return -1;
+    return n - 1;
+}
+
+static bool parseVolumeEnv(FieldReader& f, VolumeEnv& env) {
+    int v[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 4; i++) {
+        if (f.atEnd()) break;
+        if (!f.nextInt(v[i])) return false;
+    }
+    if (!f.atEnd()) return false;
+    env = makeVolumeEnv(v[0], v[1], v[2], v[3]);
+    return true;
+}
+
+static bool parsePitchEnv(FieldReader& f, PitchEnv& env) {
+    int delay = 0, rate = 1, ramp = 0;
+    int32_t depth = 0;
+    bool ok = f.atEnd() || (f.nextInt(delay) &&
+              (f.atEnd() || (f.nextInt(rate) &&
+              (f.atEnd() || (f.nextFixed16(depth) &&
+              (f.atEnd() || f.nextInt(ramp)))))));
+    if (!ok || !f.atEnd()) return false;
+    env = makePitchEnv(delay, rate, depth, ramp);
+    return true;
+}
+
+static bool parseSlideEnv(FieldReader& f, EnvelopeBank& bank, const char*& problem) {
+    int v[5] = {0, 0, 0, 0, 0}; // kit, trigger, start, end, duration
+    for (int i = 0; i < 5; i++) {
+        if (f.atEnd()) break;
+        if (!f.nextInt(v[i])) { problem = f.problem(); return false; }
+    }
+    if (!f.atEnd()) { problem = f.problem(); return false; }
+
+    // Convert 1-based kit number to 0-based index
+    int kitIdx = v[0] - 1;
+    if (kitIdx < 0 || kitIdx >= 16) { problem = "kit number must be 1-16"; return false; }
+
+    SlideNote slide;
+    slide.startNote = (int16_t)v[2];
+    slide.endNote = (int16_t)v[3];
+    slide.duration64 = v[4];
+
+    if (v[1] == -1) {
+        // Relative mode: apply to ALL notes
+        bank.setSlideFallback(kitIdx, slide);
+    } else {
+        // Normal mode: specific trigger note
+        if (v[1] < 0 || v[1] >= MAX_DRUM_NOTES) { problem = "trigger note must be 0-127 or -1"; return false; }
+        bank.setSlideNote(kitIdx, v[1], slide);
+    }
+    return true;
+}
+
+bool loadEnvelopesText(const std::string& path, EnvelopeBank& bank, EnvelopeCounts* counts,
+                       TextLoadReport* report) {
+    LineReader reader(path.c_str());
+    if (!reader.isOpen()) return false;
+
+    // Initialize all slide kits as undefined
+    bank.clearSlides();
+
+    EnvelopeCounts found;
+    const char* begin;
+    const char* end;
+    while (reader.next(begin, end)) {
+        int line = reader.lineNumber();
+        if (begin == end) continue;
+
+        // Lines without one of the three labels are comments
+        const char* label;
+        int kind;
+        if ((label = findText(begin, end, "Volume_Env"))) kind = 0;
+        else if ((label = findText(begin, end, "Pitch_Env"))) kind = 1;
+        else if ((label = findText(begin, end, "Slide_Env"))) kind = 2;
+        else continue;
+
+        if (reader.tooLong()) { badLine(report, line, "line too long"); continue; }
+
+        const char* colon = static_cast<const char*>(memchr(label, ':', end - label));
+        if (!colon) { badLine(report, line, "missing ':'"); continue; }
+        FieldReader f(colon + 1, end);
+
+        if (kind == 2) {
+            const char* problem = nullptr;
+            if (parseSlideEnv(f, bank, problem)) found.slide++;
+            else badLine(report, line, problem);
+            continue;
+        }
+
+        int index = labelIndex(label, colon, kind == 0 ? strlen("Volume_Env") : strlen("Pitch_Env"));
+        if (index < 0) { badLine(report, line, "envelope number must be 1-16"); continue; }
+
+        if (kind == 0) {
+            if (parseVolumeEnv(f, bank.volume[index])) found.volume++;
+            else badLine(report, line, f.problem());
+        } else {
+            if (parsePitchEnv(f, bank.pitch[index])) found.pitch++;
+            else badLine(report, line, f.problem());
+        }
+    }
+
+    if (counts) *counts = found;
+    if (report) report->lines = reader.lineNumber();
+    return true;
+}
+
+std::string describeTextLoad(const std::string& path, const TextLoadReport& report) {
+    if (report.badLines == 0) return "";
+    std::string text = path + ":" + std::to_string(report.firstBadLine) + ": " +
+                       (report.firstProblem ? report.firstProblem : "malformed line");
+    if (report.badLines > 1)
+        text += " (and " + std::to_string(report.badLines - 1) + " more)";
+    return text;
+}
+
+FileStamp fileStamp(const std::string& path) {
+    FileStamp stamp;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+        stamp.modified = (int64_t)st.st_mtime;
+        stamp.size = (int64_t)st.st_size;
+    }
+    return stamp;
+}
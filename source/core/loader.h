@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "envelope.h"
+#include "optimize.h"
+#include "sequence.h"
+
+// What a text loader skipped. Malformed lines are reported here and left out instead of
+// stopping the load, so one typo does not lose the whole song.
+struct TextLoadReport {
+    int lines = 0;              // lines read
+    int badLines = 0;           // lines skipped as malformed
+    int firstBadLine = 0;       // 1-based line number of the first of them
+    const char* firstProblem = nullptr;
+};
+
+// Read a song text file in one pass: the optional "BPM:" header, every note row, and the
+// loop markers (note 0 = loop start, note 1 = loop end, first of each wins; marker rows are
+// not returned as notes). Loop points stay -1 when absent. Returns false if the file cannot
+// be opened.
+bool loadSongText(const std::string& path, std::vector<Note>& notes, int& BPM,
+                  int& loopStart64th, int& loopEnd64th, TextLoadReport* report = nullptr);
+
+// loadSongText + optimizeNotes (without a grid) + fitRamps (without a tolerance, so playback
+// is unchanged) + packSequence.
+// Returns false if the file is missing or does not pack.
+bool loadSequenceText(const std::string& path, Sequence& seq, TextLoadReport* report = nullptr,
+                      SeqOptimizeStats* optimized = nullptr);
+
+// How many of each kind loadEnvelopesText found
+struct EnvelopeCounts {
+    int volume = 0, pitch = 0, slide = 0;
+};
+
+// Read every Volume_Env, Pitch_Env and Slide_Env line of envelopes.txt in one pass. Envelopes
+// the file does not define are left untouched, except that all slide kits are cleared first.
+// Returns false if the file cannot be opened.
+bool loadEnvelopesText(const std::string& path, EnvelopeBank& bank, EnvelopeCounts* counts = nullptr,
+                       TextLoadReport* report = nullptr);
+
+// When a file was last written and how long it is, to tell whether it changed since it was
+// read. A missing file has both -1.
+struct FileStamp {
+    int64_t modified = -1;
+    int64_t size = -1;
+
+    bool operator==(const FileStamp& o) const { return modified == o.modified && size == o.size; }
+    bool operator!=(const FileStamp& o) const { return !(*this == o); }
+};
+
+FileStamp fileStamp(const std::string& path);
+
+// "song.txt:12: not a number" for the first problem in report, or "" if there was none
+std::string describeTextLoad(const std::string& path, const TextLoadReport& report);
@@ -0,0 +1,214 @@
+#include "optimize.h"
+
+#include <algorithm>
+
+struct Pending { uint32_t time; uint32_t row; bool off; };
+
+// Playback order, as packSequence makes it: by time, then row order, each note's note-off
+// after its note-on
+static std::vector<Pending> playbackOrder(const std::vector<Note>& notes) {
+    std::vector<Pending> order;
+    order.reserve(notes.size() * 2);
+    for (uint32_t i = 0; i < notes.size(); i++) {
+        const Note& n = notes[i];
+        if (n.channel < 0 || n.channel > 15 || n.startDiv < 0 || n.endDiv < 0) continue;
+        order.push_back({(uint32_t)n.startDiv, i, false});
+        if (n.noteNumber != -1) order.push_back({(uint32_t)n.endDiv, i, true});
+    }
+    std::stable_sort(order.begin(), order.end(),
+        [](const Pending& a, const Pending& b) { return a.time < b.time; });
+    return order;
+}
+
+static void removeDropped(std::vector<Note>& notes, const std::vector<bool>& drop) {
+    size_t kept = 0;
+    for (size_t i = 0; i < notes.size(); i++)
+        if (!drop[i]) notes[kept++] = notes[i];
+    notes.resize(kept);
+}
+
+void optimizeNotes(std::vector<Note>& notes, uint32_t grid, SeqOptimizeStats* stats) {
+    SeqOptimizeStats found;
+    std::vector<Pending> order = playbackOrder(notes);
+
+    // Per channel: notes started and not yet ended, whether some note may still be in its
+    // release (never cleared: the release length is not known here), and the last
+    // controller row since the channel's last note event
+    int sounding[16] = {};
+    bool tail[16] = {};
+    int64_t lastCtrl[16];
+    for (int ch = 0; ch < 16; ch++) lastCtrl[ch] = -1;
+
+    std::vector<bool> drop(notes.size(), false);
+    std::vector<bool> started(notes.size(), false);
+
+    for (const Pending& p : order) {
+        const Note& n = notes[p.row];
+        int ch = n.channel;
+
+        if (n.noteNumber != -1) {
+            if (!p.off) {
+                started[p.row] = true;
+                sounding[ch]++;
+            } else if (started[p.row]) {
+                sounding[ch]--;
+                if (n.cc74 != -1) tail[ch] = true;
+            } else {
+                // Ends before it starts, so it plays on after its note-on
+                tail[ch] = true;
+            }
+            lastCtrl[ch] = -1;
+            continue;
+        }
+
+        if (!sounding[ch] && !tail[ch]) {
+            drop[p.row] = true;
+            found.unheard++;
+            continue;
+        }
+
+        if (lastCtrl[ch] >= 0) {
+            const Note& prev = notes[lastCtrl[ch]];
+            if ((uint32_t)prev.startDiv == p.time) {
+                drop[lastCtrl[ch]] = true;
+                found.merged++;
+            } else if (grid > 1 && (uint32_t)prev.startDiv / grid == p.time / grid) {
+                drop[lastCtrl[ch]] = true;
+                found.thinned++;
+            }
+        }
+        lastCtrl[ch] = p.row;
+    }
+
+    removeDropped(notes, drop);
+    if (stats) *stats = found;
+}
+
+// The three values a ramp moves, in their own units
+struct RampValues { int bend, volume, pan; };
+
+static RampValues rampValuesOf(const Note& n) {
+    return {n.pitchBend, n.channelVolume, n.pan};
+}
+
+static bool sameHeldFields(const Note& a, const Note& b) {
+    return a.program == b.program && a.cc74 == b.cc74 && a.cc75 == b.cc75 && a.cc76 == b.cc76;
+}
+
+static int distance(int a, int b) {
+    return a > b ? a - b : b - a;
+}
+
+// Fit the longest ramp from run[first] that every row up to run[last] stays within tolerance
+// of; returns last. A ramp reaches each row's values at its 64th, so only the 64ths between
+// rows can be off.
+static size_t fitRamp(const std::vector<Note>& notes, const std::vector<uint32_t>& run,
+                      const std::vector<bool>& afterNoteOn, size_t first, int tolerance,
+                      int& bendError, int& levelError) {
+    const Note& from = notes[run[first]];
+    RampValues a = rampValuesOf(from);
+    int bendTolerance = tolerance * RAMP_BEND_TOLERANCE_STEP;
+
+    size_t last = first;
+    for (size_t j = first + 1; j < run.size(); j++) {
+        const Note& to = notes[run[j]];
+        uint32_t t0 = from.startDiv, tEnd = to.startDiv, prev = notes[run[j - 1]].startDiv;
+        if (tEnd <= prev || tEnd - t0 > RAMP_LENGTH_MAX || !sameHeldFields(from, to)) break;
+        // A note-on sharing the 64th may take a voice from this channel before the line
+        // would have reached it, but after the ramp has
+        if (afterNoteOn[j]) break;
+        if (tolerance == 0 && tEnd != prev + 1) break;
+
+        RampValues b = rampValuesOf(to);
+        int length = tEnd - t0, worstBend = 0, worstLevel = 0;
+        size_t held = first;
+        for (int step = 1; step < length; step++) {
+            while (held + 1 < j && (uint32_t)notes[run[held + 1]].startDiv <= t0 + step) held++;
+            RampValues h = rampValuesOf(notes[run[held]]);
+            worstBend = std::max(worstBend, distance(rampValue(a.bend, b.bend, step, length), h.bend));
+            worstLevel = std::max(worstLevel, distance(rampValue(a.volume, b.volume, step, length), h.volume));
+            worstLevel = std::max(worstLevel, distance(rampValue(a.pan, b.pan, step, length), h.pan));
+        }
+        if (worstBend > bendTolerance || worstLevel > tolerance) break;
+
+        last = j;
+        bendError = worstBend;
+        levelError = worstLevel;
+    }
+    return last;
+}
+
+void fitRamps(std::vector<Note>& notes, int tolerance, SeqOptimizeStats* stats) {
+    SeqOptimizeStats found;
+    std::vector<Pending> order = playbackOrder(notes);
+    std::vector<bool> drop(notes.size(), false);
+
+    // Per channel: the controller rows since its last note event, and for each whether a
+    // note-on came before it in its 64th
+    std::vector<uint32_t> runs[16];
+    std::vector<bool> afterNoteOn[16];
+
+    auto flush = [&](int ch) {
+        std::vector<uint32_t>& run = runs[ch];
+        for (size_t i = 0; i + 1 < run.size();) {
+            int bendError = 0, levelError = 0;
+            size_t last = fitRamp(notes, run, afterNoteOn[ch], i, tolerance, bendError, levelError);
+            if (last == i) {
+                i++;
+                continue;
+            }
+
+            Note& n = notes[run[i]];
+            const Note& to = notes[run[last]];
+            n.rampLength = to.startDiv - n.startDiv;
+            n.rampFields = (to.pitchBend != n.pitchBend ? RAMP_BEND : 0) |
+                           (to.channelVolume != n.channelVolume ? RAMP_VOLUME : 0) |
+                           (to.pan != n.pan ? RAMP_PAN : 0);
+            n.rampPitchBend = to.pitchBend;
+            n.rampVolume = to.channelVolume;
+            n.rampPan = to.pan;
+            for (size_t k = i + 1; k <= last; k++) drop[run[k]] = true;
+
+            found.ramps++;
+            found.ramped += last - i;
+            found.maxBendError = std::max(found.maxBendError, bendError);
+            found.maxLevelError = std::max(found.maxLevelError, levelError);
+            i = last + 1;
+        }
+        run.clear();
+        afterNoteOn[ch].clear();
+    };
+
+    bool noteOnSeen = false;
+    uint32_t noteOnTime = 0;
+    for (const Pending& p : order) {
+        const Note& n = notes[p.row];
+        int ch = n.channel;
+
+        if (n.noteNumber != -1) {
+            flush(ch);
+            if (!p.off) {
+                noteOnSeen = true;
+                noteOnTime = p.time;
+            }
+            continue;
+        }
+
+        if (n.rampLength) {
+            // Already a ramp: left as it is
+            flush(ch);
+            continue;
+        }
+        runs[ch].push_back(p.row);
+        afterNoteOn[ch].push_back(noteOnSeen && noteOnTime == p.time);
+    }
+    for (int ch = 0; ch < 16; ch++) flush(ch);
+
+    removeDropped(notes, drop);
+    if (stats) {
+        stats->ramped += found.ramped;
+        stats->ramps += found.ramps;
+        stats->maxBendError = std::max(stats->maxBendError, found.maxBendError);
+        stats->maxLevelError = std::max(stats->maxLevelError, found.maxLevelError);
+    }
+}
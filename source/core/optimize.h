@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "sequence.h"
+
+// What optimizeNotes removed. Every removed row is a controller-only line.
+struct SeqOptimizeStats {
+    uint32_t merged = 0;    // overwritten by the next line of the same burst
+    uint32_t unheard = 0;   // sent while the channel could not be sounding
+    uint32_t thinned = 0;   // dropped by the automation grid
+    uint32_t ramped = 0;    // folded into a ramp on the line before
+
+    uint32_t ramps = 0;         // lines that now start a ramp
+    int maxBendError = 0;       // furthest any ramp strays from the lines it replaced, in
+    int maxLevelError = 0;      // pitch bend units and in volume/pan steps
+
+    uint32_t total() const { return merged + unheard + thinned + ramped; }
+};
+
+// Pitch bend units allowed per step of fitRamps' tolerance (1/128 of the bend range)
+#define RAMP_BEND_TOLERANCE_STEP 64
+
+// Drop controller-only rows (noteNumber -1) that make no difference to playback, before
+// packSequence. Every row carries a channel's complete controller state, so a row only
+// matters until the next row of that channel takes over:
+//   - in a burst of rows on one channel and 64th, with no note of that channel between
+//     them, only the last one is kept
+//   - rows on a channel that cannot be sounding (every note on it so far has been cut off
+//     without a volume envelope, or none has started) are dropped
+// Both keep playback exactly the same, with or without voice allocation.
+//
+// grid > 1 also thins automation to that many 64ths: of the rows on one channel within one
+// grid cell, with no note of that channel between them, only the last is kept. That one
+// changes what is heard, slightly.
+void optimizeNotes(std::vector<Note>& notes, uint32_t grid = 0, SeqOptimizeStats* stats = nullptr);
+
+// Replace runs of controller-only rows on one channel, with no note of that channel between
+// them, by a ramp on the first row of each run (see CtrlRamp); the player moves pitch bend,
+// volume and pan in a straight line between the run's first and last values, once per 64th.
+// A run only becomes a ramp if, at every 64th, the ramp is within tolerance of what the rows
+// held: tolerance volume/pan steps and tolerance * RAMP_BEND_TOLERANCE_STEP bend units.
+// Program and cc74-76 must stay the same along a run, and a ramp lasts at most
+// RAMP_LENGTH_MAX 64ths.
+//
+// With tolerance 0 only rows on consecutive 64ths that a ramp hits exactly are folded, which
+// keeps playback exactly the same. Run after optimizeNotes; stats, if given, is added to.
+void fitRamps(std::vector<Note>& notes, int tolerance = 0, SeqOptimizeStats* stats = nullptr);
@@ -0,0 +1,368 @@
+#include "pattern.h"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+const char* patternResultString(PatternResult result) {
+    switch (result) {
+        case PATTERN_OK:           return "ok";
+        case PATTERN_REORDERED:    return "events of one 64th would play in another order";
+        case PATTERN_OUT_OF_RANGE: return "too many patterns for the format";
+    }
+    return "unknown error";
+}
+
+size_t PatternSequence::expandedSize() const {
+    size_t n = 0;
+    for (const SeqPatternRef& r : orders) n += patterns[r.pattern].count;
+    return n;
+}
+
+void PatternCursor::attach(const PatternSequence* s) {
+    song = s;
+
+    // Orders are sorted by channel, so each channel's are one run
+    uint32_t o = 0;
+    for (int ch = 0; ch < 16; ch++) {
+        channelFirst[ch] = o;
+        while (o < song->orders.size() && song->orders[o].channel == ch) o++;
+    }
+    channelFirst[16] = o;
+
+    for (int ch = 0; ch < 16; ch++) {
+        pos.order[ch] = channelFirst[ch];
+        pos.index[ch] = 0;
+        settle(ch);
+    }
+    pos.fix = 0;
+    pos.fixStep = 0;
+    updateDue();
+}
+
+void PatternCursor::settle(int ch) {
+    while (pos.order[ch] < channelFirst[ch + 1] &&
+           pos.index[ch] >= song->patterns[song->orders[pos.order[ch]].pattern].count) {
+        pos.order[ch]++;
+        pos.index[ch] = 0;
+    }
+}
+
+uint32_t PatternCursor::headTime(int ch) const {
+    if (pos.order[ch] >= channelFirst[ch + 1]) return UINT32_MAX;
+    const SeqPatternRef& r = song->orders[pos.order[ch]];
+    return r.time + song->time[song->patterns[r.pattern].first + pos.index[ch]];
+}
+
+void PatternCursor::updateDue() {
+    due = UINT32_MAX;
+    for (int ch = 0; ch < 16; ch++) {
+        uint32_t t = headTime(ch);
+        if (t < due) due = t;
+    }
+}
+
+void PatternCursor::setPosition(const Position& p) {
+    pos = p;
+    updateDue();
+}
+
+// The channel whose event comes next by the song's tie rule, among those with one at due
+int PatternCursor::tieWinner() const {
+    int best = -1;
+    uint32_t bestStart = 0;
+    bool bestEarlyOff = false;
+    for (int ch = 0; ch < 16; ch++) {
+        if (headTime(ch) != due) continue;
+        const SeqPatternRef& r = song->orders[pos.order[ch]];
+        uint32_t e = song->events[song->patterns[r.pattern].first + pos.index[ch]];
+        bool earlyOff = song->tieOrder == PATTERN_TIE_OFFS_FIRST && evType(e) == EV_NOTE_OFF &&
+                        evOffLength(e) > 0;
+        uint32_t start = earlyOff ? due - evOffLength(e) : due;
+        if (best < 0 || (earlyOff && !bestEarlyOff) || (earlyOff && bestEarlyOff && start < bestStart)) {
+            best = ch;
+            bestStart = start;
+            bestEarlyOff = earlyOff;
+        }
+    }
+    return best;
+}
+
+bool PatternCursor::next(uint32_t& time, uint32_t& event) {
+    if (due == UINT32_MAX) return false;
+
+    // A fix for this 64th names the channel; one that names a channel with nothing due (only
+    // a damaged file could) gives way to the tie rule
+    int best = -1;
+    const std::vector<SeqPatternFix>& fixes = song->fixes;
+    if (pos.fix < fixes.size() && fixes[pos.fix].time == due) {
+        uint32_t at = fixes[pos.fix].first + pos.fixStep;
+        uint32_t end = pos.fix + 1 < fixes.size() ? fixes[pos.fix + 1].first : song->fixChannels.size();
+        if (at < end) best = song->fixChannels[at];
+        if (++pos.fixStep >= end - fixes[pos.fix].first) {
+            pos.fix++;
+            pos.fixStep = 0;
+        }
+        if (best >= 0 && headTime(best) != due) best = -1;
+    }
+    if (best < 0) best = tieWinner();
+
+    const SeqPatternRef& r = song->orders[pos.order[best]];
+    time = due;
+    event = song->events[song->patterns[r.pattern].first + pos.index[best]] | (best << 2);
+    pos.index[best]++;
+    settle(best);
+    updateDue();
+    return true;
+}
+
+void PatternCursor::seek(uint32_t time) {
+    for (int ch = 0; ch < 16; ch++) {
+        // Last pattern starting on or before time, else the first
+        const SeqPatternRef* first = song->orders.data() + channelFirst[ch];
+        const SeqPatternRef* last = song->orders.data() + channelFirst[ch + 1];
+        const SeqPatternRef* r = std::upper_bound(first, last, time,
+            [](uint32_t t, const SeqPatternRef& ref) { return t < ref.time; });
+        if (r != first) r--;
+        pos.order[ch] = (uint32_t)(r - song->orders.data());
+        pos.index[ch] = 0;
+        if (r == last) continue;
+
+        const SeqPattern& p = song->patterns[r->pattern];
+        while (pos.index[ch] < p.count && r->time + song->time[p.first + pos.index[ch]] < time) pos.index[ch]++;
+        settle(ch);
+    }
+    pos.fix = (uint32_t)(std::lower_bound(song->fixes.begin(), song->fixes.end(), time,
+        [](const SeqPatternFix& f, uint32_t t) { return f.time < t; }) - song->fixes.begin());
+    pos.fixStep = 0;
+    updateDue();
+}
+
+// The fixes seq needs under rule: every 64th whose events the rule, merging the channels as
+// a PatternCursor does, would put in another order
+static void findFixes(const Sequence& seq, int rule, std::vector<SeqPatternFix>& fixes,
+                      std::vector<uint8_t>& channels) {
+    fixes.clear();
+    channels.clear();
+    size_t i = 0;
+    while (i < seq.size()) {
+        uint32_t t = seq.time[i];
+        size_t end = i;
+        while (end < seq.size() && seq.time[end] == t) end++;
+
+        // Each channel's next event in this 64th; a channel's events here are in order
+        size_t head[16];
+        for (int ch = 0; ch < 16; ch++) head[ch] = end;
+        for (size_t k = end; k-- > i;) head[evChannel(seq.events[k])] = k;
+
+        bool same = true;
+        for (size_t k = i; k < end && same; k++) {
+            int best = -1;
+            uint32_t bestStart = 0;
+            bool bestEarlyOff = false;
+            for (int ch = 0; ch < 16; ch++) {
+                if (head[ch] == end) continue;
+                uint32_t e = seq.events[head[ch]];
+                bool earlyOff = rule == PATTERN_TIE_OFFS_FIRST && evType(e) == EV_NOTE_OFF && evOffLength(e) > 0;
+                uint32_t start = earlyOff ? t - evOffLength(e) : t;
+                if (best < 0 || (earlyOff && !bestEarlyOff) || (earlyOff && bestEarlyOff && start < bestStart)) {
+                    best = ch;
+                    bestStart = start;
+                    bestEarlyOff = earlyOff;
+                }
+            }
+            same = best == evChannel(seq.events[k]);
+            size_t n = head[best] + 1;
+            while (n < end && evChannel(seq.events[n]) != best) n++;
+            head[best] = n;
+        }
+
+        if (!same) {
+            fixes.push_back({t, (uint32_t)channels.size()});
+            for (size_t k = i; k < end; k++) channels.push_back((uint8_t)evChannel(seq.events[k]));
+        }
+        i = end;
+    }
+}
+
+void expandPatterns(const PatternSequence& song, Sequence& seq) {
+    seq.bpm = song.bpm;
+    seq.loopStart64th = song.loopStart64th;
+    seq.loopEnd64th = song.loopEnd64th;
+    seq.time.clear();
+    seq.events.clear();
+    seq.ctrl.clear();
+    size_t n = song.expandedSize();
+    seq.time.reserve(n);
+    seq.events.reserve(n);
+
+    PatternCursor cursor;
+    cursor.attach(&song);
+    uint32_t t, e;
+    while (cursor.next(t, e)) {
+        // Each place a pattern plays gets its own copy of the records, as packSequence makes
+        if (evType(e) >= EV_CONTROL) {
+            const uint8_t* record = &song.ctrl[evCtrlOffset(e)];
+            ChannelCtrl scratch;
+            size_t len = applyCtrlDelta(record, scratch);
+            e = (e & 0xFF) | ((uint32_t)seq.ctrl.size() << 8);
+            seq.ctrl.insert(seq.ctrl.end(), record, record + len);
+        }
+        seq.time.push_back(t);
+        seq.events.push_back(e);
+    }
+    buildKeyframes(seq);
+}
+
+void buildKeyframes(PatternSequence& song) {
+    song.keyframes.resize(song.orders.size());
+    ChannelCtrl c;
+    for (size_t o = 0; o < song.orders.size(); o++) {
+        // Orders are sorted by channel, so a new channel starts from the defaults
+        if (o > 0 && song.orders[o].channel != song.orders[o - 1].channel) c = ChannelCtrl();
+        song.keyframes[o].pack(c);
+        const SeqPattern& p = song.patterns[song.orders[o].pattern];
+        for (uint32_t i = 0; i < p.count; i++) {
+            uint32_t e = song.events[p.first + i];
+            if (evType(e) >= EV_CONTROL) applyCtrlDelta(&song.ctrl[evCtrlOffset(e)], c);
+        }
+    }
+}
+
+// Events of one channel from the 64th start (inclusive) to end (exclusive)
+struct Block {
+    uint32_t start;
+    const uint32_t* first;  // indices into the Sequence
+    size_t count;
+};
+
+// Bytes that identify a block's content: each event's time in the block, its payload with
+// the channel taken out and, for controller events, the record in place of the offset
+static void blockKey(const Sequence& seq, const Block& b, std::string& key, size_t& ctrlBytes) {
+    key.clear();
+    ctrlBytes = 0;
+    for (size_t i = 0; i < b.count; i++) {
+        uint32_t at = b.first[i];
+        uint16_t offset = (uint16_t)(seq.time[at] - b.start);
+        uint32_t e = seq.events[at] & ~(15u << 2);
+        if (evType(e) >= EV_CONTROL) e &= 0xFF;
+        key.append(reinterpret_cast<const char*>(&offset), sizeof(offset));
+        key.append(reinterpret_cast<const char*>(&e), sizeof(e));
+        if (evType(e) >= EV_CONTROL) {
+            const uint8_t* record = &seq.ctrl[evCtrlOffset(seq.events[at])];
+            ChannelCtrl scratch;
+            size_t len = applyCtrlDelta(record, scratch);
+            key.append(reinterpret_cast<const char*>(record), len);
+            ctrlBytes += len;
+        }
+    }
+}
+
+// Cut one channel's events (indices, in playback order) at every multiple of length
+static void cutBlocks(const Sequence& seq, const std::vector<uint32_t>& indices, uint32_t length,
+                      std::vector<Block>& blocks) {
+    blocks.clear();
+    size_t i = 0;
+    while (i < indices.size()) {
+        uint32_t start = seq.time[indices[i]] / length * length;
+        size_t j = i;
+        while (j < indices.size() && seq.time[indices[j]] < start + length) j++;
+        blocks.push_back({start, &indices[i], j - i});
+        i = j;
+    }
+}
+
+PatternResult buildPatterns(const Sequence& seq, PatternSequence& out) {
+    out = PatternSequence();
+    out.bpm = seq.bpm;
+    out.loopStart64th = seq.loopStart64th;
+    out.loopEnd64th = seq.loopEnd64th;
+
+    std::vector<uint32_t> byChannel[16];
+    for (uint32_t i = 0; i < seq.size(); i++) byChannel[evChannel(seq.events[i])].push_back(i);
+
+    static const uint32_t lengths[] = PATTERN_LENGTHS;
+    std::unordered_map<std::string, uint32_t> known;    // block content -> pattern
+    std::vector<Block> blocks;
+    std::string key;
+
+    for (int ch = 0; ch < 16; ch++) {
+        if (byChannel[ch].empty()) continue;
+
+        // Bytes each length would add, counting a block as new only the first time
+        uint32_t bestLength = lengths[0];
+        size_t bestBytes = SIZE_MAX;
+        for (uint32_t length : lengths) {
+            cutBlocks(seq, byChannel[ch], length, blocks);
+            std::unordered_map<std::string, bool> added;
+            size_t bytes = 0;
+            for (const Block& b : blocks) {
+                size_t ctrlBytes;
+                blockKey(seq, b, key, ctrlBytes);
+                bytes += sizeof(SeqPatternRef);
+                if (known.count(key) || added.count(key)) continue;
+                added[key] = true;
+                bytes += sizeof(SeqPattern) + b.count * (sizeof(uint16_t) + sizeof(uint32_t)) + ctrlBytes;
+            }
+            if (bytes < bestBytes) {
+                bestBytes = bytes;
+                bestLength = length;
+            }
+        }
+
+        cutBlocks(seq, byChannel[ch], bestLength, blocks);
+        for (const Block& b : blocks) {
+            size_t ctrlBytes;
+            blockKey(seq, b, key, ctrlBytes);
+            auto found = known.find(key);
+            uint32_t pattern;
+            if (found != known.end()) {
+                pattern = found->second;
+            } else {
+                pattern = (uint32_t)out.patterns.size();
+                if (pattern > 0xFFFF || out.ctrl.size() + ctrlBytes >= (1u << 24)) {
+                    out = PatternSequence();
+                    return PATTERN_OUT_OF_RANGE;
+                }
+                out.patterns.push_back({(uint32_t)out.events.size(), (uint32_t)b.count});
+                for (size_t i = 0; i < b.count; i++) {
+                    uint32_t at = b.first[i];
+                    uint32_t e = seq.events[at] & ~(15u << 2);
+                    if (evType(e) >= EV_CONTROL) {
+                        const uint8_t* record = &seq.ctrl[evCtrlOffset(e)];
+                        ChannelCtrl scratch;
+                        size_t len = applyCtrlDelta(record, scratch);
+                        e = (e & 0xFF) | ((uint32_t)out.ctrl.size() << 8);
+                        out.ctrl.insert(out.ctrl.end(), record, record + len);
+                    }
+                    out.time.push_back((uint16_t)(seq.time[at] - b.start));
+                    out.events.push_back(e);
+                }
+                known[key] = pattern;
+            }
+            out.orders.push_back({b.start, (uint16_t)pattern, (uint8_t)ch, 0});
+        }
+    }
+
+    // Whichever tie rule leaves fewer 64ths to fix
+    std::vector<SeqPatternFix> fixes;
+    std::vector<uint8_t> channels;
+    findFixes(seq, PATTERN_TIE_CHANNEL, out.fixes, out.fixChannels);
+    findFixes(seq, PATTERN_TIE_OFFS_FIRST, fixes, channels);
+    if (fixes.size() * sizeof(SeqPatternFix) + channels.size() <
+        out.fixes.size() * sizeof(SeqPatternFix) + out.fixChannels.size()) {
+        out.tieOrder = PATTERN_TIE_OFFS_FIRST;
+        out.fixes.swap(fixes);
+        out.fixChannels.swap(channels);
+    }
+
+    // The merge must give back exactly the events and order of seq
+    Sequence check;
+    expandPatterns(out, check);
+    if (!sameSequence(seq, check)) {
+        out = PatternSequence();
+        return PATTERN_REORDERED;
+    }
+    buildKeyframes(out);
+    return PATTERN_OK;
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "sequence.h"
+
+// Lengths, in 64ths, that buildPatterns tries cutting each channel into
+#define PATTERN_LENGTHS { 16, 32, 64, 128, 256 }
+
+// One stored block of a channel's events
+struct SeqPattern {
+    uint32_t first;     // index of its first event in PatternSequence::time/events
+    uint32_t count;
+};
+
+// A place in the song where a channel plays a pattern
+struct SeqPatternRef {
+    uint32_t time;      // 64th the pattern starts at
+    uint16_t pattern;
+    uint8_t channel;
+    uint8_t reserved;
+};
+
+// A 64th whose events the tie rule would put in another order: the channel of each of its
+// events, in order, are fixChannels[first] onwards (up to the next fix's first)
+struct SeqPatternFix {
+    uint32_t time;
+    uint32_t first;
+};
+
+static_assert(sizeof(SeqPattern) == 8, "SeqPattern must be packed");
+static_assert(sizeof(SeqPatternRef) == 8, "SeqPatternRef must be packed");
+static_assert(sizeof(SeqPatternFix) == 8, "SeqPatternFix must be packed");
+
+// How a PatternCursor orders the events of different channels due in the same 64th (each
+// channel's own events always keep their order)
+enum PatternTieOrder {
+    PATTERN_TIE_CHANNEL,    // lowest channel first
+    PATTERN_TIE_OFFS_FIRST, // note-offs of notes that started earlier first, earliest note and
+                            // then lowest channel; then the rest, lowest channel first
+};
+
+// A packed Sequence with repeated blocks stored once. Each channel's events are cut into
+// blocks; a block is kept as a pattern and every place it plays is a SeqPatternRef. Patterns
+// hold their events in the Sequence layout with the channel bits 0 and times in 64ths from
+// the start of the pattern, so the same bar on two channels is one pattern too. Controller
+// deltas are compared byte for byte, so a repeat shares a pattern only when it changes the
+// channel's controllers exactly as the first one did.
+//
+// Events of different channels due in the same 64th are put in order by the song's tie
+// rule. In the 64ths where the Sequence has them in another order, a fix lists the channel
+// of each event, so playback keeps the exact order of the Sequence; voice allocation depends
+// on it. OFFS_FIRST needs no fixes at all for a text song whose lines are sorted by start and
+// channel.
+//
+// keyframes holds each channel's controller values where each of its orders starts, so a
+// PatternScheduler can seek without replaying the channel from the start. Like a Sequence's,
+// they are built once when the song is built or loaded (see buildKeyframes).
+struct PatternSequence {
+    int bpm = 120;
+    int loopStart64th = -1;
+    int loopEnd64th = -1;
+    int tieOrder = PATTERN_TIE_CHANNEL; // PatternTieOrder
+
+    std::vector<SeqPattern> patterns;
+    std::vector<SeqPatternRef> orders;  // by channel, then time
+    std::vector<uint16_t> time;         // 64ths from the start of the pattern
+    std::vector<uint32_t> events;       // payloads, parallel to time
+    std::vector<uint8_t> ctrl;          // controller-delta records
+    std::vector<SeqPatternFix> fixes;   // by time
+    std::vector<uint8_t> fixChannels;
+    std::vector<SeqKeyframe::Ctrl> keyframes; // the channel's values where orders[i] starts
+
+    // Events in the song once every pattern is played out
+    size_t expandedSize() const;
+    size_t keyframeBytes() const { return keyframes.size() * sizeof(SeqKeyframe::Ctrl); }
+
+    size_t memoryBytes() const {
+        return patterns.size() * sizeof(SeqPattern) + orders.size() * sizeof(SeqPatternRef) +
+               time.size() * sizeof(uint16_t) + events.size() * sizeof(uint32_t) + ctrl.size() +
+               fixes.size() * sizeof(SeqPatternFix) + fixChannels.size();
+    }
+};
+
+// Walks every channel of a PatternSequence at once, giving back raw events (channel bits set,
+// controller offsets into the song's ctrl) in playback order. Nothing is expanded ahead: each
+// channel only keeps its place in its order list and in the pattern playing.
+class PatternCursor {
+public:
+    // Where each channel is: an index into orders and an event of that pattern; and the next
+    // fix with how many of its channels have been used
+    struct Position {
+        uint32_t order[16];
+        uint32_t index[16];
+        uint32_t fix;
+        uint32_t fixStep;
+    };
+
+    // Start at the beginning of song (the song must outlive the cursor)
+    void attach(const PatternSequence* song);
+
+    // Time of the next event, or UINT32_MAX once every channel has played out
+    uint32_t nextTime() const { return due; }
+
+    // Take the next event. False at the end.
+    bool next(uint32_t& time, uint32_t& event);
+
+    // Put each channel on its first event due on or after time
+    void seek(uint32_t time);
+
+    Position position() const { return pos; }
+    void setPosition(const Position& p);
+
+    // First and one-past-last order of a channel
+    uint32_t firstOrder(int channel) const { return channelFirst[channel]; }
+    uint32_t endOrder(int channel) const { return channelFirst[channel + 1]; }
+
+private:
+    // Step channel's place over the end of patterns it has finished
+    void settle(int channel);
+    void updateDue();
+    uint32_t headTime(int channel) const;
+    int tieWinner() const;
+
+    const PatternSequence* song = nullptr;
+    uint32_t channelFirst[17];
+    Position pos;
+    uint32_t due = UINT32_MAX;
+};
+
+enum PatternResult {
+    PATTERN_OK = 0,
+    PATTERN_REORDERED,      // the merge would play some 64th's events in another order
+                            // (cannot happen unless the fixes are wrong)
+    PATTERN_OUT_OF_RANGE,   // too many patterns, or a block too long for 16-bit times
+};
+
+const char* patternResultString(PatternResult result);
+
+// Cut seq into patterns. Each channel is cut at whichever of PATTERN_LENGTHS stores it in the
+// fewest bytes, given the patterns earlier channels already stored, and the tie rule is the
+// one needing fewer fixes. The result is expanded again and checked against seq. On anything
+// but PATTERN_OK out is left empty.
+PatternResult buildPatterns(const Sequence& seq, PatternSequence& out);
+
+// Play every pattern out into a flat Sequence, in the order a PatternScheduler plays them
+// (keyframes included)
+void expandPatterns(const PatternSequence& song, Sequence& seq);
+
+// One pass over song's orders, recording the keyframes. buildPatterns and loadPatternBinary
+// already do.
+void buildKeyframes(PatternSequence& song);
@@ -0,0 +1,133 @@
+#include "pitch.h"
+
+#include <cmath>
+
+// Q8 Hz of the octave starting at Q16 pitch 156 (with OCTAVE_SHIFT applied) in 1/64 semitone
+// steps, plus the first entry of the next octave for interpolation:
+//   round(440 * 2^((156 + i/64 - 69) / 12) * 256)
+// This is the highest octave whose values fit in 32 bits; lower octaves are right shifts.
+#define TABLE_OCTAVE 13
+#define STEPS_PER_SEMITONE 64
+
+static const uint32_t octaveTable[12 * STEPS_PER_SEMITONE + 1] = {
+    17145893, 17161375, 17176871, 17192380, 17207904, 17223442, 17238994, 17254559,
+    17270139, 17285733, 17301341, 17316963, 17332600, 17348250, 17363914, 17379593,
+    17395286, 17410993, 17426714, 17442449, 17458199, 17473962, 17489740, 17505533,
+    17521339, 17537160, 17552995, 17568844, 17584708, 17600586, 17616478, 17632385,
+    17648306, 17664241, 17680191, 17696155, 17712134, 17728127, 17744135, 17760157,
+    17776193, 17792244, 17808309, 17824389, 17840484, 17856592, 17872716, 17888854,
+    17905007, 17921174, 17937356, 17953552, 17969763, 17985989, 18002229, 18018484,
+    18034754, 18051038, 18067337, 18083651, 18099979, 18116323, 18132681, 18149053,
+    18165441, 18181843, 18198260, 18214692, 18231139, 18247601, 18264077, 18280569,
+    18297075, 18313596, 18330133, 18346684, 18363250, 18379831, 18396426, 18413037,
+    18429663, 18446304, 18462960, 18479631, 18496317, 18513018, 18529735, 18546466,
+    18563212, 18579974, 18596750, 18613542, 18630349, 18647171, 18664009, 18680861,
+    18697729, 18714612, 18731510, 18748424, 18765352, 18782296, 18799256, 18816230,
+    18833220, 18850226, 18867246, 18884282, 18901334, 18918401, 18935483, 18952581,
+    18969694, 18986822, 19003966, 19021126, 19038301, 19055491, 19072697, 19089919,
+    19107156, 19124409, 19141677, 19158961, 19176260, 19193575, 19210906, 19228252,
+    19245614, 19262992, 19280385, 19297794, 19315219, 19332660, 19350116, 19367588,
+    19385076, 19402579, 19420099, 19437634, 19455185, 19472752, 19490335, 19507934,
+    19525548, 19543179, 19560825, 19578487, 19596166, 19613860, 19631570, 19649296,
+    19667038, 19684797, 19702571, 19720361, 19738167, 19755990, 19773828, 19791683,
+    19809554, 19827441, 19845344, 19863263, 19881198, 19899150, 19917118, 19935102,
+    19953102, 19971118, 19989151, 20007200, 20025266, 20043347, 20061445, 20079560,
+    20097690, 20115837, 20134001, 20152181, 20170377, 20188590, 20206819, 20225064,
+    20243327, 20261605, 20279900, 20298212, 20316540, 20334885, 20353246, 20371624,
+    20390018, 20408429, 20426857, 20445301, 20463762, 20482239, 20500734, 20519245,
+    20537772, 20556317, 20574878, 20593456, 20612051, 20630662, 20649291, 20667936,
+    20686598, 20705276, 20723972, 20742685, 20761414, 20780161, 20798924, 20817704,
+    20836501, 20855315, 20874147, 20892995, 20911860, 20930742, 20949641, 20968558,
+    20987491, 21006442, 21025409, 21044394, 21063396, 21082415, 21101451, 21120505,
+    21139575, 21158663, 21177768, 21196890, 21216030, 21235187, 21254361, 21273552,
+    21292761, 21311987, 21331231, 21350492, 21369770, 21389066, 21408379, 21427709,
+    21447057, 21466423, 21485806, 21505206, 21524624, 21544060, 21563513, 21582983,
+    21602472, 21621977, 21641501, 21661042, 21680600, 21700177, 21719771, 21739383,
+    21759012, 21778659, 21798324, 21818007, 21837707, 21857425, 21877161, 21896915,
+    21916687, 21936476, 21956284, 21976109, 21995952, 22015813, 22035692, 22055589,
+    22075504, 22095437, 22115388, 22135357, 22155344, 22175349, 22195372, 22215413,
+    22235472, 22255550, 22275645, 22295759, 22315891, 22336041, 22356209, 22376395,
+    22396600, 22416823, 22437064, 22457323, 22477601, 22497897, 22518211, 22538544,
+    22558895, 22579264, 22599652, 22620058, 22640483, 22660926, 22681387, 22701867,
+    22722366, 22742883, 22763418, 22783972, 22804545, 22825136, 22845746, 22866374,
+    22887021, 22907687, 22928371, 22949074, 22969796, 22990536, 23011296, 23032074,
+    23052870, 23073686, 23094520, 23115373, 23136245, 23157135, 23178045, 23198973,
+    23219921, 23240887, 23261872, 23282876, 23303899, 23324942, 23346003, 23367083,
+    23388182, 23409300, 23430437, 23451594, 23472769, 23493964, 23515177, 23536410,
+    23557662, 23578934, 23600224, 23621534, 23642862, 23664211, 23685578, 23706965,
+    23728371, 23749796, 23771241, 23792705, 23814188, 23835691, 23857214, 23878755,
+    23900316, 23921897, 23943497, 23965117, 23986756, 24008415, 24030093, 24051791,
+    24073508, 24095245, 24117002, 24138778, 24160574, 24182389, 24204225, 24226080,
+    24247954, 24269849, 24291763, 24313697, 24335651, 24357625, 24379618, 24401632,
+    24423665, 24445718, 24467791, 24489884, 24511997, 24534130, 24556283, 24578456,
+    24600649, 24622862, 24645095, 24667348, 24689621, 24711915, 24734228, 24756562,
+    24778916, 24801289, 24823684, 24846098, 24868533, 24890987, 24913463, 24935958,
+    24958474, 24981010, 25003566, 25026143, 25048740, 25071358, 25093996, 25116654,
+    25139333, 25162033, 25184752, 25207493, 25230254, 25253035, 25275837, 25298660,
+    25321503, 25344367, 25367252, 25390157, 25413083, 25436029, 25458996, 25481984,
+    25504993, 25528023, 25551073, 25574144, 25597236, 25620349, 25643483, 25666637,
+    25689813, 25713009, 25736227, 25759465, 25782724, 25806005, 25829306, 25852628,
+    25875972, 25899336, 25922722, 25946129, 25969557, 25993006, 26016476, 26039967,
+    26063480, 26087014, 26110569, 26134145, 26157743, 26181362, 26205002, 26228664,
+    26252347, 26276051, 26299777, 26323524, 26347293, 26371083, 26394894, 26418727,
+    26442582, 26466458, 26490356, 26514275, 26538216, 26562178, 26586162, 26610168,
+    26634196, 26658245, 26682316, 26706408, 26730523, 26754659, 26778817, 26802997,
+    26827198, 26851422, 26875667, 26899934, 26924223, 26948534, 26972867, 26997222,
+    27021599, 27045998, 27070419, 27094862, 27119327, 27143814, 27168324, 27192855,
+    27217409, 27241984, 27266582, 27291203, 27315845, 27340510, 27365196, 27389906,
+    27414637, 27439391, 27464167, 27488966, 27513787, 27538630, 27563496, 27588384,
+    27613295, 27638228, 27663184, 27688162, 27713163, 27738186, 27763232, 27788301,
+    27813392, 27838506, 27863643, 27888802, 27913984, 27939189, 27964416, 27989667,
+    28014940, 28040235, 28065554, 28090896, 28116260, 28141648, 28167058, 28192491,
+    28217947, 28243427, 28268929, 28294454, 28320002, 28345574, 28371168, 28396786,
+    28422426, 28448090, 28473777, 28499487, 28525221, 28550977, 28576757, 28602560,
+    28628387, 28654237, 28680110, 28706006, 28731926, 28757870, 28783836, 28809826,
+    28835840, 28861877, 28887938, 28914022, 28940130, 28966261, 28992416, 29018594,
+    29044796, 29071022, 29097272, 29123545, 29149842, 29176162, 29202507, 29228875,
+    29255267, 29281683, 29308122, 29334586, 29361073, 29387585, 29414120, 29440679,
+    29467263, 29493870, 29520501, 29547157, 29573836, 29600539, 29627267, 29654019,
+    29680795, 29707595, 29734419, 29761267, 29788140, 29815037, 29841958, 29868904,
+    29895874, 29922868, 29949887, 29976930, 30003997, 30031089, 30058206, 30085346,
+    30112512, 30139702, 30166916, 30194155, 30221419, 30248707, 30276020, 30303357,
+    30330719, 30358106, 30385518, 30412954, 30440415, 30467901, 30495412, 30522948,
+    30550508, 30578094, 30605704, 30633339, 30660999, 30688684, 30716395, 30744130,
+    30771890, 30799675, 30827485, 30855321, 30883181, 30911067, 30938978, 30966914,
+    30994876, 31022862, 31050874, 31078911, 31106974, 31135062, 31163175, 31191313,
+    31219477, 31247667, 31275882, 31304122, 31332388, 31360679, 31388996, 31417338,
+    31445706, 31474100, 31502519, 31530964, 31559435, 31587931, 31616454, 31645001,
+    31673575, 31702174, 31730800, 31759451, 31788128, 31816831, 31845559, 31874314,
+    31903095, 31931902, 31960734, 31989593, 32018478, 32047389, 32076325, 32105289,
+    32134278, 32163293, 32192335, 32221403, 32250497, 32279617, 32308764, 32337937,
+    32367136, 32396362, 32425614, 32454892, 32484197, 32513529, 32542886, 32572271,
+    32601682, 32631119, 32660583, 32690074, 32719591, 32749135, 32778706, 32808303,
+    32837927, 32867578, 32897255, 32926960, 32956691, 32986449, 33016234, 33046045,
+    33075884, 33105750, 33135642, 33165562, 33195508, 33225482, 33255483, 33285511,
+    33315566, 33345648, 33375757, 33405893, 33436057, 33466248, 33496466, 33526711,
+    33556984, 33587284, 33617611, 33647966, 33678348, 33708758, 33739195, 33769659,
+    33800152, 33830671, 33861218, 33891793, 33922395, 33953025, 33983683, 34014368,
+    34045081, 34075822, 34106591, 34137387, 34168211, 34199063, 34229943, 34260851,
+    34291786,
+};
+
+uint32_t pitchToFreqQ8(int32_t pitch) {
+    // Floor division, so pitches below note 0 (deep slides) land in negative octaves
+    int semitone = pitch >> 16;
+    int octave = (semitone >= 0) ? semitone / 12 : -((11 - semitone) / 12);
+    if (octave > TABLE_OCTAVE) return octaveTable[12 * STEPS_PER_SEMITONE]; // far above u16 range
+    if (TABLE_OCTAVE - octave > 31) return 0;
+
+    // Table step plus a 10-bit linear interpolation between steps
+    uint32_t fine = pitch & 0xFFFF;
+    int index = (semitone - octave * 12) * STEPS_PER_SEMITONE + (fine >> 10);
+    uint32_t rem = fine & 0x3FF;
+    uint32_t lo = octaveTable[index];
+    uint32_t freq = lo + (((octaveTable[index + 1] - lo) * rem) >> 10);
+
+    return freq >> (TABLE_OCTAVE - octave);
+}
+
+// Converts MIDI note + pitch bend to frequency in Hz
+float midiNoteToHz(int note, int pitchBend) {
+    float semitoneOffset = (pitchBend / 8192.0f) * PITCH_BEND_RANGE_SEMITONES;
+    return 440.0f * pow(2.0f, ((note + OCTAVE_SHIFT + semitoneOffset) - 69) / 12.0f);
+}
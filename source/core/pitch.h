@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+
+#define OCTAVE_SHIFT 36
+#define PITCH_BEND_RANGE_SEMITONES 12   // whole semitones
+
+// Pitches are Q16 semitones with OCTAVE_SHIFT already applied, so pitch bend, slide and
+// vibrato offsets are plain integer adds before the table lookup.
+#define PITCH_ONE_SEMITONE (1 << 16)
+
+// Q16 pitch of a MIDI note plus a 14-bit pitch bend (-8192..8191).
+// One bend step is PITCH_BEND_RANGE_SEMITONES * 65536 / 8192 Q16 units, an exact integer.
+inline int32_t notePitch(int note, int pitchBend) {
+    return ((note + OCTAVE_SHIFT) << 16) + pitchBend * (PITCH_BEND_RANGE_SEMITONES * 8);
+}
+
+// Frequency in Q8 Hz for a Q16 pitch, from a precomputed table (no float math).
+// Saturates at about 134 kHz, well above what the PSG accepts.
+uint32_t pitchToFreqQ8(int32_t pitch);
+
+// Frequency as passed to soundSetFreq/soundPlay*Channel: truncated like the old float
+// conversion and clamped to the u16 range
+inline uint16_t freqQ8ToPSG(int32_t freqQ8) {
+    if (freqQ8 < 0) return 0;
+    if (freqQ8 >= (65535 << 8)) return 65535;
+    return freqQ8 >> 8;
+}
+
+inline uint16_t pitchToFreq(int32_t pitch) {
+    return freqQ8ToPSG(pitchToFreqQ8(pitch));
+}
+
+// Float reference the table was derived from. Not used on the playback path;
+// tools/nseqpitchcheck (make -C tools check) checks the table against it.
+float midiNoteToHz(int note, int pitchBend = 0);
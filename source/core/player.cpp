@@ -0,0 +1,434 @@
+#include "player.h"
+
+#include "pitch.h"
+
+// Q8 form of GLOBAL_VOLUME_MULTIPLIER, folded at compile time
+static const int globalVolumeQ8 = (int)(GLOBAL_VOLUME_MULTIPLIER * 256);
+
+void Player::start(const Sequence* seq, const EnvelopeBank* e, PsgBackend* o) {
+    scheduler.attach(seq);
+    begin(&scheduler, seq->bpm, seq->loopStart64th, seq->loopEnd64th, e, o);
+}
+
+void Player::start(SeqStream* stream, const EnvelopeBank* e, PsgBackend* o) {
+    begin(stream, stream->bpm(), stream->loopStart64th(), stream->loopEnd64th(), e, o);
+}
+
+void Player::start(const PatternSequence* song, const EnvelopeBank* e, PsgBackend* o) {
+    patternScheduler.attach(song);
+    begin(&patternScheduler, song->bpm, song->loopStart64th, song->loopEnd64th, e, o);
+}
+
+void Player::begin(EventSource* events, int bpm, int loopStart, int loopEnd, const EnvelopeBank* e, PsgBackend* o) {
+    source = events;
+    env = e;
+    mirror.setOutput(o);
+    mirror.clear();
+    out = &mirror;
+
+    for (int ch = 0; ch < 16; ch++) channels[ch] = PlayerChannel();
+    voices.reset();
+    rampMask = 0;
+    rampedTick = UINT32_MAX;
+    if (seeking) prof = seekProfiler;
+    seeking = false;
+    steals = 0;
+    tick = 0;
+    loops = 0;
+    setSong(bpm, loopStart, loopEnd);
+}
+
+void Player::setSong(int bpm, int loopStart, int loopEnd) {
+    songBpm = bpm;
+    loopStart64th = loopStart;
+    loopEnd64th = loopEnd;
+    loopState.valid = false;
+
+    // 64th-note timing: (60 / BPM) / 16 * 59.73 frames
+    if (bpm <= 0) bpm = 120;
+    framesPer64thQ16 = (int32_t)((ENVELOPE_FRAME_RATE_X100 * 60ull << 16) / (100 * 16 * bpm));
+
+    if (hasLoop())
+        source->setBookmark(loopStart64th);
+}
+
+void Player::replaceSequence(const Sequence* seq) {
+    scheduler.attach(seq);
+    source = &scheduler;
+    setSong(seq->bpm, seq->loopStart64th, seq->loopEnd64th);
+    source->seek(tick);
+    // The old song's ramps belong to it; the new one's start with its next controller lines
+    rampMask = 0;
+}
+
+bool Player::hasLoop() const {
+    return loopStart64th != -1 && loopEnd64th != -1 && loopEnd64th > loopStart64th;
+}
+
+bool Player::finished() const {
+    if (!source || seeking || hasLoop() || !source->exhausted()) return false;
+    for (int v = 0; v < 16; v++)
+        if (channels[v].active) return false;
+    return true;
+}
+
+// Returns the number of events dispatched
+uint32_t Player::dispatch() {
+    // A 64th held for a late stream chunk is dispatched again, but its ramps only move once
+    if (tick != rampedTick) {
+        stepRamps();
+        rampedTick = tick;
+    }
+
+    uint32_t n = 0;
+    while (const SeqEventView* ev = source->next(tick)) {
+        if (ev->type == EV_NOTE_ON) noteOn(*ev);
+        else if (ev->type == EV_CONTROL) control(*ev);
+        else noteOff(*ev);
+        n++;
+    }
+    return n;
+}
+
+void Player::save(Snapshot& s) const {
+    for (int v = 0; v < 16; v++) s.channels[v] = channels[v];
+    s.voices = voices;
+    for (int ch = 0; ch < PSG_CHANNELS; ch++) s.psg[ch] = mirror.state()[ch];
+    for (int ch = 0; ch < 16; ch++) s.ramps[ch] = ramps[ch];
+    s.rampMask = rampMask;
+    s.valid = true;
+}
+
+void Player::restore(const Snapshot& s) {
+    for (int v = 0; v < 16; v++) channels[v] = s.channels[v];
+    voices = s.voices;
+    mirror.restore(s.psg);
+    for (int ch = 0; ch < 16; ch++) ramps[ch] = s.ramps[ch];
+    rampMask = s.rampMask;
+}
+
+void Player::step64th() {
+    // A seek in progress stops the song's time until its preroll is done
+    if (seeking) {
+        continueSeek();
+        return;
+    }
+
+    // State before the loop start's own events, the same state a loop back arrives in
+    if (!loopState.valid && hasLoop() && tick == (uint32_t)loopStart64th)
+        save(loopState);
+
+    if (prof) {
+        uint32_t started = prof->now();
+        prof->countEvents(dispatch());
+        prof->end(PROF_DISPATCH, started);
+    } else {
+        dispatch();
+    }
+
+    // A streamed song whose next chunk is late: stay on this 64th until it arrives
+    if (source->waiting()) return;
+
+    // Handle looping
+    if (hasLoop() && tick >= (uint32_t)loopEnd64th) {
+        loops++;
+        if (loopState.valid) {
+            tick = loopStart64th;
+            source->seek(tick);
+            restore(loopState);
+        } else {
+            // Started past the loop start by a seek, so its state was never seen
+            startSeek(loopStart64th);
+        }
+    } else {
+        tick++;
+    }
+}
+
+void Player::seek(uint32_t time) {
+    startSeek(time);
+    while (!continueSeek()) {}
+}
+
+void Player::startSeek(uint32_t time) {
+    // Mute the output and start from silence, as playback from the beginning does. The
+    // preroll then runs with the output disconnected, and without counting it as playback.
+    if (!seeking) {
+        PsgVoiceState silent[PSG_CHANNELS];
+        mirror.restore(silent);
+        seekOutput = mirror.output();
+        mirror.setOutput(nullptr);
+        seekProfiler = prof;
+        prof = nullptr;
+        seeking = true;
+    }
+    for (int v = 0; v < 16; v++) channels[v] = PlayerChannel();
+    voices.reset();
+    rampMask = 0;
+    rampedTick = UINT32_MAX;
+    mirror.clear();
+
+    seekTarget = time;
+    seekFrames = 0;
+    if (!source->seekable()) {
+        tick = time;
+        source->seek(time);
+    } else {
+        tick = time > SEEK_PREROLL_64THS ? time - SEEK_PREROLL_64THS : 0;
+        source->seek(tick);
+    }
+}
+
+bool Player::continueSeek() {
+    if (!seeking) return true;
+
+    // Replay a slice of the preroll, stepping envelope frames at the rate the clock would
+    for (int n = 0; n < SEEK_SLICE_64THS && tick < seekTarget; n++, tick++) {
+        dispatch();
+        for (seekFrames += framesPer64thQ16; seekFrames >= (1 << 16); seekFrames -= 1 << 16)
+            updateFrame();
+    }
+    if (tick < seekTarget) return false;
+
+    // The output has been silent since startSeek(), so everything reached is written
+    PsgVoiceState reached[PSG_CHANNELS];
+    for (int ch = 0; ch < PSG_CHANNELS; ch++) reached[ch] = mirror.state()[ch];
+    mirror.clear();
+    mirror.setOutput(seekOutput);
+    mirror.restore(reached);
+    prof = seekProfiler;
+    seeking = false;
+    return true;
+}
+
+void Player::resendVoice(int channel) {
+    // Mid-seek the channel stays muted until the seek writes it with the rest
+    if (seeking) {
+        if (seekOutput) seekOutput->kill(channel);
+        return;
+    }
+    mirror.resend(channel);
+}
+
+void Player::noteOn(const SeqEventView& ev) {
+    const ChannelCtrl& c = *ev.ctrl;
+    int v = ev.channel;
+    if (allocating) {
+        bool stolen;
+        v = voices.allocate(ev.channel, ev.note, ev.channel >= 14 ? VOICE_NOISE_MASK : VOICE_TONE_MASK,
+                            stealPolicy, stolen);
+        if (v < 0) return;
+        if (stolen) steals++;
+        // A voice new to this note starts without the envelopes of what it played before
+        if (stolen || !channels[v].active) channels[v] = PlayerChannel();
+    }
+    PlayerChannel& pc = channels[v];
+    int hw = v + PSG_OFFSET;
+
+    int finalVol = (ev.velocity * c.channelVolume) / 127;
+    finalVol = (finalVol * globalVolumeQ8) >> 8;
+    if (finalVol > 127) finalVol = 127;
+    if (finalVol < 0) finalVol = 0;
+    pc.baseVolume = finalVol;
+    if (allocating) voices.setLevel(v, finalVol);
+    uint16_t freq = pitchToFreq(notePitch(ev.note, c.pitchBend));
+
+    if (v >= 14) {
+        // Channels 15-16 (0-indexed 14-15) play noise
+        out->playNoise(hw, freq, finalVol, c.pan);
+    } else {
+        out->playTone(hw, c.program, freq, finalVol, c.pan);
+    }
+
+    pc.notePlaying = ev.note;
+    pc.pitchBend = c.pitchBend;
+    pc.pan = c.pan;
+    pc.volume = c.channelVolume;
+    pc.program = c.program;
+    pc.cc74 = c.cc74;
+    pc.cc75 = c.cc75;
+    pc.active = true;
+
+    if (c.cc74 != -1) {
+        pc.volEnv.envPhase = ENV_ATTACK;
+        pc.volEnv.envCounter = 0;
+        pc.volEnv.amp = 0;
+    }
+
+    if (c.cc75 != -1) {
+        PitchState& pstate = pc.pitchEnv;
+        pstate.active = true; pstate.phaseState = 0;
+        pstate.phase = 0; pstate.currDepth = 0; pstate.counter = 0;
+    }
+
+    if (c.cc76 != -1 && c.cc76 < 16) {
+        const SlideNote* se = (ev.note >= 0 && ev.note < MAX_DRUM_NOTES) ? env->findSlide(c.cc76, ev.note) : nullptr;
+
+        if (se) {
+            int startNote = se->startNote;
+            int endNote = se->endNote;
+
+            // If relative mode, offset from the played note
+            if (se->relative) {
+                startNote = ev.note + startNote;
+                endNote = ev.note + endNote;
+            }
+
+            startSlide(pc.slide, startNote, endNote, se->duration64, framesPer64thQ16);
+        }
+    }
+}
+
+void Player::control(const SeqEventView& ev) {
+    // Controller-only event. It ends any ramp the channel had running, and may start one.
+    controlChannel(ev.channel, *ev.ctrl);
+
+    uint16_t bit = 1 << ev.channel;
+    if (ev.ramp) {
+        ChannelRamp& r = ramps[ev.channel];
+        r.from = *ev.ctrl;
+        r.to = *ev.ramp;
+        r.step = 0;
+        rampMask |= bit;
+    } else {
+        rampMask &= ~bit;
+    }
+}
+
+void Player::controlChannel(int channel, const ChannelCtrl& c) {
+    if (!allocating) {
+        applyControl(channel, c);
+        return;
+    }
+
+    // Every voice the channel is sounding follows it
+    for (uint16_t mask = voices.owned(channel); mask; mask &= mask - 1)
+        applyControl(__builtin_ctz(mask), c);
+}
+
+// Move every running ramp one 64th on, as if a controller line with the values in between
+// had been there
+void Player::stepRamps() {
+    for (uint16_t mask = rampMask; mask; mask &= mask - 1) {
+        int ch = __builtin_ctz(mask);
+        ChannelRamp& r = ramps[ch];
+        int step = ++r.step, length = r.to.length;
+
+        ChannelCtrl c = r.from;
+        if (r.to.fields & RAMP_BEND)   c.pitchBend = rampValue(r.from.pitchBend, r.to.pitchBend, step, length);
+        if (r.to.fields & RAMP_VOLUME) c.channelVolume = rampValue(r.from.channelVolume, r.to.volume, step, length);
+        if (r.to.fields & RAMP_PAN)    c.pan = rampValue(r.from.pan, r.to.pan, step, length);
+        controlChannel(ch, c);
+
+        if (step >= length) rampMask &= ~(1 << ch);
+    }
+}
+
+void Player::applyControl(int voice, const ChannelCtrl& c) {
+    PlayerChannel& pc = channels[voice];
+    int hw = voice + PSG_OFFSET;
+
+    pc.pitchBend = c.pitchBend;
+    pc.pan = c.pan;
+    pc.volume = c.channelVolume;
+    pc.program = c.program;
+    pc.cc74 = c.cc74;
+    pc.cc75 = c.cc75;
+    out->setPan(hw, c.pan);
+    out->setVolume(hw, pc.baseVolume);
+}
+
+void Player::silence(int voice) {
+    out->kill(voice + PSG_OFFSET);
+    channels[voice].active = false;
+    if (allocating) voices.release(voice);
+}
+
+void Player::noteOff(const SeqEventView& ev) {
+    int v = ev.channel;
+    if (allocating) {
+        // Nothing to do if another note has taken the voice since
+        v = voices.find(ev.channel, ev.note);
+        if (v < 0) return;
+        voices.keyOff(v);
+    }
+    PlayerChannel& pc = channels[v];
+    int hw = v + PSG_OFFSET;
+
+    if (!(ev.offFlags & NOTEOFF_VOLUME_ENV)) {
+        silence(v);
+    } else {
+        pc.volEnv.envPhase = ENV_RELEASE; pc.volEnv.envCounter = 0;
+    }
+    if (ev.offFlags & NOTEOFF_PITCH_ENV) {
+        PitchState& pstate = pc.pitchEnv;
+        if (pstate.active) {
+            pstate.active = false; pstate.phase = 0; pstate.currDepth = 0; pstate.counter = 0;
+            if (pc.active)
+                out->setFreq(hw, pitchToFreq(notePitch(pc.notePlaying, pc.pitchBend)));
+        }
+    }
+}
+
+void Player::stepFrame() {
+    // A seek steps the frames of its preroll itself
+    if (!seeking) updateFrame();
+}
+
+void Player::updateFrame() {
+    uint32_t started = prof ? prof->now() : 0;
+
+    // Update ADSR
+    for (int ch = 0; ch < 16; ch++) {
+        PlayerChannel& pc = channels[ch];
+        if (!pc.active) continue;
+        int envIndex = pc.cc74;
+        if (envIndex < 0 || envIndex >= 16) continue;
+
+        bool released;
+        int vol = updateVolumeEnv(pc.volEnv, env->volume[envIndex], pc.baseVolume, released);
+        if (released) silence(ch);
+        out->setVolume(ch + PSG_OFFSET, vol);
+        if (allocating) voices.setLevel(ch, vol);
+    }
+
+    if (prof) {
+        prof->end(PROF_ADSR, started);
+        started = prof->now();
+    }
+
+    // Update pitch envelopes
+    for (int ch = 0; ch < 16; ch++) {
+        PlayerChannel& pc = channels[ch];
+        if (!pc.active) continue;
+        if (pc.slide.active) continue;
+
+        int penvIndex = pc.cc75;
+        if (!pc.pitchEnv.active || penvIndex < 0 || penvIndex >= 16) continue;
+
+        int32_t pitchOffsetQ8;
+        if (updatePitchEnv(pc.pitchEnv, env->pitch[penvIndex], pitchOffsetQ8)) {
+            int32_t baseFreq = pitchToFreqQ8(notePitch(pc.notePlaying, pc.pitchBend));
+            int32_t newFreq = baseFreq + pitchOffsetQ8;
+            if (newFreq < (20 << 8)) newFreq = 20 << 8;
+            if (newFreq > (20000 << 8)) newFreq = 20000 << 8;
+            out->setFreq(ch + PSG_OFFSET, freqQ8ToPSG(newFreq));
+        }
+    }
+
+    if (prof) {
+        prof->end(PROF_PITCH, started);
+        started = prof->now();
+    }
+
+    // Update slides
+    for (int ch = 0; ch < 16; ch++) {
+        PlayerChannel& pc = channels[ch];
+        if (pc.slide.active && pc.slide.duration64 > 0) {
+            int currentNote = updateSlide(pc.slide);
+            out->setFreq(ch + PSG_OFFSET, pitchToFreq(notePitch(currentNote, pc.pitchBend)));
+        }
+    }
+
+    if (prof) prof->end(PROF_SLIDE, started);
+}
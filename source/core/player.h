@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstdint>
+
+#include "envelope.h"
+#include "profile.h"
+#include "psg.h"
+#include "scheduler.h"
+#include "seqstream.h"
+#include "sequence.h"
+#include "voices.h"
+
+#define PSG_OFFSET 0
+#define GLOBAL_VOLUME_MULTIPLIER 0.5f
+
+// Frame rate the envelopes are specified against, in 1/100 Hz
+#define ENVELOPE_FRAME_RATE_X100 5973
+
+// 64ths seek() plays silently before its target, so notes and envelopes already running
+// there are in the right state (four 4/4 bars)
+#define SEEK_PREROLL_64THS 256
+
+// Most 64ths of the preroll continueSeek() replays per call, so a seek from the sequencer
+// tick is spread over several ticks instead of landing on one
+#define SEEK_SLICE_64THS 32
+
+// State of one hardware voice. Without voice allocation voice N plays song channel N.
+struct PlayerChannel {
+    int notePlaying = 60;
+    int pitchBend = 0;
+    int pan = 64;
+    int volume = 127;
+    int program = 0;
+    int cc74 = -1;
+    int cc75 = -1;
+    bool active = false;
+    int baseVolume = 127;
+
+    NoteState volEnv;
+    PitchState pitchEnv;
+    SlideState slide;
+};
+
+// The sequencer core. Events are dispatched once per 64th by step64th(); envelopes, vibrato
+// and slides advance once per envelope frame by stepFrame(). Both are driven by a SeqClock,
+// so the player itself never looks at vblank or wall-clock time.
+//
+// The first time playback reaches the loop start, the player saves its whole state there:
+// every voice with its envelopes and slide, the voice allocation and what each PSG channel
+// holds. Looping back puts that state back, so the loop sounds exactly like the first pass.
+class Player {
+public:
+    // Give notes any free voice of the right kind instead of the voice numbered like their
+    // channel, so overlapping notes on one channel no longer cut each other off. Takes
+    // effect on the next start().
+    void setVoiceAllocation(bool enabled, StealPolicy policy = STEAL_RELEASING) {
+        allocating = enabled;
+        stealPolicy = policy;
+    }
+    bool allocatingVoices() const { return allocating; }
+
+    // Time event dispatch and the envelope, pitch and slide updates (nullptr: don't)
+    void setProfiler(Profiler* p) { prof = p; }
+
+    // Notes that took a voice from a note still sounding, since start()
+    uint32_t voiceSteals() const { return steals; }
+
+    // Start seq from the beginning. All three must outlive the player.
+    void start(const Sequence* seq, const EnvelopeBank* envelopes, PsgBackend* out);
+
+    // Same for a song streamed from a file (already opened)
+    void start(SeqStream* stream, const EnvelopeBank* envelopes, PsgBackend* out);
+
+    // Same for a song stored as patterns
+    void start(const PatternSequence* song, const EnvelopeBank* envelopes, PsgBackend* out);
+
+    // Play seq from here on instead of the in-memory song. Notes already sounding carry on
+    // untouched and the next events come from seq at the same 64th, so an edit is heard
+    // without a gap. The loop is saved again the next time playback reaches its start. Not
+    // safe to call while step64th() or stepFrame() may run.
+    void replaceSequence(const Sequence* seq);
+
+    // Take envelope tables from envelopes from the next frame on. Voices keep their envelope
+    // phase and position.
+    void setEnvelopes(const EnvelopeBank* envelopes) { env = envelopes; }
+
+    // Dispatch every event of the current 64th, then move to the next one (or loop back)
+    void step64th();
+
+    // Advance the volume envelopes, pitch envelopes and slides by one envelope frame
+    void stepFrame();
+
+    // Continue from time (a 64th) as if the song had played up to it. In-memory songs replay
+    // the SEEK_PREROLL_64THS before it silently; a streamed song starts there from silence with
+    // the controller values of the bookmark or the current ones, and without the ramps that
+    // were running. The whole preroll is replayed before returning. Not safe to call while
+    // step64th() or stepFrame() may run.
+    void seek(uint32_t time);
+
+    // The same seek done a slice at a time: startSeek() mutes the output and sets it up, then
+    // each continueSeek() replays up to SEEK_SLICE_64THS of the preroll and returns true once
+    // the target is reached and the output has been given its state. Meanwhile step64th()
+    // continues the seek instead of moving the song on, and stepFrame() does nothing. Neither
+    // is safe to call while step64th() or stepFrame() may run.
+    void startSeek(uint32_t time);
+    bool continueSeek();
+    bool seekInProgress() const { return seeking; }
+
+    // The 64th being played, or the one a seek in progress is heading for
+    uint32_t position() const { return seeking ? seekTarget : tick; }
+    int loopCount() const { return loops; }
+    bool hasLoop() const;
+
+    // True once a song without a loop has dispatched its last event and every voice is silent
+    bool finished() const;
+
+    // Write what the player holds for a hardware channel to the output again
+    void resendVoice(int channel);
+    int bpm() const { return songBpm; }
+    const PlayerChannel& channel(int voice) const { return channels[voice]; }
+
+    // Length of a 64th in envelope frames (Q16)
+    int32_t framesPer64th() const { return framesPer64thQ16; }
+
+private:
+    // A song channel's controller ramp: the values it started from and where it is going
+    struct ChannelRamp {
+        ChannelCtrl from;
+        CtrlRamp to;
+        uint16_t step = 0;
+    };
+
+    // Everything seek() and looping put back
+    struct Snapshot {
+        bool valid = false;
+        PlayerChannel channels[16];
+        VoiceAllocator voices;
+        PsgVoiceState psg[PSG_CHANNELS];
+        ChannelRamp ramps[16];
+        uint16_t rampMask = 0;
+    };
+
+    void begin(EventSource* events, int bpm, int loopStart, int loopEnd, const EnvelopeBank* envelopes, PsgBackend* out);
+    void setSong(int bpm, int loopStart, int loopEnd);
+    uint32_t dispatch();
+    void save(Snapshot& s) const;
+    void restore(const Snapshot& s);
+    void noteOn(const SeqEventView& ev);
+    void noteOff(const SeqEventView& ev);
+    void control(const SeqEventView& ev);
+    void controlChannel(int channel, const ChannelCtrl& c);
+    void applyControl(int voice, const ChannelCtrl& c);
+    void stepRamps();
+    void updateFrame();
+    void silence(int voice);
+
+    EventSource* source = nullptr;
+    const EnvelopeBank* env = nullptr;
+    PsgBackend* out = nullptr;     // &mirror, which forwards to the real output
+    PsgMirror mirror;
+    Profiler* prof = nullptr;
+    int songBpm = 0;
+    int loopStart64th = -1, loopEnd64th = -1;
+
+    Scheduler scheduler;   // the source for in-memory sequences
+    PatternScheduler patternScheduler;  // and for pattern songs
+    PlayerChannel channels[16];   // by hardware voice
+    ChannelRamp ramps[16];        // by song channel
+    uint16_t rampMask = 0;        // channels with a ramp running
+    uint32_t rampedTick = UINT32_MAX;  // 64th the ramps last moved on
+    VoiceAllocator voices;
+    bool allocating = false;
+    StealPolicy stealPolicy = STEAL_RELEASING;
+    uint32_t steals = 0;
+    Snapshot loopState;         // at the loop start, once playback has got there
+    uint32_t tick = 0;
+    int loops = 0;
+    bool seeking = false;
+    uint32_t seekTarget = 0;
+    int32_t seekFrames = 0;             // Q16 envelope frames owed by the preroll
+    PsgBackend* seekOutput = nullptr;   // the output muted while seeking
+    Profiler* seekProfiler = nullptr;
+    int32_t framesPer64thQ16 = 0;
+};
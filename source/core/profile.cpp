@@ -0,0 +1,67 @@
+#include "profile.h"
+
+static const char* const sectionNames[PROF_SECTIONS] = { "dispatch", "adsr", "pitch", "slide", "display", "tick" };
+
+const char* profileSectionName(int section) {
+    return (section >= 0 && section < PROF_SECTIONS) ? sectionNames[section] : "?";
+}
+
+void Profiler::end(ProfileSection section, uint32_t started) {
+    if (!clock) return;
+    uint32_t ticks = clock() - started;
+
+    ProfileStats& s = stats[section];
+    s.calls++;
+    s.total += ticks;
+    if (ticks > s.max) s.max = ticks;
+
+    int bucket = ticks ? 31 - __builtin_clz(ticks) : 0;
+    if (bucket >= PROFILE_TIME_BUCKETS) bucket = PROFILE_TIME_BUCKETS - 1;
+    s.histogram[bucket]++;
+
+    if (section == PROF_TICK && budget && ticks > budget) overrunCount++;
+}
+
+void Profiler::countEvents(uint32_t n) {
+    if (!clock) return;
+    events[n < PROFILE_EVENT_BUCKETS - 1 ? n : PROFILE_EVENT_BUCKETS - 1]++;
+}
+
+void Profiler::reset() {
+    for (int s = 0; s < PROF_SECTIONS; s++) stats[s] = ProfileStats();
+    for (int i = 0; i < PROFILE_EVENT_BUCKETS; i++) events[i] = 0;
+    overrunCount = 0;
+}
+
+void printProfile(FILE* f, const Profiler& p) {
+    fprintf(f, "# clock %u Hz, tick budget %u (%u us)\n", p.hz(), p.tickBudget(), p.toMicros(p.tickBudget()));
+    fprintf(f, "%-9s %10s %10s %10s\n", "section", "calls", "avg_us", "max_us");
+    for (int s = 0; s < PROF_SECTIONS; s++) {
+        const ProfileStats& st = p.section(s);
+        double avg = st.calls ? (double)st.total / st.calls * 1e6 / p.hz() : 0.0;
+        fprintf(f, "%-9s %10u %10.2f %10u\n", profileSectionName(s), st.calls, avg, p.toMicros(st.max));
+    }
+    fprintf(f, "overruns %u\n", p.overruns());
+
+    // Only the buckets with samples, as "section ticks>=N count"
+    fprintf(f, "\n# time histograms: samples of at least N clock ticks (and under 2N)\n");
+    for (int s = 0; s < PROF_SECTIONS; s++) {
+        const ProfileStats& st = p.section(s);
+        for (int b = 0; b < PROFILE_TIME_BUCKETS; b++)
+            if (st.histogram[b])
+                fprintf(f, "%-9s %10u %10u\n", profileSectionName(s), b ? 1u << b : 0u, st.histogram[b]);
+    }
+
+    fprintf(f, "\n# events per 64th (the last row is %d or more)\n", PROFILE_EVENT_BUCKETS - 1);
+    const uint32_t* ev = p.eventHistogram();
+    for (int i = 0; i < PROFILE_EVENT_BUCKETS; i++)
+        if (ev[i]) fprintf(f, "events %2d %10u\n", i, ev[i]);
+}
+
+bool saveProfile(const char* path, const Profiler& profiler) {
+    FILE* f = fopen(path, "w");
+    if (!f) return false;
+    printProfile(f, profiler);
+    bool ok = !ferror(f);
+    return fclose(f) == 0 && ok;
+}
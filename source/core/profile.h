@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+// Time histogram buckets: bucket n counts samples of 2^n to 2^(n+1)-1 clock ticks (bucket 0
+// also counts 0), the last bucket everything longer
+#define PROFILE_TIME_BUCKETS 24
+
+// Events-per-64th histogram buckets: 0 to 15 events, then 16 or more
+#define PROFILE_EVENT_BUCKETS 17
+
+enum ProfileSection {
+    PROF_DISPATCH,  // events of one 64th
+    PROF_ADSR,      // volume envelopes of one frame
+    PROF_PITCH,     // pitch envelopes of one frame
+    PROF_SLIDE,     // slides of one frame
+    PROF_DISPLAY,   // one HUD update
+    PROF_TICK,      // one whole sequencer tick (every 64th and frame due, plus the flush)
+    PROF_SECTIONS
+};
+
+struct ProfileStats {
+    uint32_t calls = 0;
+    uint64_t total = 0;     // clock ticks
+    uint32_t max = 0;
+    uint32_t histogram[PROFILE_TIME_BUCKETS] = {};
+};
+
+// Counters for the player's hot paths. The clock is supplied by the platform: a hardware
+// timer on the DS, std::chrono on the host. Without a clock every call returns at once, so
+// an idle profiler costs one test per section.
+class Profiler {
+public:
+    typedef uint32_t (*ClockFn)();
+
+    // now: free-running counter that wraps at 2^32, counting hz per second
+    void setClock(ClockFn now, uint32_t hz) { clock = now; clockHz = hz; }
+
+    // A PROF_TICK longer than this many clock ticks counts as an overrun
+    void setTickBudget(uint32_t ticks) { budget = ticks; }
+
+    uint32_t now() const { return clock ? clock() : 0; }
+
+    // Record a section that began at started (a now() value)
+    void end(ProfileSection section, uint32_t started);
+
+    // Record how many events one 64th dispatched
+    void countEvents(uint32_t events);
+
+    void reset();
+
+    bool enabled() const { return clock != nullptr; }
+    uint32_t hz() const { return clockHz; }
+    uint32_t tickBudget() const { return budget; }
+    const ProfileStats& section(int s) const { return stats[s]; }
+    const uint32_t* eventHistogram() const { return events; }
+    uint32_t overruns() const { return overrunCount; }
+
+    uint32_t toMicros(uint64_t ticks) const { return clockHz ? (uint32_t)(ticks * 1000000 / clockHz) : 0; }
+
+private:
+    ClockFn clock = nullptr;
+    uint32_t clockHz = 0;
+    uint32_t budget = 0;
+
+    ProfileStats stats[PROF_SECTIONS];
+    uint32_t events[PROFILE_EVENT_BUCKETS] = {};
+    uint32_t overrunCount = 0;
+};
+
+const char* profileSectionName(int section);
+
+// Plain-text report of every counter
+void printProfile(FILE* f, const Profiler& profiler);
+
+// printProfile to a file. Returns false on any I/O error.
+bool saveProfile(const char* path, const Profiler& profiler);
@@ -0,0 +1,206 @@
+#include "psg.h"
+
+static const char* const writeKindNames[PSG_WRITE_KINDS] = { "tone", "noise", "freq", "volume", "pan", "kill" };
+
+const char* psgWriteKindName(int kind) {
+    return (kind >= 0 && kind < PSG_WRITE_KINDS) ? writeKindNames[kind] : "?";
+}
+
+uint32_t PsgWriteStats::totalRequested() const {
+    uint32_t total = 0;
+    for (int i = 0; i < PSG_WRITE_KINDS; i++) total += requested[i];
+    return total;
+}
+
+uint32_t PsgWriteStats::totalIssued() const {
+    uint32_t total = 0;
+    for (int i = 0; i < PSG_WRITE_KINDS; i++) total += issued[i];
+    return total;
+}
+
+void PsgMirror::playTone(int channel, int duty, uint16_t freq, uint8_t volume, uint8_t pan) {
+    PsgVoiceState& v = voices[channel];
+    v.mode = MODE_TONE;
+    v.duty = (uint8_t)duty;
+    v.freq = freq;
+    v.volume = volume;
+    v.pan = pan;
+    if (out) out->playTone(channel, duty, freq, volume, pan);
+}
+
+void PsgMirror::playNoise(int channel, uint16_t freq, uint8_t volume, uint8_t pan) {
+    PsgVoiceState& v = voices[channel];
+    v.mode = MODE_NOISE;
+    v.duty = 0;
+    v.freq = freq;
+    v.volume = volume;
+    v.pan = pan;
+    if (out) out->playNoise(channel, freq, volume, pan);
+}
+
+void PsgMirror::setFreq(int channel, uint16_t freq) {
+    voices[channel].freq = freq;
+    if (out) out->setFreq(channel, freq);
+}
+
+void PsgMirror::setVolume(int channel, uint8_t volume) {
+    voices[channel].volume = volume;
+    if (out) out->setVolume(channel, volume);
+}
+
+void PsgMirror::setPan(int channel, uint8_t pan) {
+    voices[channel].pan = pan;
+    if (out) out->setPan(channel, pan);
+}
+
+void PsgMirror::kill(int channel) {
+    voices[channel].mode = MODE_OFF;
+    if (out) out->kill(channel);
+}
+
+void PsgMirror::restore(const PsgVoiceState to[PSG_CHANNELS]) {
+    for (int ch = 0; ch < PSG_CHANNELS; ch++) {
+        const PsgVoiceState& want = to[ch];
+        const PsgVoiceState had = voices[ch];
+
+        if (want.mode == MODE_OFF) {
+            if (had.mode != MODE_OFF) kill(ch);
+            voices[ch] = want;
+            continue;
+        }
+        if (had.mode != want.mode || had.duty != want.duty) {
+            if (want.mode == MODE_NOISE) playNoise(ch, want.freq, want.volume, want.pan);
+            else playTone(ch, want.duty, want.freq, want.volume, want.pan);
+            continue;
+        }
+        // Still sounding the same way: only move what changed
+        if (had.freq != want.freq) setFreq(ch, want.freq);
+        if (had.volume != want.volume) setVolume(ch, want.volume);
+        if (had.pan != want.pan) setPan(ch, want.pan);
+    }
+}
+
+void PsgMirror::resend(int ch) {
+    const PsgVoiceState v = voices[ch];
+    if (v.mode == MODE_OFF) kill(ch);
+    else if (v.mode == MODE_NOISE) playNoise(ch, v.freq, v.volume, v.pan);
+    else playTone(ch, v.duty, v.freq, v.volume, v.pan);
+}
+
+void PsgMirror::clear() {
+    for (int ch = 0; ch < PSG_CHANNELS; ch++) voices[ch] = PsgVoiceState();
+}
+
+void PsgMirror::assume(const PsgVoiceState held[PSG_CHANNELS]) {
+    for (int ch = 0; ch < PSG_CHANNELS; ch++) voices[ch] = held[ch];
+}
+
+void PsgShadow::play(int channel, uint8_t mode, int duty, uint16_t freq, uint8_t volume, uint8_t pan) {
+    ChannelShadow& s = channels[channel];
+
+    // A key-on sets every register, so it replaces anything still pending (including a kill)
+    s.pending = PEND_PLAY;
+    s.nextMode = mode;
+    s.nextDuty = (uint8_t)duty;
+    s.nextFreq = freq;
+    s.nextVolume = volume;
+    s.nextPan = pan;
+}
+
+void PsgShadow::playTone(int channel, int duty, uint16_t freq, uint8_t volume, uint8_t pan) {
+    writeStats.requested[PSG_WRITE_TONE]++;
+    play(channel, PSG_TONE, duty, freq, volume, pan);
+}
+
+void PsgShadow::playNoise(int channel, uint16_t freq, uint8_t volume, uint8_t pan) {
+    writeStats.requested[PSG_WRITE_NOISE]++;
+    play(channel, PSG_NOISE, 0, freq, volume, pan);
+}
+
+void PsgShadow::setFreq(int channel, uint16_t freq) {
+    writeStats.requested[PSG_WRITE_FREQ]++;
+    ChannelShadow& s = channels[channel];
+    if (!sounding(s)) return;
+
+    s.nextFreq = freq;
+    if (s.pending & PEND_PLAY) return; // goes out with the key-on
+    if (freq != s.freq) s.pending |= PEND_FREQ;
+    else s.pending &= ~PEND_FREQ;
+}
+
+void PsgShadow::setVolume(int channel, uint8_t volume) {
+    writeStats.requested[PSG_WRITE_VOLUME]++;
+    ChannelShadow& s = channels[channel];
+    if (!sounding(s)) return;
+
+    s.nextVolume = volume;
+    if (s.pending & PEND_PLAY) return;
+    if (volume != s.volume) s.pending |= PEND_VOLUME;
+    else s.pending &= ~PEND_VOLUME;
+}
+
+void PsgShadow::setPan(int channel, uint8_t pan) {
+    writeStats.requested[PSG_WRITE_PAN]++;
+    ChannelShadow& s = channels[channel];
+    if (!sounding(s)) return;
+
+    s.nextPan = pan;
+    if (s.pending & PEND_PLAY) return;
+    if (pan != s.pan) s.pending |= PEND_PAN;
+    else s.pending &= ~PEND_PAN;
+}
+
+void PsgShadow::kill(int channel) {
+    writeStats.requested[PSG_WRITE_KILL]++;
+    ChannelShadow& s = channels[channel];
+    if (!sounding(s)) return;
+
+    // A key-on in the same tick is kept, so a note that starts and stops together still sounds
+    s.pending = (s.pending & PEND_PLAY) | PEND_KILL;
+}
+
+void PsgShadow::flush() {
+    for (int ch = 0; ch < PSG_CHANNELS; ch++) {
+        ChannelShadow& s = channels[ch];
+        if (!s.pending) continue;
+
+        if (s.pending & PEND_PLAY) {
+            if (s.nextMode == PSG_NOISE) {
+                out->playNoise(ch, s.nextFreq, s.nextVolume, s.nextPan);
+                writeStats.issued[PSG_WRITE_NOISE]++;
+            } else {
+                out->playTone(ch, s.nextDuty, s.nextFreq, s.nextVolume, s.nextPan);
+                writeStats.issued[PSG_WRITE_TONE]++;
+            }
+            s.mode = s.nextMode;
+            s.duty = s.nextDuty;
+            s.freq = s.nextFreq;
+            s.volume = s.nextVolume;
+            s.pan = s.nextPan;
+        } else {
+            if (s.pending & PEND_FREQ) {
+                out->setFreq(ch, s.nextFreq);
+                writeStats.issued[PSG_WRITE_FREQ]++;
+                s.freq = s.nextFreq;
+            }
+            if (s.pending & PEND_VOLUME) {
+                out->setVolume(ch, s.nextVolume);
+                writeStats.issued[PSG_WRITE_VOLUME]++;
+                s.volume = s.nextVolume;
+            }
+            if (s.pending & PEND_PAN) {
+                out->setPan(ch, s.nextPan);
+                writeStats.issued[PSG_WRITE_PAN]++;
+                s.pan = s.nextPan;
+            }
+        }
+
+        if (s.pending & PEND_KILL) {
+            out->kill(ch);
+            writeStats.issued[PSG_WRITE_KILL]++;
+            s.mode = PSG_OFF;
+        }
+
+        s.pending = 0;
+    }
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstdint>
+
+#define PSG_CHANNELS 16
+
+// Sound output driven by the player. Channels are hardware PSG channel numbers. The DS build
+// forwards these to libnds; host tools plug in their own implementations.
+class PsgBackend {
+public:
+    virtual ~PsgBackend() {}
+
+    virtual void playTone(int channel, int duty, uint16_t freq, uint8_t volume, uint8_t pan) = 0;
+    virtual void playNoise(int channel, uint16_t freq, uint8_t volume, uint8_t pan) = 0;
+    virtual void setFreq(int channel, uint16_t freq) = 0;
+    virtual void setVolume(int channel, uint8_t volume) = 0;
+    virtual void setPan(int channel, uint8_t pan) = 0;
+    virtual void kill(int channel) = 0;
+};
+
+enum PsgWriteKind { PSG_WRITE_TONE, PSG_WRITE_NOISE, PSG_WRITE_FREQ, PSG_WRITE_VOLUME, PSG_WRITE_PAN, PSG_WRITE_KILL, PSG_WRITE_KINDS };
+
+// Per kind of write: how many the player asked for and how many reached the hardware
+struct PsgWriteStats {
+    uint32_t requested[PSG_WRITE_KINDS] = {};
+    uint32_t issued[PSG_WRITE_KINDS] = {};
+
+    uint32_t totalRequested() const;
+    uint32_t totalIssued() const;
+};
+
+const char* psgWriteKindName(int kind);
+
+// What one channel was last set to
+struct PsgVoiceState {
+    uint8_t mode = 0;       // 0 off, 1 tone, 2 noise
+    uint8_t duty = 0, volume = 0, pan = 64;
+    uint16_t freq = 0;
+};
+
+// Passes writes on to an output and remembers the last value of every channel, so the player
+// can save what the hardware holds and later put it back. With no output the writes are only
+// remembered, which lets the player run ahead silently.
+class PsgMirror : public PsgBackend {
+public:
+    enum { MODE_OFF, MODE_TONE, MODE_NOISE };
+
+    void setOutput(PsgBackend* o) { out = o; }
+    PsgBackend* output() const { return out; }
+
+    void playTone(int channel, int duty, uint16_t freq, uint8_t volume, uint8_t pan) override;
+    void playNoise(int channel, uint16_t freq, uint8_t volume, uint8_t pan) override;
+    void setFreq(int channel, uint16_t freq) override;
+    void setVolume(int channel, uint8_t volume) override;
+    void setPan(int channel, uint8_t pan) override;
+    void kill(int channel) override;
+
+    const PsgVoiceState* state() const { return voices; }
+
+    // Make every channel hold to instead, writing only what differs from what it holds now
+    void restore(const PsgVoiceState to[PSG_CHANNELS]);
+
+    // Forget everything (all channels off) without writing anything
+    void clear();
+
+    // Take held as what the channels hold, without writing anything
+    void assume(const PsgVoiceState held[PSG_CHANNELS]);
+
+    // Write everything one channel holds again, for an output that was given to someone else
+    void resend(int channel);
+
+private:
+    PsgBackend* out = nullptr;
+    PsgVoiceState voices[PSG_CHANNELS];
+};
+
+// Keeps a copy of what each hardware channel is currently set to and collects the player's
+// writes until flush(). Only the net change per channel is then sent on: a value the channel
+// already holds, a write to a silent channel, or a value that was overwritten again before
+// the flush never costs a message.
+class PsgShadow : public PsgBackend {
+public:
+    explicit PsgShadow(PsgBackend* out = nullptr) : out(out) {}
+
+    void setOutput(PsgBackend* o) { out = o; }
+
+    void playTone(int channel, int duty, uint16_t freq, uint8_t volume, uint8_t pan) override;
+    void playNoise(int channel, uint16_t freq, uint8_t volume, uint8_t pan) override;
+    void setFreq(int channel, uint16_t freq) override;
+    void setVolume(int channel, uint8_t volume) override;
+    void setPan(int channel, uint8_t pan) override;
+    void kill(int channel) override;
+
+    // Send every pending change to the output, channel by channel
+    void flush();
+
+    const PsgWriteStats& stats() const { return writeStats; }
+
+private:
+    enum { PSG_OFF, PSG_TONE, PSG_NOISE };
+    enum { PEND_PLAY = 1, PEND_KILL = 2, PEND_FREQ = 4, PEND_VOLUME = 8, PEND_PAN = 16 };
+
+    struct ChannelShadow {
+        // What the hardware holds
+        uint8_t mode = PSG_OFF;
+        uint8_t duty = 0, volume = 0, pan = 64;
+        uint16_t freq = 0;
+
+        // What it will hold after the next flush
+        uint8_t pending = 0;
+        uint8_t nextMode = PSG_OFF;
+        uint8_t nextDuty = 0, nextVolume = 0, nextPan = 64;
+        uint16_t nextFreq = 0;
+    };
+
+    void play(int channel, uint8_t mode, int duty, uint16_t freq, uint8_t volume, uint8_t pan);
+
+    // True if the channel will be sounding after the flush, so value writes matter
+    bool sounding(const ChannelShadow& s) const {
+        if (s.pending & PEND_KILL) return false;
+        return (s.pending & PEND_PLAY) || s.mode != PSG_OFF;
+    }
+
+    PsgBackend* out;
+    ChannelShadow channels[PSG_CHANNELS];
+    PsgWriteStats writeStats;
+};
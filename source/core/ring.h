@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Fixed-size queue between exactly one producer and one consumer, which may be two threads or
+// the main loop and an interrupt handler. Neither side ever waits for the other: push() fails
+// when the queue is full and pop() when it is empty. Each index is written by one side only
+// and read by the other with acquire/release ordering, so the queue needs nothing but atomic
+// loads and stores of a 32-bit word, which every target does without a lock.
+//
+// N must be a power of two; the queue holds up to N items.
+template <class T, uint32_t N>
+class SpscRing {
+    static_assert(N && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+public:
+    // Producer side
+    bool push(const T& item) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N) return false;
+        items[t & (N - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T& item) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        item = items[h & (N - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Either side; only a hint, as the other side may change it at once
+    uint32_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<uint32_t> head{0};  // next item to pop, written by the consumer
+    std::atomic<uint32_t> tail{0};  // next free slot, written by the producer
+    T items[N];
+};
@@ -0,0 +1,150 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+void Scheduler::attach(const Sequence* s) {
+    seq = s;
+    cursor = 0;
+    for (int ch = 0; ch < 16; ch++) {
+        ctrl[ch] = ChannelCtrl();
+        bookmarkCtrl[ch] = ChannelCtrl();
+    }
+    bookmarkPos = 0;
+}
+
+size_t Scheduler::lowerBound(uint32_t time) const {
+    return std::lower_bound(seq->time.begin(), seq->time.end(), time) - seq->time.begin();
+}
+
+// Controller values before event pos, which is the first event due on or after time
+void Scheduler::ctrlAt(uint32_t time, size_t pos, ChannelCtrl out[16]) const {
+    const std::vector<SeqKeyframe>& keyframes = seq->keyframes;
+    size_t from = 0;
+    if (keyframes.empty()) {
+        for (int ch = 0; ch < 16; ch++) out[ch] = ChannelCtrl();
+    } else {
+        size_t k = time / SEQ_KEYFRAME_INTERVAL;
+        if (k >= keyframes.size()) k = keyframes.size() - 1;
+        const SeqKeyframe& key = keyframes[k];
+        for (int ch = 0; ch < 16; ch++) key.ctrl[ch].unpack(out[ch]);
+        from = key.pos;
+    }
+
+    for (size_t i = from; i < pos; i++) {
+        uint32_t e = seq->events[i];
+        if (evType(e) >= EV_CONTROL)
+            applyCtrlDelta(&seq->ctrl[evCtrlOffset(e)], out[evChannel(e)]);
+    }
+}
+
+void Scheduler::setBookmark(uint32_t time) {
+    bookmarkPos = lowerBound(time);
+    ctrlAt(time, bookmarkPos, bookmarkCtrl);
+}
+
+void Scheduler::seek(uint32_t time) {
+    cursor = lowerBound(time);
+    if (cursor == bookmarkPos) {
+        for (int ch = 0; ch < 16; ch++) ctrl[ch] = bookmarkCtrl[ch];
+    } else {
+        ctrlAt(time, cursor, ctrl);
+    }
+}
+
+const SeqEventView* Scheduler::next(uint32_t time) {
+    while (cursor < seq->size() && seq->time[cursor] <= time) {
+        uint32_t e = seq->events[cursor++];
+        SeqEventType type = evType(e);
+        int ch = evChannel(e);
+
+        if (type >= EV_CONTROL) {
+            applyCtrlDelta(&seq->ctrl[evCtrlOffset(e)], ctrl[ch], &ramp);
+            if (type == EV_NOTE_CTRL) continue; // the note-on that follows reports it
+        }
+
+        view.type = type;
+        view.channel = ch;
+        view.note = (type == EV_CONTROL) ? -1 : evNote(e);
+        view.velocity = (type == EV_NOTE_ON) ? evVelocity(e) : 0;
+        view.offFlags = (type == EV_NOTE_OFF) ? evOffFlags(e) : 0;
+        view.ctrl = &ctrl[ch];
+        view.ramp = (type == EV_CONTROL && ramp.length) ? &ramp : nullptr;
+        return &view;
+    }
+    return nullptr;
+}
+
+void PatternScheduler::attach(const PatternSequence* s) {
+    song = s;
+    cursor.attach(s);
+    for (int ch = 0; ch < 16; ch++) ctrl[ch] = ChannelCtrl();
+    bookmarkTime = UINT32_MAX;
+}
+
+void PatternScheduler::ctrlAtCursor(ChannelCtrl out[16]) const {
+    PatternCursor::Position pos = cursor.position();
+    for (int ch = 0; ch < 16; ch++) {
+        out[ch] = ChannelCtrl();
+        uint32_t o = pos.order[ch], count = pos.index[ch];
+        if (o >= cursor.endOrder(ch)) {
+            // Played out: the values after its last pattern
+            if (o == cursor.firstOrder(ch)) continue;
+            o--;
+            count = song->patterns[song->orders[o].pattern].count;
+        }
+        // Without keyframes, every pattern of the channel before this one is replayed too
+        uint32_t from = o;
+        if (song->keyframes.size() == song->orders.size()) song->keyframes[o].unpack(out[ch]);
+        else from = cursor.firstOrder(ch);
+        for (; from <= o; from++) {
+            const SeqPattern& p = song->patterns[song->orders[from].pattern];
+            uint32_t n = from == o ? count : p.count;
+            for (uint32_t i = 0; i < n; i++) {
+                uint32_t e = song->events[p.first + i];
+                if (evType(e) >= EV_CONTROL) applyCtrlDelta(&song->ctrl[evCtrlOffset(e)], out[ch]);
+            }
+        }
+    }
+}
+
+void PatternScheduler::setBookmark(uint32_t time) {
+    PatternCursor::Position here = cursor.position();
+    cursor.seek(time);
+    bookmarkPos = cursor.position();
+    bookmarkTime = time;
+    ctrlAtCursor(bookmarkCtrl);
+    cursor.setPosition(here);
+}
+
+void PatternScheduler::seek(uint32_t time) {
+    if (time == bookmarkTime) {
+        cursor.setPosition(bookmarkPos);
+        for (int ch = 0; ch < 16; ch++) ctrl[ch] = bookmarkCtrl[ch];
+        return;
+    }
+    cursor.seek(time);
+    ctrlAtCursor(ctrl);
+}
+
+const SeqEventView* PatternScheduler::next(uint32_t time) {
+    uint32_t t, e;
+    while (cursor.nextTime() <= time && cursor.next(t, e)) {
+        SeqEventType type = evType(e);
+        int ch = evChannel(e);
+
+        if (type >= EV_CONTROL) {
+            applyCtrlDelta(&song->ctrl[evCtrlOffset(e)], ctrl[ch], &ramp);
+            if (type == EV_NOTE_CTRL) continue; // the note-on that follows reports it
+        }
+
+        view.type = type;
+        view.channel = ch;
+        view.note = (type == EV_CONTROL) ? -1 : evNote(e);
+        view.velocity = (type == EV_NOTE_ON) ? evVelocity(e) : 0;
+        view.offFlags = (type == EV_NOTE_OFF) ? evOffFlags(e) : 0;
+        view.ctrl = &ctrl[ch];
+        view.ramp = (type == EV_CONTROL && ramp.length) ? &ramp : nullptr;
+        return &view;
+    }
+    return nullptr;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "pattern.h"
+#include "sequence.h"
+
+// A due event with its controller delta already resolved
+struct SeqEventView {
+    SeqEventType type;          // EV_NOTE_ON, EV_NOTE_OFF or EV_CONTROL (EV_NOTE_CTRL is folded in)
+    int channel;
+    int note;
+    int velocity;               // note-on only
+    int offFlags;               // note-off only: NOTEOFF_* envelopes the note started with
+    const ChannelCtrl* ctrl;    // note-on/control: the channel's controller values for this event
+    const CtrlRamp* ramp;       // control only: a ramp that starts from ctrl, or nullptr
+};
+
+// Where the player takes its events from: a Sequence in memory (Scheduler) or a compiled
+// file read a chunk at a time (SeqStream)
+class EventSource {
+public:
+    virtual ~EventSource() {}
+
+    // Remember the position of time so seek(time) restores controller state cheaply
+    virtual void setBookmark(uint32_t time) = 0;
+
+    // Move the cursor to the first event due on or after time
+    virtual void seek(uint32_t time) = 0;
+
+    // Next event due on or before time, or nullptr once the cursor has caught up
+    virtual const SeqEventView* next(uint32_t time) = 0;
+
+    // True while next() is holding events back because their data is not in memory yet
+    virtual bool waiting() const { return false; }
+
+    // True if seek() restores exact controller values for any time, not only the bookmark
+    virtual bool seekable() const { return false; }
+
+    // True once next() has returned every event (a stream never says so)
+    virtual bool exhausted() const { return false; }
+};
+
+// Moving cursor over the time-sorted events of a Sequence. Each tick only touches the events
+// that are due, so per-tick cost depends on how many events fire in that tick rather than on
+// the song length. The cursor also tracks each channel's controller values, since the packed
+// events only store what changed.
+//
+// seek() to any time starts from the sequence's keyframe before it and replays at most one
+// interval of events. attach() only resets the cursor, so starting a song or an effect costs
+// the same whatever its length and never allocates.
+class Scheduler : public EventSource {
+public:
+    // Start at the beginning of seq (the sequence must outlive the scheduler). A sequence
+    // without keyframes still plays, but every seek replays it from the start.
+    void attach(const Sequence* seq);
+
+    // Remember the position of time so seek(time) restores controller state without replaying
+    // from the start (used for the loop start)
+    void setBookmark(uint32_t time) override;
+
+    // Move the cursor to the first event due on or after time (binary search, then the events
+    // since the keyframe before it)
+    void seek(uint32_t time) override;
+
+    // Next event due on or before time, or nullptr once the cursor has caught up
+    const SeqEventView* next(uint32_t time) override;
+
+    bool seekable() const override { return true; }
+    bool exhausted() const override { return cursor >= seq->size(); }
+
+private:
+    size_t lowerBound(uint32_t time) const;
+    void ctrlAt(uint32_t time, size_t pos, ChannelCtrl out[16]) const;
+
+    const Sequence* seq = nullptr;
+    size_t cursor = 0;
+    ChannelCtrl ctrl[16];
+    CtrlRamp ramp;
+
+    size_t bookmarkPos = 0;
+    ChannelCtrl bookmarkCtrl[16];
+
+    SeqEventView view;
+};
+
+// EventSource over a PatternSequence. Patterns are played out as the playhead reaches them,
+// straight from the pattern table, so the song is never expanded in memory. seek() to any time
+// starts from the song's keyframe for each channel's pattern there and replays at most part
+// of that pattern; attach() only resets the cursor.
+class PatternScheduler : public EventSource {
+public:
+    // Start at the beginning of song (the song must outlive the scheduler)
+    void attach(const PatternSequence* song);
+
+    void setBookmark(uint32_t time) override;
+    void seek(uint32_t time) override;
+    const SeqEventView* next(uint32_t time) override;
+
+    bool seekable() const override { return true; }
+    bool exhausted() const override { return cursor.nextTime() == UINT32_MAX; }
+
+private:
+    // Controller values at the cursor's position
+    void ctrlAtCursor(ChannelCtrl out[16]) const;
+
+    const PatternSequence* song = nullptr;
+    PatternCursor cursor;
+    ChannelCtrl ctrl[16];
+    CtrlRamp ramp;
+
+    PatternCursor::Position bookmarkPos;
+    uint32_t bookmarkTime = UINT32_MAX;
+    ChannelCtrl bookmarkCtrl[16];
+
+    SeqEventView view;
+};
@@ -0,0 +1,373 @@
+#include "seqbin.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+const char* seqBinResultString(SeqBinResult result) {
+    switch (result) {
+        case SEQBIN_OK:           return "ok";
+        case SEQBIN_NOT_FOUND:    return "file not found";
+        case SEQBIN_BAD_MAGIC:    return "not a compiled sequence";
+        case SEQBIN_BAD_VERSION:  return "stale format version, recompile";
+        case SEQBIN_TRUNCATED:    return "file is truncated";
+        case SEQBIN_BAD_CHECKSUM: return "checksum mismatch";
+        case SEQBIN_OUT_OF_RANGE: return "value out of range for the format";
+        case SEQBIN_WRITE_FAILED: return "write failed";
+    }
+    return "unknown error";
+}
+
+uint32_t seqBinChecksum(const void* data, uint32_t size, uint32_t hash) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    for (uint32_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static SeqBinResult fail(Sequence& seq, SeqBinResult result) {
+    seq.time.clear();
+    seq.events.clear();
+    seq.ctrl.clear();
+    seq.keyframes.clear();
+    return result;
+}
+
+static uint32_t align4(uint32_t n) { return (n + 3) & ~3u; }
+
+uint32_t seqBinChunkBytes(const SeqBinChunk& chunk) {
+    return align4(chunk.eventCount * sizeof(uint16_t)) + chunk.eventCount * sizeof(uint32_t) + align4(chunk.ctrlBytes);
+}
+
+// Covers the header up to its checksum as well as the table, so a damaged tempo or loop point
+// is caught too
+static uint32_t indexChecksum(const SeqBinHeader& header, const SeqBinChunk* table) {
+    uint32_t hash = seqBinChecksum(&header, offsetof(SeqBinHeader, checksum));
+    return seqBinChecksum(table, header.chunkCount * sizeof(SeqBinChunk), hash);
+}
+
+// Bytes from the current position to the end of file, or -1 if the file cannot seek
+static long bytesLeft(FILE* file) {
+    long here = ftell(file);
+    if (here < 0 || fseek(file, 0, SEEK_END) != 0) return -1;
+    long end = ftell(file);
+    if (fseek(file, here, SEEK_SET) != 0 || end < here) return -1;
+    return end - here;
+}
+
+SeqBinResult readSequenceIndex(FILE* file, SeqBinHeader& header, std::vector<SeqBinChunk>& table) {
+    if (fread(&header, sizeof(header), 1, file) != 1) return SEQBIN_TRUNCATED;
+    if (header.magic != SEQBIN_MAGIC) return SEQBIN_BAD_MAGIC;
+    if (header.version != SEQBIN_VERSION) return SEQBIN_BAD_VERSION;
+
+    // Nothing is sized from the header before the counts agree with each other and with the
+    // file: every chunk holds SEQBIN_CHUNK_EVENTS events but the last, and each event takes at
+    // least 6 bytes of chunk data
+    uint64_t chunks = ((uint64_t)header.eventCount + SEQBIN_CHUNK_EVENTS - 1) / SEQBIN_CHUNK_EVENTS;
+    if (header.chunkCount != chunks || header.maxChunkBytes > SEQBIN_CHUNK_BYTES_MAX) return SEQBIN_OUT_OF_RANGE;
+    long left = bytesLeft(file);
+    if (left < 0 || (uint64_t)left < chunks * sizeof(SeqBinChunk) + (uint64_t)header.eventCount * 6)
+        return SEQBIN_TRUNCATED;
+
+    table.resize(header.chunkCount);
+    if (fread(table.data(), sizeof(SeqBinChunk), header.chunkCount, file) != header.chunkCount)
+        return SEQBIN_TRUNCATED;
+    if (indexChecksum(header, table.data()) != header.checksum) return SEQBIN_BAD_CHECKSUM;
+
+    uint32_t events = 0, ctrlBytes = 0;
+    for (const SeqBinChunk& c : table) {
+        if (c.eventCount == 0 || c.eventCount > SEQBIN_CHUNK_EVENTS || c.ctrlBytes > SEQBIN_CHUNK_CTRL_MAX ||
+            seqBinChunkBytes(c) > header.maxChunkBytes || c.lastTime < c.firstTime)
+            return SEQBIN_OUT_OF_RANGE;
+        events += c.eventCount;
+        ctrlBytes += c.ctrlBytes;
+    }
+    if (events != header.eventCount || ctrlBytes != header.ctrlBytes) return SEQBIN_OUT_OF_RANGE;
+    return SEQBIN_OK;
+}
+
+SeqBinResult decodeSequenceChunk(const SeqBinChunk& chunk, const uint8_t* data, uint32_t* time,
+                                 uint32_t* events, uint8_t* ctrl, uint32_t ctrlBase) {
+    if (seqBinChecksum(data, seqBinChunkBytes(chunk)) != chunk.checksum) return SEQBIN_BAD_CHECKSUM;
+
+    uint32_t count = chunk.eventCount;
+    const uint8_t* payloads = data + align4(count * sizeof(uint16_t));
+    const uint8_t* records = payloads + count * sizeof(uint32_t);
+
+    uint32_t t = chunk.firstTime;
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t delta;
+        memcpy(&delta, data + i * sizeof(uint16_t), sizeof(delta));
+        t += delta;
+        time[i] = t;
+
+        uint32_t e;
+        memcpy(&e, payloads + i * sizeof(uint32_t), sizeof(e));
+        if (evType(e) >= EV_CONTROL) {
+            if (evCtrlOffset(e) >= chunk.ctrlBytes) return SEQBIN_OUT_OF_RANGE;
+            e += ctrlBase << 8;
+        }
+        events[i] = e;
+    }
+    if (t != chunk.lastTime) return SEQBIN_OUT_OF_RANGE;
+
+    memcpy(ctrl, records, chunk.ctrlBytes);
+    return SEQBIN_OK;
+}
+
+SeqBinResult loadSequenceBinary(const char* path, Sequence& seq) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return fail(seq, SEQBIN_NOT_FOUND);
+
+    SeqBinHeader header;
+    std::vector<SeqBinChunk> table;
+    SeqBinResult result = readSequenceIndex(file, header, table);
+    if (result != SEQBIN_OK) { fclose(file); return fail(seq, result); }
+
+    seq.time.resize(header.eventCount);
+    seq.events.resize(header.eventCount);
+    seq.ctrl.resize(header.ctrlBytes);
+
+    // Chunks follow each other, so this is one sequential pass over the file
+    std::vector<uint8_t> raw(header.maxChunkBytes);
+    uint32_t event = 0, ctrlBase = 0;
+    for (const SeqBinChunk& c : table) {
+        uint32_t bytes = seqBinChunkBytes(c);
+        if (fseek(file, c.offset, SEEK_SET) != 0 || fread(raw.data(), 1, bytes, file) != bytes) {
+            fclose(file);
+            return fail(seq, SEQBIN_TRUNCATED);
+        }
+        result = decodeSequenceChunk(c, raw.data(), &seq.time[event], &seq.events[event], &seq.ctrl[ctrlBase], ctrlBase);
+        if (result != SEQBIN_OK) { fclose(file); return fail(seq, result); }
+        event += c.eventCount;
+        ctrlBase += c.ctrlBytes;
+    }
+    fclose(file);
+    buildKeyframes(seq);
+
+    seq.bpm = header.bpm;
+    seq.loopStart64th = header.loopStart64th;
+    seq.loopEnd64th = header.loopEnd64th;
+    return SEQBIN_OK;
+}
+
+SeqBinResult writeSequenceBinary(const char* path, const Sequence& seq) {
+    uint32_t count = seq.size();
+    uint32_t chunkCount = (count + SEQBIN_CHUNK_EVENTS - 1) / SEQBIN_CHUNK_EVENTS;
+    std::vector<SeqBinChunk> table(chunkCount);
+    std::vector<uint8_t> data;
+
+    for (uint32_t k = 0; k < chunkCount; k++) {
+        uint32_t first = k * SEQBIN_CHUNK_EVENTS;
+        uint32_t n = (count - first < SEQBIN_CHUNK_EVENTS) ? count - first : SEQBIN_CHUNK_EVENTS;
+
+        std::vector<uint16_t> deltas(n);
+        std::vector<uint32_t> payloads(n);
+        std::vector<uint8_t> ctrl;
+        uint32_t prev = seq.time[first];
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t t = seq.time[first + i];
+            if (t < prev || t - prev > 0xFFFF) return SEQBIN_OUT_OF_RANGE;
+            deltas[i] = t - prev;
+            prev = t;
+
+            // The pool is in file order, not time order, so each chunk gets its own copy of
+            // the records its events use
+            uint32_t e = seq.events[first + i];
+            if (evType(e) >= EV_CONTROL) {
+                const uint8_t* record = &seq.ctrl[evCtrlOffset(e)];
+                ChannelCtrl scratch;
+                size_t len = applyCtrlDelta(record, scratch);
+                e = (e & 0xFF) | ((uint32_t)ctrl.size() << 8);
+                ctrl.insert(ctrl.end(), record, record + len);
+            }
+            payloads[i] = e;
+        }
+
+        SeqBinChunk& c = table[k];
+        c.firstTime = seq.time[first];
+        c.lastTime = prev;
+        c.eventCount = n;
+        c.ctrlBytes = ctrl.size();
+        c.offset = sizeof(SeqBinHeader) + chunkCount * sizeof(SeqBinChunk) + data.size();
+
+        size_t start = data.size(), at = start;
+        data.resize(start + seqBinChunkBytes(c), 0);
+        memcpy(&data[at], deltas.data(), n * sizeof(uint16_t));
+        at += align4(n * sizeof(uint16_t));
+        memcpy(&data[at], payloads.data(), n * sizeof(uint32_t));
+        at += n * sizeof(uint32_t);
+        if (!ctrl.empty()) memcpy(&data[at], ctrl.data(), ctrl.size());
+        c.checksum = seqBinChecksum(&data[start], seqBinChunkBytes(c));
+    }
+
+    SeqBinHeader header;
+    header.magic = SEQBIN_MAGIC;
+    header.version = SEQBIN_VERSION;
+    header.bpm = seq.bpm;
+    header.loopStart64th = seq.loopStart64th;
+    header.loopEnd64th = seq.loopEnd64th;
+    header.eventCount = count;
+    header.ctrlBytes = 0;
+    header.chunkCount = chunkCount;
+    header.maxChunkBytes = 0;
+    for (const SeqBinChunk& c : table) {
+        header.ctrlBytes += c.ctrlBytes;
+        if (seqBinChunkBytes(c) > header.maxChunkBytes) header.maxChunkBytes = seqBinChunkBytes(c);
+    }
+    header.checksum = indexChecksum(header, table.data());
+
+    FILE* file = fopen(path, "wb");
+    if (!file) return SEQBIN_WRITE_FAILED;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(table.data(), sizeof(SeqBinChunk), chunkCount, file) == chunkCount &&
+              fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = (fclose(file) == 0) && ok;
+    return ok ? SEQBIN_OK : SEQBIN_WRITE_FAILED;
+}
+
+// Bytes after the header, in file order
+static uint32_t patternDataBytes(const SeqPatternBinHeader& h) {
+    return h.patternCount * sizeof(SeqPattern) + h.orderCount * sizeof(SeqPatternRef) +
+           align4(h.eventCount * sizeof(uint16_t)) + h.eventCount * sizeof(uint32_t) + align4(h.ctrlBytes) +
+           h.fixCount * sizeof(SeqPatternFix) + align4(h.fixChannelCount);
+}
+
+static uint32_t patternChecksum(const SeqPatternBinHeader& header, const std::vector<uint8_t>& data) {
+    uint32_t hash = seqBinChecksum(&header, offsetof(SeqPatternBinHeader, checksum));
+    return seqBinChecksum(data.data(), data.size(), hash);
+}
+
+static SeqBinResult failPatterns(PatternSequence& song, SeqBinResult result) {
+    song = PatternSequence();
+    return result;
+}
+
+// Every index stays inside the song, and orders are sorted the way PatternCursor needs
+static bool patternsInRange(const PatternSequence& song) {
+    for (const SeqPattern& p : song.patterns)
+        if (p.first > song.events.size() || p.count > song.events.size() - p.first) return false;
+    for (size_t i = 0; i < song.orders.size(); i++) {
+        const SeqPatternRef& r = song.orders[i];
+        if (r.channel >= 16 || r.pattern >= song.patterns.size()) return false;
+        if (i > 0) {
+            const SeqPatternRef& prev = song.orders[i - 1];
+            if (r.channel < prev.channel || (r.channel == prev.channel && r.time <= prev.time)) return false;
+        }
+    }
+    for (uint32_t e : song.events) {
+        if (evChannel(e) != 0) return false;
+        if (evType(e) >= EV_CONTROL && evCtrlOffset(e) >= song.ctrl.size()) return false;
+    }
+    if (song.tieOrder != PATTERN_TIE_CHANNEL && song.tieOrder != PATTERN_TIE_OFFS_FIRST) return false;
+    for (size_t i = 0; i < song.fixes.size(); i++) {
+        const SeqPatternFix& f = song.fixes[i];
+        if (f.first >= song.fixChannels.size()) return false;
+        if (i > 0 && (f.time <= song.fixes[i - 1].time || f.first <= song.fixes[i - 1].first)) return false;
+    }
+    for (uint8_t ch : song.fixChannels)
+        if (ch >= 16) return false;
+    return true;
+}
+
+SeqBinResult loadPatternBinary(const char* path, PatternSequence& song) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return failPatterns(song, SEQBIN_NOT_FOUND);
+
+    SeqPatternBinHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1) { fclose(file); return failPatterns(song, SEQBIN_TRUNCATED); }
+    if (header.magic != SEQBIN_PATTERN_MAGIC) { fclose(file); return failPatterns(song, SEQBIN_BAD_MAGIC); }
+    if (header.version != SEQBIN_VERSION) { fclose(file); return failPatterns(song, SEQBIN_BAD_VERSION); }
+    if (header.patternCount > 0x10000 || header.eventCount >= (1u << 24) || header.ctrlBytes >= (1u << 24) ||
+        header.orderCount >= (1u << 24) || header.fixCount >= (1u << 24) || header.fixChannelCount >= (1u << 24)) {
+        fclose(file);
+        return failPatterns(song, SEQBIN_OUT_OF_RANGE);
+    }
+    long left = bytesLeft(file);
+    if (left < 0 || (uint32_t)left < patternDataBytes(header)) {
+        fclose(file);
+        return failPatterns(song, SEQBIN_TRUNCATED);
+    }
+
+    std::vector<uint8_t> data(patternDataBytes(header));
+    bool read = fread(data.data(), 1, data.size(), file) == data.size();
+    fclose(file);
+    if (!read) return failPatterns(song, SEQBIN_TRUNCATED);
+    if (patternChecksum(header, data) != header.checksum) return failPatterns(song, SEQBIN_BAD_CHECKSUM);
+
+    song.patterns.resize(header.patternCount);
+    song.orders.resize(header.orderCount);
+    song.time.resize(header.eventCount);
+    song.events.resize(header.eventCount);
+    song.ctrl.resize(header.ctrlBytes);
+    song.fixes.resize(header.fixCount);
+    song.fixChannels.resize(header.fixChannelCount);
+    const uint8_t* p = data.data();
+    memcpy(song.patterns.data(), p, header.patternCount * sizeof(SeqPattern));
+    p += header.patternCount * sizeof(SeqPattern);
+    memcpy(song.orders.data(), p, header.orderCount * sizeof(SeqPatternRef));
+    p += header.orderCount * sizeof(SeqPatternRef);
+    memcpy(song.time.data(), p, header.eventCount * sizeof(uint16_t));
+    p += align4(header.eventCount * sizeof(uint16_t));
+    memcpy(song.events.data(), p, header.eventCount * sizeof(uint32_t));
+    p += header.eventCount * sizeof(uint32_t);
+    memcpy(song.ctrl.data(), p, header.ctrlBytes);
+    p += align4(header.ctrlBytes);
+    memcpy(song.fixes.data(), p, header.fixCount * sizeof(SeqPatternFix));
+    p += header.fixCount * sizeof(SeqPatternFix);
+    memcpy(song.fixChannels.data(), p, header.fixChannelCount);
+    song.tieOrder = header.tieOrder;
+    if (!patternsInRange(song)) return failPatterns(song, SEQBIN_OUT_OF_RANGE);
+
+    buildKeyframes(song);
+
+    song.bpm = header.bpm;
+    song.loopStart64th = header.loopStart64th;
+    song.loopEnd64th = header.loopEnd64th;
+    return SEQBIN_OK;
+}
+
+SeqBinResult writePatternBinary(const char* path, const PatternSequence& song) {
+    if (!patternsInRange(song)) return SEQBIN_OUT_OF_RANGE;
+
+    SeqPatternBinHeader header;
+    header.magic = SEQBIN_PATTERN_MAGIC;
+    header.version = SEQBIN_VERSION;
+    header.bpm = song.bpm;
+    header.loopStart64th = song.loopStart64th;
+    header.loopEnd64th = song.loopEnd64th;
+    header.patternCount = song.patterns.size();
+    header.orderCount = song.orders.size();
+    header.eventCount = song.events.size();
+    header.ctrlBytes = song.ctrl.size();
+    header.tieOrder = (uint16_t)song.tieOrder;
+    header.reserved = 0;
+    header.fixCount = song.fixes.size();
+    header.fixChannelCount = song.fixChannels.size();
+
+    std::vector<uint8_t> data(patternDataBytes(header), 0);
+    uint8_t* p = data.data();
+    memcpy(p, song.patterns.data(), header.patternCount * sizeof(SeqPattern));
+    p += header.patternCount * sizeof(SeqPattern);
+    memcpy(p, song.orders.data(), header.orderCount * sizeof(SeqPatternRef));
+    p += header.orderCount * sizeof(SeqPatternRef);
+    memcpy(p, song.time.data(), header.eventCount * sizeof(uint16_t));
+    p += align4(header.eventCount * sizeof(uint16_t));
+    memcpy(p, song.events.data(), header.eventCount * sizeof(uint32_t));
+    p += header.eventCount * sizeof(uint32_t);
+    if (header.ctrlBytes) memcpy(p, song.ctrl.data(), header.ctrlBytes);
+    p += align4(header.ctrlBytes);
+    if (header.fixCount) memcpy(p, song.fixes.data(), header.fixCount * sizeof(SeqPatternFix));
+    p += header.fixCount * sizeof(SeqPatternFix);
+    if (header.fixChannelCount) memcpy(p, song.fixChannels.data(), header.fixChannelCount);
+    header.checksum = patternChecksum(header, data);
+
+    FILE* file = fopen(path, "wb");
+    if (!file) return SEQBIN_WRITE_FAILED;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = (fclose(file) == 0) && ok;
+    return ok ? SEQBIN_OK : SEQBIN_WRITE_FAILED;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "pattern.h"
+#include "sequence.h"
+
+// Compiled sequence format (.nseq)
+//
+// The packed Sequence cut into chunks of up to SEQBIN_CHUNK_EVENTS events, behind a fixed
+// header and a table of chunks:
+//   SeqBinHeader
+//   SeqBinChunk table[chunkCount]
+//   chunk data, for each chunk:
+//     uint16_t timeDelta[eventCount]   64ths since the previous event; the first is 0 and
+//                                      the chunk starts at firstTime (padded to 4 bytes)
+//     uint32_t events[eventCount]      payloads, see Sequence in sequence.h; controller
+//                                      offsets are relative to this chunk's ctrl block
+//     uint8_t  ctrl[ctrlBytes]         controller-delta records (padded to 4 bytes)
+// Every chunk can be decoded on its own, so a player can either read the whole file up front
+// or stream it a chunk at a time (see seqstream.h). Multi-byte fields are little-endian,
+// which is the native order of both the DS and x86 hosts.
+
+#define SEQBIN_MAGIC   0x5145534E // "NSEQ"
+#define SEQBIN_VERSION 5
+
+#define SEQBIN_CHUNK_EVENTS 512
+// A controller record is a mask byte plus at most 8 bytes of values, then up to 6 of ramp
+#define SEQBIN_CHUNK_CTRL_MAX (SEQBIN_CHUNK_EVENTS * 15)
+// Largest chunk on disk: times, payloads and records, each already a multiple of 4 bytes
+#define SEQBIN_CHUNK_BYTES_MAX (SEQBIN_CHUNK_EVENTS * 6 + SEQBIN_CHUNK_CTRL_MAX)
+
+struct SeqBinHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t bpm;
+    int32_t loopStart64th;  // -1 = no loop
+    int32_t loopEnd64th;
+    uint32_t eventCount;
+    uint32_t ctrlBytes;     // over all chunks
+    uint32_t chunkCount;
+    uint32_t maxChunkBytes; // largest chunk on disk, for sizing read buffers
+    uint32_t checksum;      // FNV-1a over the fields above, then the chunk table
+};
+
+struct SeqBinChunk {
+    uint32_t firstTime;     // 64th of the first and last event
+    uint32_t lastTime;
+    uint32_t offset;        // of the chunk data, from the start of the file
+    uint16_t eventCount;
+    uint16_t ctrlBytes;
+    uint32_t checksum;      // FNV-1a over the chunk data
+};
+
+// A song stored as patterns (see pattern.h) is one block, read whole:
+//   SeqPatternBinHeader
+//   SeqPattern    patterns[patternCount]
+//   SeqPatternRef orders[orderCount]     by channel, then time
+//   uint16_t      time[eventCount]       64ths from the start of the pattern (padded to 4 bytes)
+//   uint32_t      events[eventCount]     payloads with channel 0; controller offsets into ctrl
+//   uint8_t       ctrl[ctrlBytes]        controller-delta records (padded to 4 bytes)
+//   SeqPatternFix fixes[fixCount]        by time
+//   uint8_t       fixChannels[fixChannelCount] (padded to 4 bytes)
+#define SEQBIN_PATTERN_MAGIC 0x5441504E // "NPAT"
+
+struct SeqPatternBinHeader {
+    uint32_t magic;
+    uint16_t version;       // SEQBIN_VERSION
+    uint16_t bpm;
+    int32_t loopStart64th;  // -1 = no loop
+    int32_t loopEnd64th;
+    uint32_t patternCount;
+    uint32_t orderCount;
+    uint32_t eventCount;    // stored, not played
+    uint32_t ctrlBytes;
+    uint16_t tieOrder;      // PatternTieOrder
+    uint16_t reserved;
+    uint32_t fixCount;
+    uint32_t fixChannelCount;
+    uint32_t checksum;      // FNV-1a over the fields above, then everything after the header
+};
+
+static_assert(sizeof(SeqBinHeader) == 36, "SeqBinHeader must be packed");
+static_assert(sizeof(SeqBinChunk) == 20, "SeqBinChunk must be packed");
+static_assert(sizeof(SeqPatternBinHeader) == 48, "SeqPatternBinHeader must be packed");
+
+enum SeqBinResult {
+    SEQBIN_OK = 0,
+    SEQBIN_NOT_FOUND,
+    SEQBIN_BAD_MAGIC,
+    SEQBIN_BAD_VERSION,
+    SEQBIN_TRUNCATED,
+    SEQBIN_BAD_CHECKSUM,
+    SEQBIN_OUT_OF_RANGE,    // a value does not fit the format
+    SEQBIN_WRITE_FAILED,
+};
+
+const char* seqBinResultString(SeqBinResult result);
+
+uint32_t seqBinChecksum(const void* data, uint32_t size, uint32_t hash = 2166136261u);
+
+// Bytes of chunk data on disk
+uint32_t seqBinChunkBytes(const SeqBinChunk& chunk);
+
+// Read and check the header and chunk table of an open file
+SeqBinResult readSequenceIndex(FILE* file, SeqBinHeader& header, std::vector<SeqBinChunk>& table);
+
+// Verify one chunk's raw data and decode it: absolute times into time, payloads into events
+// with controller offsets moved up by ctrlBase, and the controller records into ctrl
+SeqBinResult decodeSequenceChunk(const SeqBinChunk& chunk, const uint8_t* data, uint32_t* time,
+                                 uint32_t* events, uint8_t* ctrl, uint32_t ctrlBase);
+
+// Load a compiled sequence. On anything but SEQBIN_OK, seq is left empty.
+SeqBinResult loadSequenceBinary(const char* path, Sequence& seq);
+
+// Write a packed sequence (time in 64ths) to a .nseq file
+SeqBinResult writeSequenceBinary(const char* path, const Sequence& seq);
+
+// Load a song stored as patterns. A flat .nseq gives SEQBIN_BAD_MAGIC, as a pattern file does
+// for loadSequenceBinary and SeqStream. On anything but SEQBIN_OK, song is left empty.
+SeqBinResult loadPatternBinary(const char* path, PatternSequence& song);
+
+// Write a song stored as patterns
+SeqBinResult writePatternBinary(const char* path, const PatternSequence& song);
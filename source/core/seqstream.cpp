@@ -0,0 +1,230 @@
+#include "seqstream.h"
+
+#include <algorithm>
+
+SeqBinResult SeqStream::open(const char* path) {
+    close();
+
+    file = fopen(path, "rb");
+    if (!file) return SEQBIN_NOT_FOUND;
+
+    SeqBinResult result = readSequenceIndex(file, header, table);
+    if (result != SEQBIN_OK) { close(); return result; }
+    raw.resize(header.maxChunkBytes);
+
+    loopStartChunk = loopEndChunk = -1;
+    if (hasLoop()) {
+        loopStartChunk = chunkFor(header.loopStart64th);
+        // Last chunk holding events at or before the loop end
+        loopEndChunk = (int)(std::upper_bound(table.begin(), table.end(), (uint32_t)header.loopEnd64th,
+                             [](uint32_t t, const SeqBinChunk& c) { return t < c.firstTime; }) - table.begin()) - 1;
+    }
+
+    for (int ch = 0; ch < 16; ch++) ctrl[ch] = ChannelCtrl();
+    bookmarkSet = bookmarkTaken = false;
+    seekPending = false;
+    underrunCount = 0;
+    starving = false;
+    front.store(0, std::memory_order_relaxed);
+    cursor = 0;
+
+    if (table.empty()) return SEQBIN_OK;
+
+    result = load(buffers[0], 0);
+    if (result != SEQBIN_OK) { close(); return result; }
+    request(prefetchTarget(0));
+    return SEQBIN_OK;
+}
+
+void SeqStream::close() {
+    if (file) fclose(file);
+    file = nullptr;
+    table.clear();
+    header = SeqBinHeader();
+    for (ChunkBuffer& b : buffers) {
+        b.chunk = -1;
+        b.count = 0;
+    }
+    wanted.store(-1, std::memory_order_relaxed);
+    delivered.store(requested.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+size_t SeqStream::memoryBytes() const {
+    return sizeof(buffers) + raw.capacity() + table.capacity() * sizeof(SeqBinChunk);
+}
+
+bool SeqStream::hasLoop() const {
+    return header.loopStart64th != -1 && header.loopEnd64th != -1 && header.loopEnd64th > header.loopStart64th;
+}
+
+// First chunk with an event at or after time; table.size() if there is none
+int SeqStream::chunkFor(uint32_t time) const {
+    return (int)(std::lower_bound(table.begin(), table.end(), time,
+                 [](const SeqBinChunk& c, uint32_t t) { return c.lastTime < t; }) - table.begin());
+}
+
+// Chunk played after chunk, or -1 at the end of the song or the loop
+int SeqStream::successor(int chunk) const {
+    if (chunk == loopEndChunk) return -1;
+    return (chunk + 1 < (int)table.size()) ? chunk + 1 : -1;
+}
+
+int SeqStream::prefetchTarget(int chunk) const {
+    if (chunk == loopEndChunk) return loopStartChunk;
+    return successor(chunk);
+}
+
+SeqBinResult SeqStream::load(ChunkBuffer& buf, int chunk) {
+    const SeqBinChunk& c = table[chunk];
+    uint32_t bytes = seqBinChunkBytes(c);
+    if (fseek(file, c.offset, SEEK_SET) != 0 || fread(raw.data(), 1, bytes, file) != bytes)
+        return SEQBIN_TRUNCATED;
+
+    SeqBinResult result = decodeSequenceChunk(c, raw.data(), buf.time, buf.events, buf.ctrl, 0);
+    if (result != SEQBIN_OK) return result;
+    buf.count = c.eventCount;
+    buf.chunk = chunk;
+    return SEQBIN_OK;
+}
+
+SeqBinResult SeqStream::service() {
+    uint32_t number = requested.load(std::memory_order_acquire);
+    if (!file || number == delivered.load(std::memory_order_relaxed)) return SEQBIN_OK;
+
+    // Until this request is answered next() leaves the back buffer alone, and cannot swap it in
+    int want = wanted.load(std::memory_order_relaxed);
+    ChunkBuffer& b = buffers[1 - front.load(std::memory_order_relaxed)];
+    if (want >= 0 && b.chunk != want) {
+        b.chunk = -1;
+        SeqBinResult result = load(b, want);
+        // Unanswered, so the next call tries again
+        if (result != SEQBIN_OK) return result;
+    }
+    delivered.store(number, std::memory_order_release);
+    return SEQBIN_OK;
+}
+
+// Ask service() for chunk (-1: none) in the back buffer. next() must not read the back
+// buffer again until the request is answered.
+void SeqStream::request(int chunk) {
+    wanted.store(chunk, std::memory_order_relaxed);
+    requested.store(requested.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Make the back buffer the front if it holds chunk; otherwise ask service() for it
+bool SeqStream::takeBack(int chunk) {
+    int back = 1 - front.load(std::memory_order_relaxed);
+    bool answered = delivered.load(std::memory_order_acquire) == requested.load(std::memory_order_relaxed);
+    if (!answered || buffers[back].chunk != chunk) {
+        if (wanted.load(std::memory_order_relaxed) != chunk) request(chunk);
+        return false;
+    }
+    front.store(back, std::memory_order_relaxed);
+    cursor = 0;
+    // The old front is the back buffer now, so it is asked for even if it holds the chunk
+    request(prefetchTarget(chunk));
+    return true;
+}
+
+void SeqStream::setBookmark(uint32_t time) {
+    bookmarkSet = true;
+    bookmarkTaken = false;
+    bookmarkTime = time;
+}
+
+// The bookmark's controller state is captured on the way past it, once every event before
+// it has been applied
+void SeqStream::noteBookmark(uint32_t nextEventTime) {
+    if (!bookmarkSet || bookmarkTaken || nextEventTime < bookmarkTime) return;
+    for (int ch = 0; ch < 16; ch++) bookmarkCtrl[ch] = ctrl[ch];
+    bookmarkTaken = true;
+}
+
+void SeqStream::seek(uint32_t time) {
+    if (bookmarkTaken && time == bookmarkTime) {
+        for (int ch = 0; ch < 16; ch++) ctrl[ch] = bookmarkCtrl[ch];
+    } else if (time == 0) {
+        for (int ch = 0; ch < 16; ch++) ctrl[ch] = ChannelCtrl();
+    }
+
+    seekPending = true;
+    seekTime = time;
+    seekChunk = chunkFor(time);
+    finishSeek();
+}
+
+bool SeqStream::finishSeek() {
+    ChunkBuffer& f = playing();
+
+    if (seekChunk >= (int)table.size()) {
+        // Past the last event: leave the front exhausted
+        cursor = f.count;
+        seekPending = false;
+        return true;
+    }
+    if (f.chunk != seekChunk && !takeBack(seekChunk)) return false;
+
+    ChunkBuffer& now = playing();
+    cursor = std::lower_bound(now.time, now.time + now.count, seekTime) - now.time;
+    int prefetch = prefetchTarget(seekChunk);
+    if (wanted.load(std::memory_order_relaxed) != prefetch) request(prefetch);
+    seekPending = false;
+    return true;
+}
+
+const SeqEventView* SeqStream::next(uint32_t time) {
+    if (table.empty()) return nullptr;
+
+    if (seekPending && !finishSeek()) {
+        if (!starving) underrunCount++;
+        starving = true;
+        return nullptr;
+    }
+
+    while (true) {
+        ChunkBuffer& f = playing();
+
+        if (cursor >= f.count) {
+            int following = successor(f.chunk);
+            if (following < 0) {
+                noteBookmark(UINT32_MAX);
+                return nullptr;
+            }
+
+            uint32_t firstTime = table[following].firstTime;
+            noteBookmark(firstTime);
+            if (firstTime > time) return nullptr;
+
+            if (!takeBack(following)) {
+                if (!starving) underrunCount++;
+                starving = true;
+                return nullptr;
+            }
+            starving = false;
+            continue;
+        }
+        starving = false;
+
+        uint32_t t = f.time[cursor];
+        noteBookmark(t);
+        if (t > time) return nullptr;
+
+        uint32_t e = f.events[cursor++];
+        SeqEventType type = evType(e);
+        int ch = evChannel(e);
+
+        if (type >= EV_CONTROL) {
+            applyCtrlDelta(&f.ctrl[evCtrlOffset(e)], ctrl[ch], &ramp);
+            if (type == EV_NOTE_CTRL) continue; // the note-on that follows reports it
+        }
+
+        view.type = type;
+        view.channel = ch;
+        view.note = (type == EV_CONTROL) ? -1 : evNote(e);
+        view.velocity = (type == EV_NOTE_ON) ? evVelocity(e) : 0;
+        view.offFlags = (type == EV_NOTE_OFF) ? evOffFlags(e) : 0;
+        view.ctrl = &ctrl[ch];
+        view.ramp = (type == EV_CONTROL && ramp.length) ? &ramp : nullptr;
+        return &view;
+    }
+}
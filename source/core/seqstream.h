@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "scheduler.h"
+#include "seqbin.h"
+
+// Plays a compiled .nseq straight from the file, holding only two decoded chunks: the one
+// being played and the one that will be played next. Memory use is the same for any song
+// length, and playback can start as soon as the first chunk is in.
+//
+// next() runs in the sequencer timer IRQ and never touches the file. service() runs in the
+// main loop and reads the chunk the IRQ will want next into the spare buffer. When looping,
+// the chunk after the loop end is the one holding the loop start, so that is prefetched
+// instead. If a chunk is not in by the time its events are due (an underrun), waiting()
+// reports it and the player holds its position until service() has read the chunk.
+//
+// The two sides hand the spare buffer back and forth the way SpscRing hands over its slots:
+// next() asks for a chunk by storing it and a new request number (release), and service()
+// answers by storing that number once the chunk is in (release). Each side only reads the
+// spare buffer while the numbers say it has it: service() from a request it has not yet
+// answered, next() once the latest request has been answered. Only atomic loads and stores of
+// a 32-bit word are needed, so this works from an interrupt and between two threads alike.
+//
+// seek() is only exact for time 0 and the bookmark. Other times keep the current controller
+// values, since replaying them would need every earlier chunk.
+class SeqStream : public EventSource {
+public:
+    ~SeqStream() { close(); }
+
+    // Open path and read the first chunk
+    SeqBinResult open(const char* path);
+    void close();
+
+    // Call from the main loop. Reads the chunk playback needs next, if it is not in yet.
+    SeqBinResult service();
+
+    int bpm() const { return header.bpm; }
+    int loopStart64th() const { return header.loopStart64th; }
+    int loopEnd64th() const { return header.loopEnd64th; }
+    uint32_t size() const { return header.eventCount; }
+    uint32_t underruns() const { return underrunCount; }
+    size_t memoryBytes() const;
+
+    void setBookmark(uint32_t time) override;
+    void seek(uint32_t time) override;
+    const SeqEventView* next(uint32_t time) override;
+    bool waiting() const override { return starving; }
+
+private:
+    struct ChunkBuffer {
+        int chunk = -1;                 // table index held
+        uint32_t count = 0;
+        uint32_t time[SEQBIN_CHUNK_EVENTS];
+        uint32_t events[SEQBIN_CHUNK_EVENTS];
+        uint8_t ctrl[SEQBIN_CHUNK_CTRL_MAX];
+    };
+
+    ChunkBuffer& playing() { return buffers[front.load(std::memory_order_relaxed)]; }
+    bool hasLoop() const;
+    int chunkFor(uint32_t time) const;
+    int successor(int chunk) const;
+    int prefetchTarget(int chunk) const;
+    bool takeBack(int chunk);
+    void request(int chunk);
+    bool finishSeek();
+    void noteBookmark(uint32_t nextEventTime);
+    SeqBinResult load(ChunkBuffer& buf, int chunk);
+
+    FILE* file = nullptr;
+    SeqBinHeader header = {};
+    std::vector<SeqBinChunk> table;
+    std::vector<uint8_t> raw;
+    int loopStartChunk = -1, loopEndChunk = -1;
+
+    ChunkBuffer buffers[2];
+    std::atomic<int> front{0};              // buffer next() plays from, written by next()
+    std::atomic<int> wanted{-1};            // chunk service() should have in the back buffer
+    std::atomic<uint32_t> requested{0};     // request number of wanted, written by next()
+    std::atomic<uint32_t> delivered{0};     // last request service() answered
+    uint32_t cursor = 0;                    // into the front buffer
+
+    bool seekPending = false;
+    uint32_t seekTime = 0;
+    int seekChunk = -1;
+
+    ChannelCtrl ctrl[16];
+    CtrlRamp ramp;
+    bool bookmarkSet = false, bookmarkTaken = false;
+    uint32_t bookmarkTime = 0;
+    ChannelCtrl bookmarkCtrl[16];
+
+    uint32_t underrunCount = 0;
+    bool starving = false;
+
+    SeqEventView view;
+};
@@ -0,0 +1,194 @@
+#include "sequence.h"
+
+#include <algorithm>
+#include <cstring>
+
+size_t applyCtrlDelta(const uint8_t* p, ChannelCtrl& c, CtrlRamp* ramp) {
+    const uint8_t* start = p;
+    uint8_t mask = *p++;
+    if (mask & CTRL_PROGRAM) c.program = *p++;
+    if (mask & CTRL_PAN)     c.pan = *p++;
+    if (mask & CTRL_VOLUME)  c.channelVolume = *p++;
+    if (mask & CTRL_BEND)    { c.pitchBend = static_cast<int16_t>(p[0] | (p[1] << 8)); p += 2; }
+    if (mask & CTRL_CC74)    c.cc74 = static_cast<int8_t>(*p++);
+    if (mask & CTRL_CC75)    c.cc75 = static_cast<int8_t>(*p++);
+    if (mask & CTRL_CC76)    c.cc76 = static_cast<int8_t>(*p++);
+
+    CtrlRamp r;
+    if (mask & CTRL_RAMP) {
+        r.fields = *p++;
+        r.length = *p++ + 1;
+        if (r.fields & RAMP_BEND)   { r.pitchBend = static_cast<int16_t>(p[0] | (p[1] << 8)); p += 2; }
+        if (r.fields & RAMP_VOLUME) r.volume = *p++;
+        if (r.fields & RAMP_PAN)    r.pan = *p++;
+    }
+    if (ramp) *ramp = r;
+    return p - start;
+}
+
+static bool inRange(int value, int lo, int hi) {
+    return value >= lo && value <= hi;
+}
+
+// Append the delta between from and to; returns its offset in the pool
+static uint32_t emitCtrlDelta(std::vector<uint8_t>& pool, const ChannelCtrl& from, const ChannelCtrl& to) {
+    uint32_t offset = pool.size();
+    uint8_t mask = 0;
+    pool.push_back(0);
+    if (to.program != from.program)             { mask |= CTRL_PROGRAM; pool.push_back(to.program); }
+    if (to.pan != from.pan)                     { mask |= CTRL_PAN;     pool.push_back(to.pan); }
+    if (to.channelVolume != from.channelVolume) { mask |= CTRL_VOLUME;  pool.push_back(to.channelVolume); }
+    if (to.pitchBend != from.pitchBend) {
+        mask |= CTRL_BEND;
+        pool.push_back(to.pitchBend & 0xFF);
+        pool.push_back((to.pitchBend >> 8) & 0xFF);
+    }
+    if (to.cc74 != from.cc74)                   { mask |= CTRL_CC74;    pool.push_back(to.cc74); }
+    if (to.cc75 != from.cc75)                   { mask |= CTRL_CC75;    pool.push_back(to.cc75); }
+    if (to.cc76 != from.cc76)                   { mask |= CTRL_CC76;    pool.push_back(to.cc76); }
+    pool[offset] = mask;
+    return offset;
+}
+
+// Append n's ramp to the record just emitted at offset
+static void emitRamp(std::vector<uint8_t>& pool, uint32_t offset, const Note& n) {
+    pool[offset] |= CTRL_RAMP;
+    pool.push_back(n.rampFields);
+    pool.push_back(n.rampLength - 1);
+    if (n.rampFields & RAMP_BEND) {
+        pool.push_back(n.rampPitchBend & 0xFF);
+        pool.push_back((n.rampPitchBend >> 8) & 0xFF);
+    }
+    if (n.rampFields & RAMP_VOLUME) pool.push_back(n.rampVolume);
+    if (n.rampFields & RAMP_PAN)    pool.push_back(n.rampPan);
+}
+
+static ChannelCtrl ctrlOf(const Note& n) {
+    ChannelCtrl c;
+    c.program = n.program;
+    c.pan = n.pan;
+    c.channelVolume = n.channelVolume;
+    c.pitchBend = n.pitchBend;
+    c.cc74 = n.cc74;
+    c.cc75 = n.cc75;
+    c.cc76 = n.cc76;
+    return c;
+}
+
+static bool sameCtrl(const ChannelCtrl& a, const ChannelCtrl& b) {
+    return a.program == b.program && a.pan == b.pan && a.channelVolume == b.channelVolume &&
+           a.pitchBend == b.pitchBend && a.cc74 == b.cc74 && a.cc75 == b.cc75 && a.cc76 == b.cc76;
+}
+
+bool packSequence(const std::vector<Note>& notes, Sequence& seq) {
+    struct Pending { uint32_t time; SeqEventType type; uint32_t note; };
+
+    std::vector<Pending> order;
+    order.reserve(notes.size() * 2);
+    for (uint32_t i = 0; i < notes.size(); i++) {
+        const Note& n = notes[i];
+        if (!inRange(n.channel, 0, 15) || !inRange(n.noteNumber, -1, 127) ||
+            !inRange(n.velocity, 0, 255) || !inRange(n.program, 0, 255) ||
+            !inRange(n.pan, 0, 255) || !inRange(n.channelVolume, 0, 255) ||
+            !inRange(n.pitchBend, -32768, 32767) || !inRange(n.cc74, -1, 127) ||
+            !inRange(n.cc75, -1, 127) || !inRange(n.cc76, -1, 127) ||
+            n.startDiv < 0 || n.endDiv < 0)
+            return false;
+        if (n.rampLength && (n.noteNumber != -1 || !inRange(n.rampLength, 1, RAMP_LENGTH_MAX) ||
+                             !inRange(n.rampFields, 0, RAMP_BEND | RAMP_VOLUME | RAMP_PAN) ||
+                             !inRange(n.rampPitchBend, -32768, 32767) ||
+                             !inRange(n.rampVolume, 0, 255) || !inRange(n.rampPan, 0, 255)))
+            return false;
+
+        if (n.noteNumber == -1) {
+            // Controller-only lines have no note-off
+            order.push_back({(uint32_t)n.startDiv, EV_CONTROL, i});
+        } else {
+            order.push_back({(uint32_t)n.startDiv, EV_NOTE_ON, i});
+            order.push_back({(uint32_t)n.endDiv, EV_NOTE_OFF, i});
+        }
+    }
+
+    // Stable so events sharing a 64th keep the file order (and on-before-off per note)
+    std::stable_sort(order.begin(), order.end(),
+        [](const Pending& a, const Pending& b) { return a.time < b.time; });
+
+    seq.time.clear();
+    seq.events.clear();
+    seq.ctrl.clear();
+    seq.time.reserve(order.size());
+    seq.events.reserve(order.size());
+
+    ChannelCtrl running[16];
+    for (const Pending& p : order) {
+        const Note& n = notes[p.note];
+        uint32_t base = n.channel << 2;
+
+        if (p.type == EV_NOTE_OFF) {
+            uint32_t flags = (n.cc74 != -1 ? NOTEOFF_VOLUME_ENV : 0) | (n.cc75 != -1 ? NOTEOFF_PITCH_ENV : 0);
+            uint32_t length = n.endDiv > n.startDiv ? n.endDiv - n.startDiv : 0;
+            if (length > NOTEOFF_LENGTH_MAX) length = NOTEOFF_LENGTH_MAX;
+            seq.time.push_back(p.time);
+            seq.events.push_back(base | EV_NOTE_OFF | (n.noteNumber << 8) | (flags << 16) | (length << 18));
+            continue;
+        }
+
+        ChannelCtrl c = ctrlOf(n);
+        if (p.type == EV_CONTROL || !sameCtrl(c, running[n.channel])) {
+            uint32_t offset = emitCtrlDelta(seq.ctrl, running[n.channel], c);
+            if (offset >= (1u << 24)) return false;
+            if (p.type == EV_CONTROL && n.rampLength) emitRamp(seq.ctrl, offset, n);
+            running[n.channel] = c;
+            seq.time.push_back(p.time);
+            seq.events.push_back(base | (p.type == EV_CONTROL ? EV_CONTROL : EV_NOTE_CTRL) | (offset << 8));
+        }
+
+        if (p.type == EV_NOTE_ON) {
+            seq.time.push_back(p.time);
+            seq.events.push_back(base | EV_NOTE_ON | (n.noteNumber << 8) | (n.velocity << 16));
+        }
+    }
+
+    buildKeyframes(seq);
+    return true;
+}
+
+void buildKeyframes(Sequence& seq) {
+    seq.keyframes.clear();
+    uint32_t last = seq.size() ? seq.time.back() : 0;
+    seq.keyframes.reserve(last / SEQ_KEYFRAME_INTERVAL + 1);
+
+    ChannelCtrl c[16];
+    size_t i = 0;
+    for (uint32_t t = 0; t <= last; t += SEQ_KEYFRAME_INTERVAL) {
+        for (; i < seq.size() && seq.time[i] < t; i++) {
+            uint32_t e = seq.events[i];
+            if (evType(e) >= EV_CONTROL)
+                applyCtrlDelta(&seq.ctrl[evCtrlOffset(e)], c[evChannel(e)]);
+        }
+        SeqKeyframe k;
+        k.pos = (uint32_t)i;
+        for (int ch = 0; ch < 16; ch++) k.ctrl[ch].pack(c[ch]);
+        seq.keyframes.push_back(k);
+        if (last - t < SEQ_KEYFRAME_INTERVAL) break;
+    }
+}
+
+bool sameSequence(const Sequence& a, const Sequence& b) {
+    if (a.time != b.time || a.events.size() != b.events.size()) return false;
+    for (size_t i = 0; i < a.events.size(); i++) {
+        uint32_t ea = a.events[i], eb = b.events[i];
+        if (evType(ea) < EV_CONTROL) {
+            if (ea != eb) return false;
+            continue;
+        }
+        if ((ea & 0xFF) != (eb & 0xFF)) return false;
+
+        ChannelCtrl scratch;
+        size_t len = applyCtrlDelta(&a.ctrl[evCtrlOffset(ea)], scratch);
+        if (evCtrlOffset(eb) + len > b.ctrl.size() ||
+            memcmp(&a.ctrl[evCtrlOffset(ea)], &b.ctrl[evCtrlOffset(eb)], len) != 0)
+            return false;
+    }
+    return true;
+}
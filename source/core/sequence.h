@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Note struct with per-note paramters that is then sent to each channel.
+// This is the row format of the text sequence; it is only used while loading and compiling.
+// Playback uses the packed Sequence below.
+struct Note {
+    int channel, program, noteNumber, velocity, startDiv, endDiv, startDivFrames, endDivFrames;
+    int pan;
+    int pitchBend;
+    int channelVolume;
+    int cc74; // ADSR envelope index (0-based, -1 = none)
+    int cc75; // Pitch/mod envelope index (0-based, -1 = none)
+    int cc76; // Slide envelope (0-based, -1 = none)
+
+    // Controller-only rows: a ramp from the values above to these over rampLength 64ths
+    // (set by fitRamps, never read from text; 0 = no ramp). rampFields is a mask of
+    // RAMP_*.
+    int rampFields = 0, rampLength = 0;
+    int rampPitchBend = 0, rampVolume = 0, rampPan = 0;
+};
+
+// Controller values a channel carries between events
+struct ChannelCtrl {
+    int program = 0;
+    int pan = 64;
+    int channelVolume = 127;
+    int pitchBend = 0;
+    int cc74 = -1;
+    int cc75 = -1;
+    int cc76 = -1;
+};
+
+enum SeqEventType : uint8_t {
+    EV_NOTE_ON = 0,
+    EV_NOTE_OFF = 1,
+    EV_CONTROL = 2,     // controller-only line
+    EV_NOTE_CTRL = 3,   // controller delta carried by the note-on that follows it
+};
+
+// Bits of the controller-delta mask. The mask byte is followed by the changed fields only,
+// in this order: program, pan, volume (1 byte each), pitch bend (2 bytes LE), cc74-76 (1 byte each).
+enum CtrlField : uint8_t {
+    CTRL_PROGRAM = 1 << 0,
+    CTRL_PAN     = 1 << 1,
+    CTRL_VOLUME  = 1 << 2,
+    CTRL_BEND    = 1 << 3,
+    CTRL_CC74    = 1 << 4,
+    CTRL_CC75    = 1 << 5,
+    CTRL_CC76    = 1 << 6,
+    CTRL_RAMP    = 1 << 7,  // a ramp record follows the fields
+};
+
+// Fields a ramp moves
+#define RAMP_BEND   1
+#define RAMP_VOLUME 2
+#define RAMP_PAN    4
+
+// Longest ramp, in 64ths. No longer than the player's seek preroll, so a seek always replays
+// the start of any ramp still running at its target.
+#define RAMP_LENGTH_MAX 256
+
+// A controller line that also moves pitch bend, volume and/or pan in a straight line from the
+// values it sets to these targets, one step every 64th for length 64ths. Stored after the
+// record's fields as: fields (1 byte), length - 1 (1 byte), then the targets of the fields it
+// moves in this order: bend (2 bytes LE), volume, pan.
+struct CtrlRamp {
+    uint8_t fields = 0;
+    uint16_t length = 0;
+    int16_t pitchBend = 0;
+    uint8_t volume = 0, pan = 0;
+};
+
+// Value step 64ths into a ramp from `from` to `to` lasting length 64ths, rounded to nearest
+inline int rampValue(int from, int to, int step, int length) {
+    int32_t d = (to - from) * 2 * step;
+    return from + (d >= 0 ? d + length : d - length) / (2 * length);
+}
+
+// Note-off flags: which envelopes the note was started with
+#define NOTEOFF_VOLUME_ENV 1
+#define NOTEOFF_PITCH_ENV  2
+
+// Longest note length a note-off records; longer notes record this
+#define NOTEOFF_LENGTH_MAX 0x3FFF
+
+// Spacing of a Sequence's keyframes, in 64ths (two 4/4 bars)
+#define SEQ_KEYFRAME_INTERVAL 128
+
+// Every channel's controller values at a keyframe time, packed to 8 bytes a channel
+struct SeqKeyframe {
+    struct Ctrl {
+        uint8_t program, pan, volume;
+        int8_t cc74, cc75, cc76;
+        int16_t pitchBend;
+
+        void pack(const ChannelCtrl& c) {
+            program = (uint8_t)c.program;
+            pan = (uint8_t)c.pan;
+            volume = (uint8_t)c.channelVolume;
+            cc74 = (int8_t)c.cc74;
+            cc75 = (int8_t)c.cc75;
+            cc76 = (int8_t)c.cc76;
+            pitchBend = (int16_t)c.pitchBend;
+        }
+
+        void unpack(ChannelCtrl& c) const {
+            c.program = program;
+            c.pan = pan;
+            c.channelVolume = volume;
+            c.cc74 = cc74;
+            c.cc75 = cc75;
+            c.cc76 = cc76;
+            c.pitchBend = pitchBend;
+        }
+    };
+
+    uint32_t pos;       // first event due at or after the keyframe
+    Ctrl ctrl[16];
+};
+
+// Packed, time-sorted sequence (structure of arrays).
+//
+// Every event is one 32-bit time plus one 32-bit payload:
+//   bits 0-1   SeqEventType
+//   bits 2-5   channel
+//   note-on:   bits 8-15 note, bits 16-23 velocity
+//   note-off:  bits 8-15 note, bits 16-17 NOTEOFF_* flags, bits 18-31 how many 64ths after
+//              its note-on it comes (at most NOTEOFF_LENGTH_MAX)
+//   control:   bits 8-31 byte offset of the controller delta in ctrl
+// Controller deltas are relative to the previous event on the same channel in playback order,
+// so a controller-only line that only moves the pan costs 2 bytes of ctrl data.
+//
+// keyframes holds every channel's controller values each SEQ_KEYFRAME_INTERVAL 64ths, so a
+// Scheduler can seek without replaying the song from the start. They are built once when the
+// sequence is loaded (see buildKeyframes), never while it plays.
+struct Sequence {
+    int bpm = 120;
+    int loopStart64th = -1;
+    int loopEnd64th = -1;
+
+    std::vector<uint32_t> time;     // 64ths (the player may rescale these to its tick unit)
+    std::vector<uint32_t> events;   // payloads, parallel to time
+    std::vector<uint8_t> ctrl;      // controller-delta records
+    std::vector<SeqKeyframe> keyframes; // keyframes[k] is at k * SEQ_KEYFRAME_INTERVAL
+
+    size_t size() const { return events.size(); }
+    size_t memoryBytes() const {
+        return time.size() * sizeof(uint32_t) + events.size() * sizeof(uint32_t) + ctrl.size();
+    }
+    size_t keyframeBytes() const { return keyframes.size() * sizeof(SeqKeyframe); }
+};
+
+inline SeqEventType evType(uint32_t e)  { return static_cast<SeqEventType>(e & 3); }
+inline int evChannel(uint32_t e)        { return (e >> 2) & 15; }
+inline int evNote(uint32_t e)           { return (e >> 8) & 0xFF; }
+inline int evVelocity(uint32_t e)       { return (e >> 16) & 0xFF; }
+inline int evOffFlags(uint32_t e)       { return (e >> 16) & 3; }
+inline uint32_t evOffLength(uint32_t e) { return e >> 18; }
+inline uint32_t evCtrlOffset(uint32_t e) { return e >> 8; }
+
+// Apply the controller delta at p to c; returns the number of bytes consumed. The record's
+// ramp, if any, goes to ramp (length 0 when there is none).
+size_t applyCtrlDelta(const uint8_t* p, ChannelCtrl& c, CtrlRamp* ramp = nullptr);
+
+// Pack loaded notes into a Sequence (time in 64ths), keyframes included. bpm and loop points
+// are left to the caller. Returns false if a value does not fit the packed layout (or the
+// ctrl pool overflows).
+bool packSequence(const std::vector<Note>& notes, Sequence& seq);
+
+// Same events with the same controller records, wherever in the ctrl pools the records sit
+// (a compiled file or a pattern song stores them elsewhere). Keyframes are not compared.
+bool sameSequence(const Sequence& a, const Sequence& b);
+
+// One pass over seq's events, recording the keyframes. Anything that fills a Sequence other
+// than packSequence and the loaders must call it before the sequence is played.
+void buildKeyframes(Sequence& seq);
@@ -0,0 +1,180 @@
+#include "textreader.h"
+
+#include <cstring>
+
+LineReader::LineReader(const char* path) {
+    file = fopen(path, "rb");
+    if (!file) return;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        fileSize = ftell(file);
+        fseek(file, 0, SEEK_SET);
+    }
+}
+
+LineReader::~LineReader() {
+    if (file) fclose(file);
+}
+
+// Move what is left to the front of the buffer and read more behind it
+bool LineReader::fill() {
+    if (eof) return false;
+    if (start > 0) {
+        memmove(buf, buf + start, len - start);
+        len -= start;
+        start = 0;
+    }
+    if (len == sizeof(buf)) return false;
+
+    size_t got = fread(buf + len, 1, sizeof(buf) - len, file);
+    if (got == 0) eof = true;
+    len += got;
+    return got > 0;
+}
+
+bool LineReader::next(const char*& begin, const char*& lineEnd) {
+    if (!file) return false;
+    cut = false;
+
+    // Find the end of the line, reading more until it is in the buffer or too long
+    const char* nl;
+    size_t scanned = 0;
+    while (!(nl = static_cast<const char*>(memchr(buf + start + scanned, '\n', len - start - scanned)))) {
+        scanned = len - start;
+        if (scanned > LINE_READER_MAX) break;
+        if (!fill()) {
+            if (start == len) return false;
+            break; // last line without a line ending
+        }
+    }
+
+    begin = buf + start;
+    lineEnd = nl ? nl : buf + len;
+    if (lineEnd - begin > LINE_READER_MAX) {
+        cut = true;
+        lineEnd = begin + LINE_READER_MAX;
+    }
+
+    if (nl) {
+        start = nl - buf + 1;
+    } else if (!cut) {
+        start = len;
+    } else {
+        // Keep the part being returned at the front and drop the rest of the line
+        memmove(buf, begin, LINE_READER_MAX);
+        begin = buf;
+        lineEnd = buf + LINE_READER_MAX;
+        len = LINE_READER_MAX;
+        start = len;
+        while (true) {
+            size_t got = fread(buf + len, 1, sizeof(buf) - len, file);
+            if (got == 0) {
+                eof = true;
+                break;
+            }
+            const char* skip = static_cast<const char*>(memchr(buf + len, '\n', got));
+            if (skip) {
+                start = skip - buf + 1;
+                len += got;
+                break;
+            }
+        }
+    }
+
+    if (lineEnd > begin && lineEnd[-1] == '\r') lineEnd--;
+    line++;
+    return true;
+}
+
+void trimSpace(const char*& begin, const char*& end) {
+    while (begin < end && (*begin == ' ' || *begin == '\t')) begin++;
+    while (end > begin && (end[-1] == ' ' || end[-1] == '\t')) end--;
+}
+
+const char* findText(const char* begin, const char* end, const char* needle) {
+    size_t n = strlen(needle);
+    for (const char* p = begin; p + n <= end; p++)
+        if (memcmp(p, needle, n) == 0) return p;
+    return nullptr;
+}
+
+void FieldReader::skipSpace() {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+}
+
+// After a value: allow spaces, then a comma or the end of the line
+bool FieldReader::finishField() {
+    skipSpace();
+    if (p < end && *p == ',') {
+        p++;
+        return true;
+    }
+    if (p == end) return true;
+    why = "unexpected character";
+    return false;
+}
+
+bool FieldReader::nextInt(int& value) {
+    skipSpace();
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+
+    if (p == end || *p < '0' || *p > '9') {
+        why = (p == end) ? "missing value" : "not a number";
+        return false;
+    }
+
+    int64_t v = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (*p++ - '0');
+        if (v > INT32_MAX) {
+            why = "number too large";
+            return false;
+        }
+    }
+    value = (int)(negative ? -v : v);
+    return finishField();
+}
+
+bool FieldReader::nextFixed16(int32_t& value) {
+    skipSpace();
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+
+    int64_t whole = 0, frac = 0, scale = 1;
+    bool digits = false;
+    while (p < end && *p >= '0' && *p <= '9') {
+        whole = whole * 10 + (*p++ - '0');
+        digits = true;
+        if (whole > 32767) {
+            why = "number too large";
+            return false;
+        }
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            // Digits past the ninth are below 16.16 resolution
+            if (scale < 1000000000) {
+                frac = frac * 10 + (*p - '0');
+                scale *= 10;
+            }
+            p++;
+            digits = true;
+        }
+    }
+    if (!digits) {
+        why = (p == end) ? "missing value" : "not a number";
+        return false;
+    }
+
+    int64_t q = (whole << 16) + frac * 65536 / scale;
+    value = (int32_t)(negative ? -q : q);
+    return finishField();
+}
+
+bool FieldReader::atEnd() {
+    skipSpace();
+    if (p == end) return true;
+    why = "too many values";
+    return false;
+}
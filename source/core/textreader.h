@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// Longest line a LineReader returns whole; longer ones are reported as malformed
+#define LINE_READER_MAX 512
+
+// Reads a text file one line at a time through a fixed buffer, so nothing is allocated no
+// matter how long the file is. Handles LF and CRLF endings.
+class LineReader {
+public:
+    explicit LineReader(const char* path);
+    ~LineReader();
+
+    bool isOpen() const { return file != nullptr; }
+
+    // File size in bytes, or -1 if unknown
+    long size() const { return fileSize; }
+
+    // The next line, without its line ending, as [begin, end). False at the end of the file.
+    bool next(const char*& begin, const char*& end);
+
+    // 1-based number of the line next() returned last
+    int lineNumber() const { return line; }
+
+    // The last line was longer than LINE_READER_MAX and has been cut short
+    bool tooLong() const { return cut; }
+
+private:
+    bool fill();
+
+    FILE* file = nullptr;
+    long fileSize = -1;
+    char buf[LINE_READER_MAX * 4];
+    size_t start = 0, len = 0;
+    int line = 0;
+    bool eof = false, cut = false;
+};
+
+// Reads comma-separated numbers from one line. Spaces and tabs around a value are ignored;
+// anything else that is not part of a number makes the read fail, so malformed input can be
+// reported instead of being read as 0.
+class FieldReader {
+public:
+    FieldReader(const char* begin, const char* end) : p(begin), end(end) {}
+
+    // Next value as an integer
+    bool nextInt(int& value);
+
+    // Next value as a decimal number ("1.25", "-3"), returned in 16.16 fixed point
+    bool nextFixed16(int32_t& value);
+
+    // True once every field has been read (trailing spaces allowed)
+    bool atEnd();
+
+    // For error messages: set by the last failed read
+    const char* problem() const { return why; }
+
+private:
+    void skipSpace();
+    bool finishField();
+
+    const char* p;
+    const char* end;
+    const char* why = nullptr;
+};
+
+// [begin, end) with spaces and tabs removed from both ends
+void trimSpace(const char*& begin, const char*& end);
+
+// Position of needle in [begin, end), or nullptr
+const char* findText(const char* begin, const char* end, const char* needle);
@@ -0,0 +1,209 @@
+#include "trace.h"
+
+#include <cstring>
+
+const char* psgTraceResultString(PsgTraceResult result) {
+    switch (result) {
+        case PSG_TRACE_OK:           return "ok";
+        case PSG_TRACE_NOT_FOUND:    return "file not found";
+        case PSG_TRACE_BAD_MAGIC:    return "not a PSG trace";
+        case PSG_TRACE_BAD_VERSION:  return "unsupported trace version";
+        case PSG_TRACE_TRUNCATED:    return "file is truncated";
+        case PSG_TRACE_BAD_RECORD:   return "corrupt record";
+        case PSG_TRACE_WRITE_FAILED: return "write failed";
+    }
+    return "unknown error";
+}
+
+// Argument bytes of each kind of write, in PsgWriteKind order
+static const int traceArgBytes[PSG_WRITE_KINDS] = { 5, 4, 2, 1, 1, 0 };
+
+PsgTraceResult PsgTrace::start(const char* path, uint32_t clockHz) {
+    stop();
+    file = fopen(path, "wb");
+    if (!file) return PSG_TRACE_WRITE_FAILED;
+
+    hz = clockHz;
+    tick = lastTick = 0;
+    recordCount = droppedCount = 0;
+    active = 0;
+    for (Block& b : blocks) {
+        b.full = false;
+        b.used = 0;
+    }
+
+    // Rewritten with the counts by stop()
+    PsgTraceHeader header = {PSG_TRACE_MAGIC, PSG_TRACE_VERSION, 0, hz, 0, 0};
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        file = nullptr;
+        return PSG_TRACE_WRITE_FAILED;
+    }
+    return PSG_TRACE_OK;
+}
+
+PsgTraceResult PsgTrace::service() {
+    if (!file) return PSG_TRACE_OK;
+    for (Block& b : blocks) {
+        if (!b.full) continue;
+        bool ok = fwrite(b.data, 1, b.used, file) == b.used;
+        b.used = 0;
+        b.full = false;
+        if (!ok) return PSG_TRACE_WRITE_FAILED;
+    }
+    return PSG_TRACE_OK;
+}
+
+PsgTraceResult PsgTrace::stop() {
+    if (!file) return PSG_TRACE_OK;
+
+    // At most one block is full at a time, and it is older than the active one
+    bool ok = service() == PSG_TRACE_OK;
+    Block& b = blocks[active];
+    ok = ok && fwrite(b.data, 1, b.used, file) == b.used;
+    b.used = 0;
+
+    PsgTraceHeader header = {PSG_TRACE_MAGIC, PSG_TRACE_VERSION, 0, hz, recordCount, droppedCount};
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+    file = nullptr;
+    return ok ? PSG_TRACE_OK : PSG_TRACE_WRITE_FAILED;
+}
+
+uint8_t* PsgTrace::reserve() {
+    Block* b = &blocks[active];
+    if (b->used + PSG_TRACE_RECORD_MAX > PSG_TRACE_BLOCK_BYTES) {
+        Block& other = blocks[active ^ 1];
+        if (other.full) return nullptr;
+        b->full = true;
+        active ^= 1;
+        b = &other;
+    }
+    return &b->data[b->used];
+}
+
+void PsgTrace::record(int kind, int channel, const uint8_t* args, int argBytes) {
+    if (!file) return;
+    uint8_t* start = reserve();
+    if (!start) {
+        droppedCount++;
+        return;
+    }
+
+    uint8_t* p = start;
+    uint32_t delta = tick - lastTick;
+    *p++ = (uint8_t)(channel | (kind << 4) | (delta ? 0x80 : 0));
+    for (; delta; delta >>= 7)
+        *p++ = (uint8_t)((delta & 0x7F) | (delta > 0x7F ? 0x80 : 0));
+    memcpy(p, args, argBytes);
+    p += argBytes;
+
+    blocks[active].used += p - start;
+    lastTick = tick;
+    recordCount++;
+}
+
+void PsgTrace::playTone(int channel, int duty, uint16_t freq, uint8_t volume, uint8_t pan) {
+    if (out) out->playTone(channel, duty, freq, volume, pan);
+    uint8_t args[5] = {(uint8_t)duty, (uint8_t)(freq & 0xFF), (uint8_t)(freq >> 8), volume, pan};
+    record(PSG_WRITE_TONE, channel, args, sizeof(args));
+}
+
+void PsgTrace::playNoise(int channel, uint16_t freq, uint8_t volume, uint8_t pan) {
+    if (out) out->playNoise(channel, freq, volume, pan);
+    uint8_t args[4] = {(uint8_t)(freq & 0xFF), (uint8_t)(freq >> 8), volume, pan};
+    record(PSG_WRITE_NOISE, channel, args, sizeof(args));
+}
+
+void PsgTrace::setFreq(int channel, uint16_t freq) {
+    if (out) out->setFreq(channel, freq);
+    uint8_t args[2] = {(uint8_t)(freq & 0xFF), (uint8_t)(freq >> 8)};
+    record(PSG_WRITE_FREQ, channel, args, sizeof(args));
+}
+
+void PsgTrace::setVolume(int channel, uint8_t volume) {
+    if (out) out->setVolume(channel, volume);
+    record(PSG_WRITE_VOLUME, channel, &volume, 1);
+}
+
+void PsgTrace::setPan(int channel, uint8_t pan) {
+    if (out) out->setPan(channel, pan);
+    record(PSG_WRITE_PAN, channel, &pan, 1);
+}
+
+void PsgTrace::kill(int channel) {
+    if (out) out->kill(channel);
+    record(PSG_WRITE_KILL, channel, nullptr, 0);
+}
+
+PsgTraceResult loadTrace(const char* path, PsgTraceHeader& header, std::vector<PsgTraceRecord>& records) {
+    records.clear();
+    FILE* file = fopen(path, "rb");
+    if (!file) return PSG_TRACE_NOT_FOUND;
+
+    std::vector<uint8_t> data;
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) data.insert(data.end(), buffer, buffer + n);
+    fclose(file);
+
+    if (data.size() < sizeof(header)) return PSG_TRACE_TRUNCATED;
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != PSG_TRACE_MAGIC) return PSG_TRACE_BAD_MAGIC;
+    if (header.version != PSG_TRACE_VERSION) return PSG_TRACE_BAD_VERSION;
+
+    records.reserve(header.records);
+    const uint8_t* p = data.data() + sizeof(header);
+    const uint8_t* end = data.data() + data.size();
+    uint32_t tick = 0;
+    while (p < end) {
+        PsgTraceRecord r;
+        uint8_t head = *p++;
+        r.channel = head & 0x0F;
+        r.kind = (head >> 4) & 7;
+        if (r.kind >= PSG_WRITE_KINDS) return PSG_TRACE_BAD_RECORD;
+
+        if (head & 0x80) {
+            uint32_t delta = 0;
+            for (int shift = 0;; shift += 7) {
+                if (shift > 28) return PSG_TRACE_BAD_RECORD;
+                if (p == end) return PSG_TRACE_TRUNCATED;
+                uint8_t byte = *p++;
+                delta |= (uint32_t)(byte & 0x7F) << shift;
+                if (!(byte & 0x80)) break;
+            }
+            tick += delta;
+        }
+        r.tick = tick;
+
+        if (end - p < traceArgBytes[r.kind]) return PSG_TRACE_TRUNCATED;
+        switch (r.kind) {
+            case PSG_WRITE_TONE:
+                r.duty = p[0]; r.freq = p[1] | (p[2] << 8); r.volume = p[3]; r.pan = p[4];
+                break;
+            case PSG_WRITE_NOISE:
+                r.freq = p[0] | (p[1] << 8); r.volume = p[2]; r.pan = p[3];
+                break;
+            case PSG_WRITE_FREQ:   r.freq = p[0] | (p[1] << 8); break;
+            case PSG_WRITE_VOLUME: r.volume = p[0]; break;
+            case PSG_WRITE_PAN:    r.pan = p[0]; break;
+        }
+        p += traceArgBytes[r.kind];
+        records.push_back(r);
+    }
+
+    // A recording that never finished has no count; one that did must match it
+    if (header.records && header.records != records.size()) return PSG_TRACE_TRUNCATED;
+    return PSG_TRACE_OK;
+}
+
+void replayTraceRecord(const PsgTraceRecord& r, PsgBackend& out) {
+    switch (r.kind) {
+        case PSG_WRITE_TONE:   out.playTone(r.channel, r.duty, r.freq, r.volume, r.pan); break;
+        case PSG_WRITE_NOISE:  out.playNoise(r.channel, r.freq, r.volume, r.pan); break;
+        case PSG_WRITE_FREQ:   out.setFreq(r.channel, r.freq); break;
+        case PSG_WRITE_VOLUME: out.setVolume(r.channel, r.volume); break;
+        case PSG_WRITE_PAN:    out.setPan(r.channel, r.pan); break;
+        case PSG_WRITE_KILL:   out.kill(r.channel); break;
+    }
+}
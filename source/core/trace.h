@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "psg.h"
+
+// PSG write trace (.ntr)
+//
+// Every write that reached the hardware, in order, stamped with the sequencer timer tick it
+// was sent on:
+//   PsgTraceHeader
+//   records to the end of the file, each:
+//     uint8_t head         bits 0-3 channel, bits 4-6 PsgWriteKind, bit 7 a tick delta follows
+//     tick delta           timer ticks since the previous record (first: since tick 0), as
+//                          7 bits per byte, low first, bit 7 set on all but the last byte
+//     arguments by kind    tone:  duty, freq (2 bytes LE), volume, pan
+//                          noise: freq (2 bytes LE), volume, pan
+//                          freq:  freq (2 bytes LE)
+//                          volume, pan: one byte
+//                          kill:  none
+// A busy tick costs a few bytes per write and a quiet one nothing, so a trace of a whole song
+// stays small enough to write to the card while it plays.
+
+#define PSG_TRACE_MAGIC   0x4352544E // "NTRC"
+#define PSG_TRACE_VERSION 1
+
+struct PsgTraceHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t clockHz;   // timer ticks per second
+    uint32_t records;   // written by stop(); 0 if the recording never finished
+    uint32_t dropped;   // writes that did not fit the buffers and are missing
+};
+
+static_assert(sizeof(PsgTraceHeader) == 20, "PsgTraceHeader must be packed");
+
+// Longest record: head, a 32-bit tick delta and a tone's arguments
+#define PSG_TRACE_RECORD_MAX 11
+
+// Buffers PsgTrace fills while service() writes the other one out
+#define PSG_TRACE_BLOCK_BYTES 4096
+
+// One decoded record
+struct PsgTraceRecord {
+    uint32_t tick = 0;
+    uint8_t kind = 0;       // PsgWriteKind
+    uint8_t channel = 0;
+    uint8_t duty = 0, volume = 0, pan = 0;
+    uint16_t freq = 0;
+};
+
+enum PsgTraceResult {
+    PSG_TRACE_OK = 0,
+    PSG_TRACE_NOT_FOUND,
+    PSG_TRACE_BAD_MAGIC,
+    PSG_TRACE_BAD_VERSION,
+    PSG_TRACE_TRUNCATED,
+    PSG_TRACE_BAD_RECORD,
+    PSG_TRACE_WRITE_FAILED,
+};
+
+const char* psgTraceResultString(PsgTraceResult result);
+
+// Passes every write on to an output and, while recording, appends it to a trace file. The
+// writes go into one of two memory blocks; service() writes a full block out from the main
+// loop while the sequencer fills the other, so recording never waits on the card. If the
+// card falls so far behind that both are full, writes are left out of the trace (not the
+// output) and counted.
+class PsgTrace : public PsgBackend {
+public:
+    explicit PsgTrace(PsgBackend* out = nullptr) : out(out) {}
+    ~PsgTrace() { stop(); }
+
+    void setOutput(PsgBackend* o) { out = o; }
+
+    // Start recording to path, at tick 0. clockHz is the rate advance() is called at.
+    PsgTraceResult start(const char* path, uint32_t clockHz);
+
+    // Write what is recorded so far, fill in the header and close the file. Not safe to call
+    // while writes may arrive.
+    PsgTraceResult stop();
+
+    bool recording() const { return file != nullptr; }
+
+    // Call from the main loop while recording: writes out a full block, if there is one
+    PsgTraceResult service();
+
+    // The writes from here on were sent on the next timer tick
+    void advance() { tick++; }
+
+    uint32_t records() const { return recordCount; }
+    uint32_t dropped() const { return droppedCount; }
+
+    void playTone(int channel, int duty, uint16_t freq, uint8_t volume, uint8_t pan) override;
+    void playNoise(int channel, uint16_t freq, uint8_t volume, uint8_t pan) override;
+    void setFreq(int channel, uint16_t freq) override;
+    void setVolume(int channel, uint8_t volume) override;
+    void setPan(int channel, uint8_t pan) override;
+    void kill(int channel) override;
+
+private:
+    struct Block {
+        volatile bool full = false;     // waiting for service()
+        volatile uint32_t used = 0;     // cleared by service() before full
+        uint8_t data[PSG_TRACE_BLOCK_BYTES];
+    };
+
+    // Room for one record in the active block, or nullptr to drop it
+    uint8_t* reserve();
+    void record(int kind, int channel, const uint8_t* args, int argBytes);
+
+    PsgBackend* out;
+    FILE* file = nullptr;
+    uint32_t hz = 0;
+    uint32_t tick = 0, lastTick = 0;
+    uint32_t recordCount = 0, droppedCount = 0;
+    int active = 0;
+    Block blocks[2];
+};
+
+// Read a whole trace
+PsgTraceResult loadTrace(const char* path, PsgTraceHeader& header, std::vector<PsgTraceRecord>& records);
+
+// Make the write a record describes
+void replayTraceRecord(const PsgTraceRecord& r, PsgBackend& out);
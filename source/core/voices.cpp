@@ -0,0 +1,82 @@
+#include "voices.h"
+
+void VoiceAllocator::reset() {
+    *this = VoiceAllocator();
+}
+
+int VoiceAllocator::oldest(uint16_t mask) const {
+    int best = -1;
+    for (; mask; mask &= mask - 1) {
+        int v = __builtin_ctz(mask);
+        if (best < 0 || started[v] - started[best] > 0x80000000u) best = v;
+    }
+    return best;
+}
+
+int VoiceAllocator::pickVictim(uint16_t pool, StealPolicy policy) const {
+    if (policy == STEAL_RELEASING) {
+        uint16_t releasing = pool & ~heldMask;
+        return oldest(releasing ? releasing : pool);
+    }
+    if (policy == STEAL_QUIETEST) {
+        // Lowest level, the oldest of those on a tie
+        int lowest = 256;
+        uint16_t quiet = 0;
+        for (uint16_t mask = pool; mask; mask &= mask - 1) {
+            int v = __builtin_ctz(mask);
+            if (levels[v] < lowest) { lowest = levels[v]; quiet = 0; }
+            if (levels[v] == lowest) quiet |= 1 << v;
+        }
+        return oldest(quiet);
+    }
+    return oldest(pool);
+}
+
+int VoiceAllocator::allocate(int channel, int note, uint16_t pool, StealPolicy policy, bool& stolen) {
+    stolen = false;
+
+    // Re-striking a held key retriggers the voice it already has
+    int v = find(channel, note);
+    if (v >= 0) {
+        started[v] = ++clock;
+        return v;
+    }
+
+    uint16_t candidates = freeMask & pool;
+    if (candidates) {
+        v = __builtin_ctz(candidates);
+    } else {
+        v = pickVictim(pool, policy);
+        if (v < 0) return -1;
+        stolen = true;
+        ownedMask[owner[v]] &= ~(1 << v);
+    }
+
+    freeMask &= ~(1 << v);
+    heldMask |= 1 << v;
+    ownedMask[channel] |= 1 << v;
+    owner[v] = (uint8_t)channel;
+    notes[v] = (uint8_t)note;
+    levels[v] = 0;
+    started[v] = ++clock;
+    return v;
+}
+
+int VoiceAllocator::find(int channel, int note) const {
+    for (uint16_t mask = ownedMask[channel] & heldMask; mask; mask &= mask - 1) {
+        int v = __builtin_ctz(mask);
+        if (notes[v] == note) return v;
+    }
+    return -1;
+}
+
+void VoiceAllocator::keyOff(int voice) {
+    heldMask &= ~(1 << voice);
+}
+
+void VoiceAllocator::release(int voice) {
+    if (freeMask & (1 << voice)) return;
+    freeMask |= 1 << voice;
+    heldMask &= ~(1 << voice);
+    ownedMask[owner[voice]] &= ~(1 << voice);
+}
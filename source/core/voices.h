@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+// Hardware voices a song channel can be given when the player allocates voices: the six
+// pulse channels for tone parts, the two noise channels for channels 15-16
+#define VOICE_TONE_MASK  0x3F00
+#define VOICE_NOISE_MASK 0xC000
+
+// Which sounding voice gives way when a note finds none free
+enum StealPolicy {
+    STEAL_OLDEST,       // the one started longest ago
+    STEAL_QUIETEST,     // the one at the lowest volume right now
+    STEAL_RELEASING,    // the oldest one already in its release, else the oldest
+};
+
+// Hands out hardware voices to (channel, note) pairs. Free voices are kept in a bitmask, so
+// finding one is a single bit scan; stealing looks at the few voices of one pool.
+class VoiceAllocator {
+public:
+    void reset();
+
+    // Voice for a new note from pool. A note already held on the channel keeps its voice.
+    // stolen is set when the voice was taken from a note that was still sounding.
+    int allocate(int channel, int note, uint16_t pool, StealPolicy policy, bool& stolen);
+
+    // Voice holding note on channel (key still down), or -1
+    int find(int channel, int note) const;
+
+    // The key is up; the voice keeps sounding through its release
+    void keyOff(int voice);
+
+    // The voice is silent and can be handed out again
+    void release(int voice);
+
+    // Current output volume, for STEAL_QUIETEST
+    void setLevel(int voice, int level) { levels[voice] = (uint8_t)level; }
+
+    // Sounding voices started by channel
+    uint16_t owned(int channel) const { return ownedMask[channel]; }
+
+private:
+    int pickVictim(uint16_t pool, StealPolicy policy) const;
+    int oldest(uint16_t mask) const;
+
+    uint16_t freeMask = 0xFFFF;
+    uint16_t heldMask = 0;
+    uint16_t ownedMask[16] = {};
+    uint8_t owner[16] = {};
+    uint8_t notes[16] = {};
+    uint8_t levels[16] = {};
+    uint32_t started[16] = {};
+    uint32_t clock = 0;
+};
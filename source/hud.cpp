@@ -0,0 +1,208 @@
+#include "hud.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <nds.h>
+
+static const char phaseNames[] = "-ADSR";
+
+void StatusDisplay::begin(const char* name, const SeqStatus* st, bool streamed, Profiler* prof) {
+    songName = name;
+    status = st;
+    streaming = streamed;
+    profiler = prof;
+    notice = nullptr;
+    lastLoopCount = st->loops;
+    loopMessage = -1;
+    framesUntilRefresh = 0;
+    costTotal = 0; costFrames = 0;
+
+    // Start from a known blank screen so the first diff redraws everything that has text
+    consoleClear();
+    memset(shown, ' ', sizeof(shown));
+}
+
+void StatusDisplay::setNotice(const char* text) {
+    notice = text;
+}
+
+void StatusDisplay::toggle() {
+    on = !on;
+    consoleClear();
+    memset(shown, ' ', sizeof(shown));
+    framesUntilRefresh = 0;
+    costTotal = 0; costFrames = 0;
+}
+
+void StatusDisplay::toggleProfile() {
+    profilePage = !profilePage;
+    framesUntilRefresh = 0;
+}
+
+void StatusDisplay::update() {
+    uint32_t started = profiler ? profiler->now() : 0;
+
+    if (status->loops != lastLoopCount) {
+        lastLoopCount = status->loops;
+        loopMessage = status->position;
+    }
+
+    if (--framesUntilRefresh <= 0) {
+        framesUntilRefresh = HUD_REFRESH_FRAMES;
+
+        // Report the previous period's cost, then draw with it
+        if (costFrames) {
+            uint32_t avg = costTotal / costFrames;
+            if (on) costOn = avg; else costOff = avg;
+        }
+        costTotal = 0; costFrames = 0;
+
+        memset(next, ' ', sizeof(next));
+        render();
+        flush();
+    }
+
+    if (profiler) {
+        costTotal += profiler->now() - started;
+        profiler->end(PROF_DISPLAY, started);
+    }
+    costFrames++;
+}
+
+void StatusDisplay::render() {
+    int usOn = profiler ? (int)profiler->toMicros(costOn) : 0;
+    int usOff = profiler ? (int)profiler->toMicros(costOff) : 0;
+
+    put(22, 0, "HUD us/frame on:");
+    putInt(22, 16, usOn, 5);
+    put(22, 22, "off:");
+    putInt(22, 26, usOff, 5);
+    put(23, 0, on ? "SELECT: hide HUD" : "SELECT: show HUD");
+    if (on) put(23, 17, profilePage ? "X: channels" : "X: profile");
+    if (notice) put(21, 0, notice);
+
+    if (!on) return;
+
+    put(0, 0, songName);
+    if (streaming) {
+        put(2, 0, "Streaming, underruns:");
+        putInt(2, 22, status->underruns, 6);
+    }
+    put(1, 0, "64th:");
+    putInt(1, 5, status->position, 6);
+    put(1, 12, "BPM:");
+    putInt(1, 16, status->bpm, 3);
+    put(1, 20, "Loops:");
+    putInt(1, 26, status->loops, 4);
+
+    if (profilePage && profiler) {
+        renderProfile();
+    } else {
+        renderChannels();
+    }
+
+    if (loopMessage >= 0) {
+        put(20, 0, "Looping back to 64th:");
+        putInt(20, 22, loopMessage, 6);
+    }
+}
+
+void StatusDisplay::renderChannels() {
+    put(3, 0, "Ch Note Vol Pan  V  P E Env");
+    for (int ch = 0; ch < 16; ch++) {
+        const SeqChannelStatus& pc = status->channels[ch];
+        int row = 4 + ch;
+
+        putInt(row, 0, ch, 2);
+        if (pc.active) {
+            putInt(row, 3, pc.note, 4);
+            putInt(row, 8, pc.baseVolume, 3);
+        }
+        putInt(row, 12, pc.pan, 3);
+        if (pc.cc74 != -1) putInt(row, 15, pc.cc74, 3);
+        if (pc.cc75 != -1) putInt(row, 18, pc.cc75, 3);
+        if (pc.active && pc.cc74 >= 0 && pc.cc74 < 16) {
+            char phase[2] = { phaseNames[pc.envPhase], 0 };
+            put(row, 22, phase);
+            putInt(row, 24, pc.level, 3);
+        }
+    }
+}
+
+// The sequencer's sections come from the latest status, as they stood when it was taken; only
+// PROF_DISPLAY, which this loop records itself, is read from the profiler
+void StatusDisplay::renderProfile() {
+    put(3, 0, "Section      calls avg us   max");
+    for (int s = 0; s < PROF_SECTIONS; s++) {
+        SeqProfileSection st = status->profile[s];
+        if (s == PROF_DISPLAY) {
+            const ProfileStats& own = profiler->section(s);
+            st.calls = own.calls;
+            st.total = own.total;
+            st.max = own.max;
+        }
+        int row = 4 + s;
+        put(row, 0, profileSectionName(s));
+        putInt(row, 9, (int)st.calls, 10);
+        if (st.calls) putInt(row, 20, (int)profiler->toMicros(st.total / st.calls), 6);
+        putInt(row, 27, (int)profiler->toMicros(st.max), 5);
+    }
+
+    put(11, 0, "Tick overruns:");
+    putInt(11, 15, (int)status->overruns, 8);
+
+    // Three buckets a row, the last one counting 16 or more events
+    put(13, 0, "Events per 64th:");
+    const uint32_t* events = status->events;
+    for (int i = 0; i < PROFILE_EVENT_BUCKETS; i++) {
+        int row = 14 + i / 3, col = (i % 3) * 11;
+        putInt(row, col, i, 2);
+        put(row, col + 2, i == PROFILE_EVENT_BUCKETS - 1 ? "+" : ":");
+        putInt(row, col + 3, (int)events[i], 7);
+    }
+}
+
+void StatusDisplay::flush() {
+    char run[HUD_COLS + 1];
+
+    for (int row = 0; row < HUD_ROWS; row++) {
+        // The last cell is never written, so the console does not scroll
+        int cols = (row == HUD_ROWS - 1) ? HUD_COLS - 1 : HUD_COLS;
+        int col = 0;
+
+        while (col < cols) {
+            if (next[row][col] == shown[row][col]) { col++; continue; }
+
+            int start = col;
+            while (col < cols && next[row][col] != shown[row][col]) {
+                run[col - start] = next[row][col];
+                shown[row][col] = next[row][col];
+                col++;
+            }
+            run[col - start] = 0;
+
+            // libnds console cursor positions are 0-based
+            printf("\x1b[%d;%dH%s", row, start, run);
+        }
+    }
+}
+
+void StatusDisplay::put(int row, int col, const char* text) {
+    while (*text && col < HUD_COLS)
+        next[row][col++] = *text++;
+}
+
+// Right-aligned, clipped to width
+void StatusDisplay::putInt(int row, int col, int value, int width) {
+    char digits[12];
+    int n = 0;
+    bool negative = value < 0;
+    unsigned v = negative ? -(unsigned)value : (unsigned)value;
+
+    do { digits[n++] = '0' + v % 10; v /= 10; } while (v && n < 11);
+    if (negative) digits[n++] = '-';
+
+    int pos = col + width - 1;
+    for (int i = 0; i < n && pos >= col; i++, pos--)
+        if (pos < HUD_COLS) next[row][pos] = digits[i];
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+
+#include "core/link.h"
+#include "core/profile.h"
+
+// Size of the text console set up by consoleDemoInit()
+#define HUD_COLS 32
+#define HUD_ROWS 24
+
+// Refresh the HUD at most once every this many frames (6 = 10 Hz)
+#define HUD_REFRESH_FRAMES 6
+
+// Playback status on the bottom-screen console. Each refresh formats the whole screen into
+// a text grid, compares it with what is already on screen and only writes the cells that
+// changed, so a steady song costs almost nothing to display.
+class StatusDisplay {
+public:
+    // status: the sequencer's latest status, kept up to date by the caller; the underrun
+    // count and the profile page come from it.
+    // streaming: the song is streamed, so its underruns are shown.
+    // profiler: times the HUD itself, into PROF_DISPLAY.
+    void begin(const char* songName, const SeqStatus* status, bool streaming = false,
+               Profiler* profiler = nullptr);
+
+    // Show text on its own row until replaced (nullptr clears it)
+    void setNotice(const char* text);
+
+    // Call once per frame
+    void update();
+
+    void toggle();
+    bool enabled() const { return on; }
+
+    // Switch the channel table for the profiler's counters
+    void toggleProfile();
+
+private:
+    void render();
+    void renderChannels();
+    void renderProfile();
+    void flush();
+    void put(int row, int col, const char* text);
+    void putInt(int row, int col, int value, int width);
+
+    const SeqStatus* status = nullptr;
+    bool streaming = false;
+    Profiler* profiler = nullptr;
+    const char* songName = "";
+    const char* notice = nullptr;
+
+    char shown[HUD_ROWS][HUD_COLS];
+    char next[HUD_ROWS][HUD_COLS];
+
+    bool on = true;
+    bool profilePage = false;
+    int framesUntilRefresh = 0;
+    int lastLoopCount = 0;
+    int loopMessage = -1;
+
+    // Main-loop cost per frame in profiler clock ticks, averaged over each refresh period
+    uint32_t costTotal = 0;
+    int costFrames = 0;
+    uint32_t costOn = 0, costOff = 0;
+};
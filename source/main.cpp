@@ -12,300 +12,134 @@
 #include <fat.h>
 #include <map>
 
-#define OCTAVE_SHIFT 36
-#define PSG_OFFSET 0
-#define PITCH_BEND_RANGE_SEMITONES 12.0f
-#define GLOBAL_VOLUME_MULTIPLIER 0.5f
-#define MAX_DRUM_NOTES 128  // Support all MIDI notes as potential triggers
-
-// Note struct with per-note paramters that is then sent to each channel
-struct Note {
-    int channel, program, noteNumber, velocity, startDiv, endDiv, startDivFrames, endDivFrames;
-    int pan;
-    int pitchBend;
-    int channelVolume;
-    int cc74; // ADSR envelope index (0-based, -1 = none)
-    int cc75; // Pitch/mod envelope index (0-based, -1 = none)
-    int cc76; // Slide envelope (0-based, -1 = none)
-};
-
-// ADSR; attack, decay, and release are measured in 64ths, while sustain is measured in level from 0-127
-struct VolumeEnv {
-    int A, D, S, R; // Attack, Decay, Sustain, Release (64ths)
-};
-
-// Struct for tracking the current state of the *volume* envelope
-struct NoteState {
-    int envPhase = 0;   // 0=inactive,1=Attack,2=Decay,3=Sustain,4=Release
-    float amp = 0;      // Current amplitude 0–127
-    int envCounter = 0; // Counter for current phase
-};
-
-// Envelope for pitch
-struct PitchEnv {
-    int delay;  // in 64ths
-    int rate;   // in 64ths (period)
-    float depth;// in Hz
-    int ramp;   // in 64ths (fade-in)
-};
+#include "core/engine.h"
+#include "core/envelope.h"
+#include "core/link.h"
+#include "core/loader.h"
+#include "core/pattern.h"
+#include "core/pitch.h"
+#include "core/player.h"
+#include "core/profile.h"
+#include "core/seqbin.h"
+#include "core/trace.h"
+#include "hud.h"
+
+// Hardware timer that drives the sequencer, and its rate. 1024 Hz keeps the step well under
+// the shortest 64th the format allows while leaving the CPU to the UI.
+#define SEQ_TIMER 3
+#define SEQ_TIMER_HZ 1024
 
-// Struct for tracking the state of the *pitch* envelope
-struct PitchState {
-    bool active = false;
-    int phaseState = 0; 
-    float phase = 0.0f;
-    float currDepth = 0.0f;
-    int counter = 0;
-};
+// Unused until later (maybe)
+enum bitDepth { form8bit = 0, form16bit = 1, formADPCM = 2 };
 
-// Struct for tracking the state of the *slide* envelope
-struct SlideEnv {
-    int startNote[MAX_DRUM_NOTES];   // indexed by trigger note
-    int endNote[MAX_DRUM_NOTES];
-    int duration64[MAX_DRUM_NOTES];
-    bool defined[MAX_DRUM_NOTES];    // track which notes are defined
-    bool isRelative[MAX_DRUM_NOTES];
+// Forwards player output to the libnds PSG calls
+class NdsPsg : public PsgBackend {
+public:
+    void playTone(int channel, int duty, u16 freq, u8 volume, u8 pan) override {
+        soundPlayPSGChannel(channel, static_cast<DutyCycle>(duty), freq, volume, pan);
+    }
+    void playNoise(int channel, u16 freq, u8 volume, u8 pan) override {
+        soundPlayNoiseChannel(channel, freq, volume, pan);
+    }
+    void setFreq(int channel, u16 freq) override { soundSetFreq(channel, freq); }
+    void setVolume(int channel, u8 volume) override { soundSetVolume(channel, volume); }
+    void setPan(int channel, u8 pan) override { soundSetPan(channel, pan); }
+    void kill(int channel) override { soundKill(channel); }
 };
 
-struct SlideState {
-    bool active = false;
-    int startFrame = 0;
-    int startNote = 0;
-    int endNote = 0;
-    int counter = 0;       // counts frames or 64th ticks
-    int duration64 = 0;    // duration of the slide
-};
+// Too large for the stack, and shared with the timer IRQ
+static SeqStream stream;
+static PatternSequence patternSong;     // song.nseq when it was compiled with nseqc -p
+
+// Two of each, so a reload can read into the one playback is not using and then switch over
+static Sequence songs[2];
+static Sequence* seq = &songs[0];
+static EnvelopeBank envelopeBanks[2];
+static EnvelopeBank* envelopes = &envelopeBanks[0];
+
+#define ENVELOPE_PATH "fat:/NuclearSEQ/seq/envelopes.txt"
+#define TRACE_PATH "fat:/NuclearSEQ/trace.ntr"
+static NdsPsg psg;
+static PsgTrace psgTrace(&psg);     // between the shadow and psg while recording
+static PsgShadow psgShadow(&psg);
+static Sequence sfx;
+static SoundEngine engine;
+static Player& player = engine.music();
+static SequencerLink seqLink(engine);   // the main loop's only way to the engine once it plays
+static SeqStatus status;                // latest from the sequencer, read by the HUD
+static StatusDisplay hud;
+static Profiler profiler;
+
+// Profiler clock: timers 0 and 1 cascaded into a free-running 32-bit bus clock counter
+static uint32_t busClockNow() {
+    return cpuGetTiming();
+}
 
-// Unused until later (maybe)
-enum bitDepth { form8bit = 0, form16bit = 1, formADPCM = 2 };
+// Timer IRQ: carry out what the main loop asked for, advance the sequencer by one timer period
+// of bus clocks, then send the net register changes of that period to the ARM7
+static void sequencerTick() {
+    uint32_t started = profiler.now();
+    seqLink.tick(BUS_CLOCK / SEQ_TIMER_HZ);
+    psgShadow.flush();
+    psgTrace.advance();
+    profiler.end(PROF_TICK, started);
+}
 
 bool fileExists(const std::string& path) {
     std::ifstream file(path);
     return file.is_open();
 }
 
-// Converts MIDI note + pitch bend to frequency in Hz
-float midiNoteToHz(int note, int pitchBend = 0) {
-    float semitoneOffset = (pitchBend / 8192.0f) * PITCH_BEND_RANGE_SEMITONES;
-    return 440.0f * pow(2.0f, ((note + OCTAVE_SHIFT + semitoneOffset) - 69) / 12.0f);
-}
-
-// Load notes from TXT file
-std::vector<Note> loadNotes(const std::string& path, int& BPM) {
-    std::ifstream file(path);
-    std::string line;
-    std::vector<Note> notes;
-
-    if (!file.is_open()) return notes;
-
-    if (std::getline(file, line) && line.find("BPM:") == 0)
-        BPM = std::stoi(line.substr(4));
-
-    while (std::getline(file, line)) {
-        if (line.empty()) continue;
-        std::stringstream ss(line);
-        std::string token;
-        Note n;
-
-        // Put the values into the note array
-        std::getline(ss, token, ','); n.channel = std::stoi(token);
-        std::getline(ss, token, ','); n.program = std::stoi(token);
-        std::getline(ss, token, ','); n.noteNumber = std::stoi(token);
-        std::getline(ss, token, ','); n.velocity = std::stoi(token);
-        std::getline(ss, token, ','); n.startDiv = std::stoi(token);
-        std::getline(ss, token, ','); n.endDiv = std::stoi(token);
-        std::getline(ss, token, ','); n.pan = std::stoi(token);
-        std::getline(ss, token, ','); n.pitchBend = std::stoi(token);
-        std::getline(ss, token, ','); n.channelVolume = std::stoi(token);
-
-        std::getline(ss, token, ',');
-        n.cc74 = std::stoi(token); if (n.cc74 > 0) n.cc74 -= 1; else n.cc74 = -1;
-        std::getline(ss, token, ',');
-        n.cc75 = std::stoi(token); if (n.cc75 > 0) n.cc75 -= 1; else n.cc75 = -1;
-        std::getline(ss, token, ',');
-        n.cc76 = std::stoi(token); if (n.cc76 > 0) n.cc76 -= 1; else n.cc76 = -1;
-
-        // Skip loop marker notes (C0 = MIDI 0, C#1 = MIDI 1)
-        if (n.noteNumber == 0 || n.noteNumber == 1) continue;
-
-        notes.push_back(n);
-    }
+// What the song and envelope files were like when last read
+static FileStamp songStamp, envelopeStamp;
 
-    return notes;
+// Hand a command to the sequencer and wait the tick or so until it has been carried out, so
+// whatever it replaced is free to reuse. False if the queue was full.
+static bool sendAndWait(uint32_t ticket) {
+    if (!ticket) return false;
+    while (!seqLink.done(ticket)) {}
+    return true;
 }
 
-// Load volume envelopes
-void loadVolumeEnvelopes(const std::string& path, VolumeEnv volEnvelopes[16]) {
-    std::ifstream file(path);
-    if (!file.is_open()) { std::cout << "Failed to open envelope file: " << path << std::endl; return; }
-
-    auto trim = [](std::string s) -> std::string {
-        size_t start = s.find_first_not_of(" \t\r\n");
-        if (start == std::string::npos) return "";
-        size_t end = s.find_last_not_of(" \t\r\n");
-        return s.substr(start, end - start + 1);
-    };
-
-    std::string line;
-    int loaded = 0;
-
-    while (std::getline(file, line)) {
-        if (line.empty()) continue;
-        size_t pos = line.find("Volume_Env");
-        if (pos == std::string::npos) continue;
-        size_t colon = line.find(':', pos);
-        if (colon == std::string::npos) continue;
-
-        std::string label = trim(line.substr(pos, colon - pos));
-        std::string values = trim(line.substr(colon + 1));
-
-        int envIndex = -1;
-        size_t prefixLen = 10;
-        if (label.length() > prefixLen) {
-            std::string numStr = trim(label.substr(prefixLen));
-            if (!numStr.empty() && isdigit(numStr[0])) {
-                int n = std::atoi(numStr.c_str());
-                envIndex = n - 1;
-            }
-        }
-
-        if (envIndex < 0 || envIndex >= 16) continue;
-
-        std::stringstream valStream(values);
-        std::string token;
-        int envValues[4] = {0,0,0,0};
-        int i = 0;
-        while (std::getline(valStream, token, ',') && i < 4)
-            envValues[i++] = std::atoi(trim(token).c_str());
-
-        volEnvelopes[envIndex] = { envValues[0], envValues[1], envValues[2], envValues[3] };
-        loaded++;
+// Re-read whichever of the text song and envelopes.txt changed since it was read, into the
+// spare copy, then switch playback over to it between two sequencer ticks. The song carries
+// on from the same 64th; a compiled song is left as it is. Returns the HUD notice.
+static const char* reloadChanged(const std::string& songPath, bool compiled) {
+    static char message[HUD_COLS + 1];
+    uint32_t started = profiler.now();
+    const char* what = nullptr;
+    int badLines = 0;
+
+    FileStamp stamp = compiled ? songStamp : fileStamp(songPath);
+    if (stamp != songStamp) {
+        Sequence* spare = (seq == &songs[0]) ? &songs[1] : &songs[0];
+        TextLoadReport report;
+        if (!loadSequenceText(songPath, *spare, &report)) return "Could not reload the song";
+        if (!sendAndWait(seqLink.replaceMusic(spare))) return "Sequencer busy, try again";
+        seq = spare;
+        songStamp = stamp;
+        badLines += report.badLines;
+        what = "song";
     }
 
-    std::cout << "Loaded " << loaded << " volume envelopes." << std::endl;
-}
-
-// Load pitch envelopes
-void loadPitchEnvelopes(const std::string& path, PitchEnv pitchEnvelopes[16]) {
-    std::ifstream file(path);
-    if (!file.is_open()) { std::cout << "Failed to open pitch envelope file: " << path << std::endl; return; }
-
-    auto trim = [](std::string s) -> std::string {
-        size_t start = s.find_first_not_of(" \t\r\n");
-        if (start == std::string::npos) return "";
-        size_t end = s.find_last_not_of(" \t\r\n");
-        return s.substr(start, end - start + 1);
-    };
-
-    std::string line;
-    int loaded = 0;
-
-    while (std::getline(file, line)) {
-        if (line.empty()) continue;
-        size_t pos = line.find("Pitch_Env");
-        if (pos == std::string::npos) continue;
-        size_t colon = line.find(':', pos);
-        if (colon == std::string::npos) continue;
-
-        std::string label = trim(line.substr(pos, colon - pos));
-        std::string values = trim(line.substr(colon + 1));
-
-        int envIndex = -1;
-        size_t prefixLen = 9;
-        if (label.length() > prefixLen) {
-            std::string numStr = trim(label.substr(prefixLen));
-            if (!numStr.empty() && isdigit(numStr[0])) {
-                int n = std::atoi(numStr.c_str());
-                envIndex = n - 1;
-            }
-        }
-
-        if (envIndex < 0 || envIndex >= 16) continue;
-
-        std::stringstream valStream(values);
-        std::string token;
-        int delay=0, rate=1, ramp=0; float depth=0.0f;
-        if (std::getline(valStream, token, ',')) delay = std::atoi(trim(token).c_str());
-        if (std::getline(valStream, token, ',')) rate  = std::atoi(trim(token).c_str());
-        if (std::getline(valStream, token, ',')) depth = std::atof(trim(token).c_str());
-        if (std::getline(valStream, token, ',')) ramp  = std::atoi(trim(token).c_str());
-
-        pitchEnvelopes[envIndex] = { delay, rate, depth, ramp };
-        loaded++;
+    stamp = fileStamp(ENVELOPE_PATH);
+    if (stamp != envelopeStamp) {
+        EnvelopeBank* spare = (envelopes == &envelopeBanks[0]) ? &envelopeBanks[1] : &envelopeBanks[0];
+        TextLoadReport report;
+        spare->setDefaults();
+        if (!loadEnvelopesText(ENVELOPE_PATH, *spare, nullptr, &report)) return "Could not reload envelopes";
+        if (!sendAndWait(seqLink.setEnvelopes(spare))) return "Sequencer busy, try again";
+        envelopes = spare;
+        envelopeStamp = stamp;
+        badLines += report.badLines;
+        what = what ? "song+envelopes" : "envelopes";
     }
 
-    std::cout << "Loaded " << loaded << " pitch envelopes." << std::endl;
-}
-
-void loadSlideEnvelopes(const std::string& path, SlideEnv slideEnvs[16]){
-    std::ifstream file(path); 
-    if(!file.is_open()) return;
-    
-    auto trim = [](std::string s){
-        size_t start=s.find_first_not_of(" \t\r\n"); 
-        if(start==std::string::npos) return std::string("");
-        size_t end=s.find_last_not_of(" \t\r\n"); 
-        return s.substr(start,end-start+1);
-    };
-    
-    // Initialize all as undefined
-    for(int i = 0; i < 16; i++) {
-        for(int n = 0; n < MAX_DRUM_NOTES; n++) {
-            slideEnvs[i].defined[n] = false;
-            slideEnvs[i].startNote[n] = 0;
-            slideEnvs[i].endNote[n] = 0;
-            slideEnvs[i].duration64[n] = 0;
-            slideEnvs[i].isRelative[n] = false;
-        }
-    }
-    
-    std::string line;
-    while(std::getline(file,line)){
-        if(line.empty()) continue;
-        size_t pos = line.find("Slide_Env");
-        if(pos == std::string::npos) continue;
-        size_t colon = line.find(':', pos);
-        if(colon == std::string::npos) continue;
-
-        std::string values = trim(line.substr(colon+1));
-        
-        std::stringstream ss(values); 
-        std::string token;
-        int kitNum=0, trigger=0, start=0, end=0, dur=0;
-        
-        if(std::getline(ss,token,',')) kitNum = std::atoi(trim(token).c_str());
-        if(std::getline(ss,token,',')) trigger = std::atoi(trim(token).c_str());
-        if(std::getline(ss,token,',')) start = std::atoi(trim(token).c_str());
-        if(std::getline(ss,token,',')) end = std::atoi(trim(token).c_str());
-        if(std::getline(ss,token,',')) dur = std::atoi(trim(token).c_str());
-        
-        // Convert 1-based kit number to 0-based index
-        int kitIdx = kitNum - 1;
-        if(kitIdx < 0 || kitIdx >= 16) continue;
-        
-        if(trigger == -1) {
-            // Relative mode: apply to ALL notes
-            // Pre-calculate duration per semitone from absolute duration
-            int distance = abs(end - start);
-            int durationPerSemitone = (distance > 0) ? dur : 0;  // Store as absolute, will divide later
-            
-            for(int n = 0; n < MAX_DRUM_NOTES; n++) {
-                slideEnvs[kitIdx].startNote[n] = start;
-                slideEnvs[kitIdx].endNote[n] = end;
-                slideEnvs[kitIdx].duration64[n] = dur;  // Store absolute duration from file
-                slideEnvs[kitIdx].defined[n] = true;
-                slideEnvs[kitIdx].isRelative[n] = true;
-            }
-        } else {
-            // Normal mode: specific trigger note
-            if(trigger < 0 || trigger >= MAX_DRUM_NOTES) continue;
-            slideEnvs[kitIdx].startNote[trigger] = start;
-            slideEnvs[kitIdx].endNote[trigger] = end;
-            slideEnvs[kitIdx].duration64[trigger] = dur;
-            slideEnvs[kitIdx].defined[trigger] = true;
-            slideEnvs[kitIdx].isRelative[trigger] = false;
-        }
-    }
+    if (!what) return "Nothing changed to reload";
+    unsigned ms = profiler.toMicros(profiler.now() - started) / 1000;
+    if (badLines) snprintf(message, sizeof(message), "Reloaded %s %ums, %d bad", what, ms, badLines);
+    else snprintf(message, sizeof(message), "Reloaded %s in %u ms", what, ms);
+    return message;
 }
 
 // DS initialization
@@ -331,84 +165,77 @@ int main(int argc, char *argv[]) {
 
     std::string songName = "demoSong.txt";
 
-    int BPM = 120;
-    if (fileExists("fat:/NuclearSEQ/seq/song.txt")) {
-        songName = "song.txt";
-    } 
-    
-    std::vector<Note> notes = loadNotes("fat:/NuclearSEQ/seq/" + songName, BPM);
-
-    // Detect loop markers (C0 = MIDI 0 start, C#1 = MIDI 1 end)
-    int loopStart64th = -1;
-    int loopEnd64th = -1;
-    {
-        std::ifstream loopFile("fat:/NuclearSEQ/seq/" + songName);
-        std::string line;
-        if (std::getline(loopFile, line) && line.find("BPM:") == 0) {} // skip BPM
-        while (std::getline(loopFile, line)) {
-            if (line.empty()) continue;
-            std::stringstream ss(line);
-            std::string token;
-            int channel, program, noteNum, velocity, startDiv, endDiv, pan, pitchBend, vol;
-            std::getline(ss, token, ','); channel = std::stoi(token);
-            std::getline(ss, token, ','); program = std::stoi(token);
-            std::getline(ss, token, ','); noteNum = std::stoi(token);
-            std::getline(ss, token, ','); velocity = std::stoi(token);
-            std::getline(ss, token, ','); startDiv = std::stoi(token);
-            if (noteNum == 0 && loopStart64th == -1) loopStart64th = startDiv;
-            if (noteNum == 1 && loopEnd64th == -1) loopEnd64th = startDiv;
-        }
+    // A compiled song.nseq takes priority and is streamed from the card a chunk at a time, or
+    // read whole if it holds patterns; a stale or damaged one falls back to the text song
+    bool streaming = false, patterned = false;
+    SeqBinResult binResult = stream.open("fat:/NuclearSEQ/seq/song.nseq");
+    if (binResult == SEQBIN_BAD_MAGIC) {
+        binResult = loadPatternBinary("fat:/NuclearSEQ/seq/song.nseq", patternSong);
+        patterned = binResult == SEQBIN_OK;
     }
-
-    float framesPer64th = (60.0f / BPM) / 16.0f * 59.73f; // 64th-note timing
-    for (Note& n : notes) {
-        n.startDivFrames = static_cast<int>(round(n.startDiv * framesPer64th));
-        n.endDivFrames   = static_cast<int>(round(n.endDiv * framesPer64th));
+    if (binResult == SEQBIN_OK) {
+        songName = "song.nseq";
+        streaming = !patterned;
+        if (streaming)
+            std::cout << "Streaming " << stream.size() << " events (" << stream.memoryBytes() << " bytes resident)" << std::endl;
+        else
+            std::cout << "Loaded " << patternSong.expandedSize() << " events as " << patternSong.patterns.size()
+                      << " patterns (" << patternSong.memoryBytes() << " bytes)" << std::endl;
+    } else {
+        if (binResult != SEQBIN_NOT_FOUND)
+            std::cout << "Ignoring song.nseq: " << seqBinResultString(binResult) << std::endl;
+
+        if (fileExists("fat:/NuclearSEQ/seq/song.txt")) {
+            songName = "song.txt";
+        } 
+
+        TextLoadReport report;
+        SeqOptimizeStats optimized;
+        if (!loadSequenceText("fat:/NuclearSEQ/seq/" + songName, *seq, &report, &optimized))
+            std::cout << "Could not load " << songName << std::endl;
+        else if (report.badLines)
+            std::cout << "Skipped " << describeTextLoad(songName, report) << std::endl;
+        if (optimized.total())
+            std::cout << "Left out " << optimized.total() << " redundant controller lines" << std::endl;
+
+        std::cout << "Loaded " << seq->size() << " events (" << seq->memoryBytes() << " bytes)" << std::endl;
+        songStamp = fileStamp("fat:/NuclearSEQ/seq/" + songName);
     }
 
-    if (loopStart64th != -1)
-        loopStart64th = static_cast<int>(round(loopStart64th * framesPer64th));
-    if (loopEnd64th != -1)
-        loopEnd64th = static_cast<int>(round(loopEnd64th * framesPer64th));
-
+    int loopStart64th = streaming ? stream.loopStart64th() : patterned ? patternSong.loopStart64th : seq->loopStart64th;
+    int loopEnd64th = streaming ? stream.loopEnd64th() : patterned ? patternSong.loopEnd64th : seq->loopEnd64th;
     if (loopStart64th != -1 && loopEnd64th != -1 && loopEnd64th > loopStart64th)
-        std::cout << "Loop points set: " << (loopStart64th / framesPer64th) << " → " << (loopEnd64th / framesPer64th) << std::endl;
+        std::cout << "Loop points set: " << loopStart64th << " → " << loopEnd64th << std::endl;
     else
         std::cout << "No valid loop points found." << std::endl;
 
-    // Create arrays for channel states
-    int currentNotePlaying[16], currentPitchBend[16], currentPan[16], currentVolume[16], currentNoteProgram[16];
-    int currentCC74[16], currentCC75[16];
-    bool channelActive[16];
-    VolumeEnv volEnvelopes[16];
-    NoteState noteStates[16];
-    int noteBaseVolume[16];
-    PitchEnv pitchEnvelopes[16];
-    PitchState pitchStates[16];
-    SlideEnv slideEnvelopes[16];
-    SlideState slideStates[16];
-
-
-    for (int i = 0; i < 16; i++){
-        currentNotePlaying[i] = 60; currentPitchBend[i] = 0; currentPan[i] = 64;
-        currentVolume[i] = 127; currentNoteProgram[i] = 0;
-        currentCC74[i] = -1; currentCC75[i] = -1;
-        channelActive[i] = false;
-        noteStates[i] = {}; 
-        pitchStates[i] = {};
-        volEnvelopes[i] = {4,8,100,12};
-        pitchEnvelopes[i] = {0,1,0.0f,0};
-        noteBaseVolume[i] = 127;
-        slideStates[i] = {};
+    envelopes->setDefaults();
+
+    EnvelopeCounts counts;
+    TextLoadReport envReport;
+    envelopeStamp = fileStamp(ENVELOPE_PATH);
+    if (!loadEnvelopesText(ENVELOPE_PATH, *envelopes, &counts, &envReport)) {
+        std::cout << "Failed to open envelope file: " ENVELOPE_PATH << std::endl;
+    } else {
+        std::cout << "Loaded " << counts.volume << " volume, " << counts.pitch << " pitch, "
+                  << counts.slide << " slide envelopes." << std::endl;
+        if (envReport.badLines)
+            std::cout << "Skipped " << describeTextLoad("envelopes.txt", envReport) << std::endl;
     }
 
-    loadVolumeEnvelopes("fat:/NuclearSEQ/seq/envelopes.txt", volEnvelopes);
-    loadPitchEnvelopes("fat:/NuclearSEQ/seq/envelopes.txt", pitchEnvelopes);
-    loadSlideEnvelopes("fat:/NuclearSEQ/seq/envelopes.txt", slideEnvelopes);
+    // Started once and left running; every section reads it instead of restarting it
+    cpuStartTiming(0);
+    profiler.setClock(busClockNow, BUS_CLOCK);
+    profiler.setTickBudget(BUS_CLOCK / SEQ_TIMER_HZ);
+    player.setProfiler(&profiler);
+    seqLink.setCounters(&profiler, streaming ? &stream : nullptr);
+    engine.begin(envelopes, &psgShadow, BUS_CLOCK);
 
-    consoleClear();
+    // An optional sound effect for B to play over the music
+    bool haveSfx = fileExists("fat:/NuclearSEQ/seq/sfx.txt") && loadSequenceText("fat:/NuclearSEQ/seq/sfx.txt", sfx);
 
-    int frameMod = 0;
+    consoleClear();
+    bool tracing = false;
 
     while (1) {
         // Opening screen
@@ -417,250 +244,105 @@ int main(int argc, char *argv[]) {
             std::cout << "Welcome to the NuclearSEQ player.\n";
             std::cout << "The song that will be played\n should be put in NuclearSEQ/seq/song.txt\n" << "Otherwise demoSong.txt will be \nplayed instead." << std::endl;
             std::cout << "Press any button to continue." << std::endl;
+            std::cout << "Press Y to let notes share\n all 8 PSG voices." << std::endl;
+            std::cout << "Hold R to record every PSG\n write to trace.ntr." << std::endl;
             scanKeys(); 
             uint16_t keys = keysDown();
 
             if (keys) {
+                player.setVoiceAllocation(keys & KEY_Y);
+                tracing = keysHeld() & KEY_R;
                 std::cout << "Button pressed - entering playback loop." << std::endl; // debug: menu state change
                 break;
             }
             swiWaitForVBlank();
         }
 
+        // From here on the sequencer runs from the timer IRQ and this loop only reaches it
+        // through seqLink: commands in, statuses out
+        if (streaming) engine.startMusic(&stream);
+        else if (patterned) engine.startMusic(&patternSong);
+        else engine.startMusic(seq);
+        status = SeqStatus();
+        profiler.reset();
+        const char* traceNotice = nullptr;
+        if (tracing) {
+            PsgTraceResult result = psgTrace.start(TRACE_PATH, SEQ_TIMER_HZ);
+            if (result == PSG_TRACE_OK) psgShadow.setOutput(&psgTrace);
+            else traceNotice = psgTraceResultString(result);
+        }
+        timerStart(SEQ_TIMER, ClockDivider_1, TIMER_FREQ(SEQ_TIMER_HZ), sequencerTick);
+
+        hud.begin(songName.c_str(), &status, streaming, &profiler);
+        if (traceNotice) hud.setNotice(traceNotice);
+        SeqBinResult streamResult = SEQBIN_OK;
+
         while (1) {
-            frameMod++;
-            int current64th = frameMod / framesPer64th;
-            
-            // Process note events
-            for (Note& n : notes) {
-                if (frameMod == n.startDivFrames) {
-                    if (n.noteNumber != -1) {
-                        // Note-on
-                        int finalVol = (n.velocity * n.channelVolume) / 127;
-                        finalVol = (int)(finalVol * GLOBAL_VOLUME_MULTIPLIER);
-                        if (finalVol > 127) finalVol = 127; 
-                        if (finalVol < 0) finalVol = 0;
-                        noteBaseVolume[n.channel] = finalVol;
-                        float freq = midiNoteToHz(n.noteNumber, n.pitchBend);
-
-                        if (n.channel >= 14) {
-                            // Channels 15-16 (0-indexed 14-15) play noise
-                            soundPlayNoiseChannel(n.channel + PSG_OFFSET, freq, finalVol, n.pan);
-                        } else {
-                            DutyCycle duty = static_cast<DutyCycle>(n.program);
-                            soundPlayPSGChannel(n.channel + PSG_OFFSET, duty, freq, finalVol, n.pan);
-                        }
-
-
-                        currentNotePlaying[n.channel] = n.noteNumber;
-                        currentPitchBend[n.channel] = n.pitchBend;
-                        currentPan[n.channel] = n.pan;
-                        currentVolume[n.channel] = n.channelVolume;
-                        currentNoteProgram[n.channel] = n.program;
-                        currentCC74[n.channel] = n.cc74;
-                        currentCC75[n.channel] = n.cc75;
-                        channelActive[n.channel] = true;
-
-                        if (n.cc74 != -1) {
-                            noteStates[n.channel].envPhase = 1;
-                            noteStates[n.channel].envCounter = 0;
-                            noteStates[n.channel].amp = 0;
-                        }
-
-                        if (n.cc75 != -1) {
-                            PitchEnv &penv = pitchEnvelopes[n.cc75];
-                            PitchState &pstate = pitchStates[n.channel];
-                            pstate.active = true; pstate.phaseState = 0;
-                            pstate.phase = 0.0f; pstate.currDepth = 0.0f; pstate.counter = 0;
-                        }
-
-                        if(n.cc76 != -1 && n.cc76 < 16) {
-                            SlideEnv &se = slideEnvelopes[n.cc76];
-                            
-                            if (n.noteNumber >= 0 && n.noteNumber < MAX_DRUM_NOTES && se.defined[n.noteNumber]) {
-                                SlideState &ss = slideStates[n.channel];
-                                ss.active = true;
-                                
-                                int startNote = se.startNote[n.noteNumber];
-                                int endNote = se.endNote[n.noteNumber];
-                                int duration = se.duration64[n.noteNumber];
-                                
-                                // If relative mode, offset from the played note
-                                if(se.isRelative[n.noteNumber]) {
-                                    startNote = n.noteNumber + startNote;  // Offset from played note
-                                    endNote = n.noteNumber + endNote;      // Offset from played note
-                                }
-                                
-                                ss.startNote = startNote;
-                                ss.endNote = endNote;
-                                ss.startFrame = frameMod;
-                                ss.duration64 = duration;
-                            }
-                        }
-
-                    } else {
-                        // Controller-only event
-                        currentPitchBend[n.channel] = n.pitchBend;
-                        currentPan[n.channel] = n.pan;
-                        currentVolume[n.channel] = n.channelVolume;
-                        currentNoteProgram[n.channel] = n.program;
-                        currentCC74[n.channel] = n.cc74;
-                        currentCC75[n.channel] = n.cc75;
-                        soundSetPan(n.channel+PSG_OFFSET, n.pan);
-                        int finalVol = noteBaseVolume[n.channel];
-                        soundSetVolume(n.channel+PSG_OFFSET, finalVol);
-                    }
-                }
-
-                if (frameMod == n.endDivFrames && n.noteNumber != -1) {
-                    if (n.cc74 == -1) {
-                        soundKill(n.channel + PSG_OFFSET); channelActive[n.channel] = false;
-                    } else {
-                        noteStates[n.channel].envPhase = 4; noteStates[n.channel].envCounter = 0;
-                    }
-                    if (n.cc75 != -1) {
-                        PitchState &pstate = pitchStates[n.channel];
-                        if (pstate.active) {
-                            pstate.active = false; pstate.phase = 0; pstate.currDepth=0; pstate.counter=0;
-                            if (channelActive[n.channel]) {
-                                float baseFreq = midiNoteToHz(currentNotePlaying[n.channel], currentPitchBend[n.channel]);
-                                soundSetFreq(n.channel+PSG_OFFSET, baseFreq);
-                            }
-                        }
-                    }
-                }
+            // Read the chunk the sequencer will need next; a read error leaves playback held
+            if (streaming && streamResult == SEQBIN_OK) {
+                streamResult = stream.service();
+                if (streamResult != SEQBIN_OK)
+                    hud.setNotice(seqBinResultString(streamResult));
             }
 
-            // Update ADSR
-            for (int ch = 0; ch < 16; ch++) {
-                if (!channelActive[ch]) continue;
-                int envIndex = currentCC74[ch];
-                if (envIndex < 0 || envIndex >= 16) continue;
-
-                VolumeEnv &env = volEnvelopes[envIndex];
-                NoteState &state = noteStates[ch];
-                int baseVol = noteBaseVolume[ch];
-                state.envCounter++;
-
-                switch (state.envPhase) {
-                    case 1:
-                        state.amp += (127.0f / std::max(1, env.A)) / 1.0f;
-                        if (state.amp >= 127.0f) { state.amp = 127.0f; state.envPhase = 2; state.envCounter=0; }
-                        break;
-                    case 2:
-                        state.amp -= ((127.0f - env.S) / std::max(1, env.D));
-                        if (state.amp <= env.S) { state.amp = env.S; state.envPhase = 3; }
-                        break;
-                    case 4:
-                        state.amp -= (env.S / std::max(1, env.R));
-                        if (state.amp <= 0) { state.amp = 0; state.envPhase=0; soundKill(ch+PSG_OFFSET); channelActive[ch]=false; }
-                        break;
-                }
-
-                int vol = (int)(state.amp / 127.0f * baseVol);
-                if (vol < 0) vol = 0; if (vol > 127) vol = 127;
-                soundSetVolume(ch + PSG_OFFSET, vol);
+            // Write out the trace block the sequencer has filled; a write error ends the trace
+            if (psgTrace.recording() && psgTrace.service() != PSG_TRACE_OK) {
+                irqDisable(IRQ_TIMER(SEQ_TIMER));
+                psgShadow.setOutput(&psg);
+                irqEnable(IRQ_TIMER(SEQ_TIMER));
+                psgTrace.stop();
+                hud.setNotice("Could not write trace.ntr");
             }
 
-            // Update pitch envelopes
-            for (int ch = 0; ch < 16; ch++) {
-                if (!channelActive[ch]) continue;
-                if (slideStates[ch].active) continue;
-
-                PitchState &pstate = pitchStates[ch];
-                int penvIndex = currentCC75[ch];
-                if (!pstate.active || penvIndex < 0 || penvIndex >= 16) continue;
-
-                PitchEnv &penv = pitchEnvelopes[penvIndex];
-                pstate.counter++;
-                if (pstate.phaseState == 0 && pstate.counter >= penv.delay) {
-                    pstate.phaseState = 1; pstate.counter = 0;
-                }
-                if (pstate.phaseState == 1) {
-                    if (pstate.currDepth < penv.depth) {
-                        pstate.currDepth += (penv.depth / std::max(1, penv.ramp));
-                        if (pstate.currDepth > penv.depth) pstate.currDepth = penv.depth;
-                    }
-                    pstate.phase += (2.0f * M_PI / std::max(1, penv.rate));
-                    float pitchOffsetHz = sin(pstate.phase) * pstate.currDepth;
-                    float baseFreq = midiNoteToHz(currentNotePlaying[ch], currentPitchBend[ch]);
-                    float newFreq = baseFreq + pitchOffsetHz;
-                    if (newFreq < 20.0f) newFreq = 20.0f;
-                    if (newFreq > 20000.0f) newFreq = 20000.0f;
-                    soundSetFreq(ch + PSG_OFFSET, newFreq);
-                }
+            seqLink.latest(status);
+
+            scanKeys();
+            uint32_t down = keysDown();
+            if (down & KEY_SELECT)
+                hud.toggle();
+            if (down & KEY_X)
+                hud.toggleProfile();
+
+            // START writes the counters so far to the card, from a copy taken with the
+            // sequencer IRQ held off so the card write does not hold up playback
+            if (down & KEY_START) {
+                static Profiler snapshot;
+                irqDisable(IRQ_TIMER(SEQ_TIMER));
+                snapshot = profiler;
+                irqEnable(IRQ_TIMER(SEQ_TIMER));
+                bool saved = saveProfile("fat:/NuclearSEQ/profile.txt", snapshot);
+                hud.setNotice(saved ? "Saved profile.txt" : "Could not save profile.txt");
             }
 
-            for(int ch = 0; ch < 16; ch++) {
-                SlideState &ss = slideStates[ch];
-                if(ss.active && ss.duration64 > 0){
-                    int elapsedFrames = frameMod - ss.startFrame;
-                    float elapsed64ths = elapsedFrames / framesPer64th;
-                    float t = elapsed64ths / ss.duration64;
-                    
-                    if(t >= 1.0f) { 
-                        t = 1.0f; 
-                        ss.active = false; 
-                    }
-
-                    float currentNote = ss.startNote + t * (ss.endNote - ss.startNote);
-                    float freq = midiNoteToHz((int)currentNote, currentPitchBend[ch]);
-
-                    // Clamp to u16 range
-                    if (freq < 0.0f) freq = 0.0f;
-                    if (freq > 65535.0f) freq = 65535.0f;
-                    
-                    soundSetFreq(ch + PSG_OFFSET, (u16)freq);
-                }
+            // L and R jump four bars back or ahead of the last status
+            if (!streaming && (down & (KEY_L | KEY_R))) {
+                int64_t target = (int64_t)status.position + ((down & KEY_L) ? -256 : 256);
+                seqLink.seek(target > 0 ? (uint32_t)target : 0);
             }
 
-
-            // Debug print (per-channel CC/envelope and global info)
-            consoleClear();
-            for (int ch = 0; ch < 16; ch++) {
-                std::cout << "Ch " << ch << " CC74:" << currentCC74[ch] << " CC75:" << currentCC75[ch];
-                if (currentCC74[ch] != -1) {
-                    VolumeEnv &e = volEnvelopes[currentCC74[ch]];
-                    std::cout << " [A:" << e.A << " D:" << e.D << " S:" << e.S << " R:" << e.R << "]";
-                }
-                if (currentCC75[ch] != -1) {
-                    PitchEnv &p = pitchEnvelopes[currentCC75[ch]];
-                    std::cout << " (P delay:" << p.delay << " rate:" << p.rate << " depth:" << p.depth << " ramp:" << p.ramp << ")";
-                }
-                std::cout << std::endl;
-            }
-            const std::string testString = "fat:/NuclearSEQ/seq/" + songName;
-
-            std::cout << "64th:" << current64th << " BPM:" << BPM << " framesPer64th:" << framesPer64th << " frameMod:" << frameMod << std::endl;
-            std::cout << testString << std::endl;
-
-            // Handle looping
-            if (loopStart64th != -1 && loopEnd64th != -1 && frameMod >= loopEnd64th) {
-                frameMod = (loopStart64th > 0) ? loopStart64th - 1 : 0;
-
-                // Reset slide states
-                for (int ch = 0; ch < 16; ch++) {
-                    slideStates[ch].active = false;
-                }
-
-                /*
-                // Reset states
-                for (int ch = 0; ch < 16; ch++) {
-                    if (channelActive[ch]) {
-                        soundKill(ch + PSG_OFFSET);
-                        channelActive[ch] = false;
-                        noteStates[ch].envPhase = 0;
-                        noteStates[ch].amp = 0;
-                        pitchStates[ch].active = false;
-                        pitchStates[ch].phase = 0;
-                    }
-                }
-                */
-
-                consoleClear();
-                std::cout << "Looping back to 64th: " << (loopStart64th / framesPer64th) << std::endl;
+            // B plays sfx.txt over the music, taking the channels it uses until it ends
+            if (haveSfx && (down & KEY_B))
+                seqLink.playSfx(&sfx, 1);
+
+            // Y ends the trace and completes the file
+            if (psgTrace.recording() && (down & KEY_Y)) {
+                static char message[HUD_COLS + 1];
+                irqDisable(IRQ_TIMER(SEQ_TIMER));
+                psgShadow.setOutput(&psg);
+                irqEnable(IRQ_TIMER(SEQ_TIMER));
+                uint32_t records = psgTrace.records(), dropped = psgTrace.dropped();
+                if (psgTrace.stop() != PSG_TRACE_OK) snprintf(message, sizeof(message), "Could not write trace.ntr");
+                else if (dropped) snprintf(message, sizeof(message), "Traced %u, %u dropped", (unsigned)records, (unsigned)dropped);
+                else snprintf(message, sizeof(message), "Traced %u writes", (unsigned)records);
+                hud.setNotice(message);
             }
 
+            // DOWN+A re-reads the song and envelopes if they changed on the card
+            if ((down & KEY_A) && (keysHeld() & KEY_DOWN))
+                hud.setNotice(reloadChanged("fat:/NuclearSEQ/seq/" + songName, streaming || patterned));
+
+            hud.update();
+
             swiWaitForVBlank();
         }
     }
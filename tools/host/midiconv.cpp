@@ -0,0 +1,359 @@
+#include "midiconv.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <unordered_set>
+
+bool SongRow::operator==(const SongRow& o) const {
+    return channel == o.channel && program == o.program && note == o.note && velocity == o.velocity &&
+           startDiv == o.startDiv && endDiv == o.endDiv && pan == o.pan && pitchBend == o.pitchBend &&
+           volume == o.volume && cc74 == o.cc74 && cc75 == o.cc75 && cc76 == o.cc76;
+}
+
+namespace {
+
+struct SongRowHash {
+    size_t operator()(const SongRow& r) const {
+        const int fields[12] = {r.channel, r.program, r.note, r.velocity, r.startDiv, r.endDiv,
+                                r.pan, r.pitchBend, r.volume, r.cc74, r.cc75, r.cc76};
+        uint64_t h = 1469598103934665603ull;  // FNV-1a
+        for (int f : fields) h = (h ^ (uint32_t)f) * 1099511628211ull;
+        return (size_t)h;
+    }
+};
+
+// Bounds-checked big-endian reads from the file image
+struct ByteReader {
+    const uint8_t* p;
+    const uint8_t* end;
+
+    bool byte(uint8_t& b) {
+        if (p == end) return false;
+        b = *p++;
+        return true;
+    }
+
+    bool u16(uint32_t& v) {
+        if (end - p < 2) return false;
+        v = (uint32_t)p[0] << 8 | p[1];
+        p += 2;
+        return true;
+    }
+
+    bool u32(uint32_t& v) {
+        if (end - p < 4) return false;
+        v = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+        p += 4;
+        return true;
+    }
+
+    // MIDI variable-length quantity, at most 4 bytes
+    bool varlen(uint32_t& v) {
+        v = 0;
+        for (int i = 0; i < 4; i++) {
+            uint8_t b;
+            if (!byte(b)) return false;
+            v = v << 7 | (b & 0x7F);
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+
+    bool skip(uint32_t n) {
+        if ((uint32_t)(end - p) < n) return false;
+        p += n;
+        return true;
+    }
+};
+
+// Controller state m2text.py tracks per channel
+struct ChannelState {
+    int program = 0, pan = 64, pitchBend = 0, volume = 127, cc74 = 0, cc75 = 0, cc76 = 0;
+
+    bool operator!=(const ChannelState& o) const {
+        return program != o.program || pan != o.pan || pitchBend != o.pitchBend || volume != o.volume ||
+               cc74 != o.cc74 || cc75 != o.cc75 || cc76 != o.cc76;
+    }
+};
+
+static int sanitize(int value) {
+    return value != 0 ? value : -1;
+}
+
+// The conversion state of m2text.py, kept so that every message costs O(1) amortized.
+// Controller state is shared by all tracks, as it is there.
+class Converter {
+public:
+    Converter(int ticksPerBeat, SongText& out) : ticksPer64th(ticksPerBeat / 16.0), out(out) {
+        for (int ch = 0; ch < 16; ch++) lastVelocity[ch] = -1;
+    }
+
+    void noteOn(int ch, int note, int velocity, int64_t time) {
+        Active& a = active[ch][note];
+        if (!a.on) {
+            // A new key goes to the back of the order; re-striking a held key keeps its place
+            a.on = true;
+            a.serial = ++serial;
+            order[ch].push_back(Held{(uint8_t)note, a.serial});
+        }
+        a.row = rowFor(ch, note, velocity, startDiv(time));
+    }
+
+    void noteOff(int ch, int note, int64_t time) {
+        Active& a = active[ch][note];
+        if (!a.on) return;
+        a.on = false;
+        a.row.endDiv = (int)std::ceil(time / ticksPer64th);
+        out.rows.push_back(a.row);
+        lastVelocity[ch] = a.row.velocity;
+    }
+
+    // After any controller message: a row for the channel if its state differs from the last
+    // one written
+    void controllerChanged(int ch, int64_t time) {
+        if (!(state[ch] != last[ch])) return;
+        int div = startDiv(time);
+        SongRow row = rowFor(ch, -1, heldVelocity(ch), div);
+        row.endDiv = div;
+        out.rows.push_back(row);
+        last[ch] = state[ch];
+    }
+
+    ChannelState state[16];
+
+private:
+    struct Active {
+        bool on = false;
+        uint32_t serial = 0;
+        SongRow row;
+    };
+
+    struct Held {
+        uint8_t note;
+        uint32_t serial;
+    };
+
+    int startDiv(int64_t time) const {
+        // Round half to even, as Python's round() does
+        return (int)std::nearbyint(time / ticksPer64th);
+    }
+
+    SongRow rowFor(int ch, int note, int velocity, int div) const {
+        const ChannelState& s = state[ch];
+        return SongRow{ch, s.program, note, velocity, div, div, s.pan, s.pitchBend, s.volume,
+                       sanitize(s.cc74), sanitize(s.cc75), sanitize(s.cc76)};
+    }
+
+    // Velocity of the longest-held note on the channel, else of its last finished note, else 64
+    int heldVelocity(int ch) {
+        std::deque<Held>& held = order[ch];
+        while (!held.empty()) {
+            const Active& a = active[ch][held.front().note];
+            if (a.on && a.serial == held.front().serial) return a.row.velocity;
+            held.pop_front();
+        }
+        return lastVelocity[ch] >= 0 ? lastVelocity[ch] : 64;
+    }
+
+    double ticksPer64th;
+    SongText& out;
+
+    ChannelState last[16];
+    Active active[16][128];
+    std::deque<Held> order[16];  // held notes per channel in the order they were struck
+    int lastVelocity[16];
+    uint32_t serial = 0;
+};
+
+} // namespace
+
+static bool readFile(const char* path, std::vector<uint8_t>& data) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+    uint8_t buf[65536];
+    size_t got;
+    while ((got = fread(buf, 1, sizeof(buf), f)) > 0) data.insert(data.end(), buf, buf + got);
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+// Data bytes after the status byte of a channel or system common message, or -1 if undefined
+static int dataLength(uint8_t status) {
+    switch (status & 0xF0) {
+    case 0xC0: case 0xD0: return 1;
+    case 0xF0: break;
+    default: return 2;
+    }
+    switch (status) {
+    case 0xF1: case 0xF3: return 1;
+    case 0xF2: return 2;
+    case 0xF6: case 0xF8: case 0xFA: case 0xFB: case 0xFC: case 0xFE: return 0;
+    default: return -1;
+    }
+}
+
+static bool truncated(std::string& error) {
+    error = "track is truncated";
+    return false;
+}
+
+static bool convertTrack(ByteReader in, Converter& conv, bool& haveTempo, SongText& song, std::string& error) {
+    int64_t time = 0;
+    int runningStatus = -1;
+
+    while (in.p < in.end) {
+        uint32_t delta;
+        uint8_t status;
+        if (!in.varlen(delta) || !in.byte(status)) return truncated(error);
+        time += delta;
+
+        uint8_t data[2];
+        int have = 0;
+        if (status < 0x80) {
+            if (runningStatus < 0) {
+                error = "running status without a previous status byte";
+                return false;
+            }
+            data[have++] = status;
+            status = (uint8_t)runningStatus;
+        } else if (status != 0xFF) {
+            // Meta events do not set running status
+            runningStatus = status;
+        }
+
+        if (status == 0xFF) {
+            uint8_t type;
+            uint32_t len;
+            if (!in.byte(type) || !in.varlen(len) || (uint32_t)(in.end - in.p) < len) return truncated(error);
+            // The first tempo in file order sets the BPM, wherever it is
+            if (type == 0x51 && len >= 3 && !haveTempo) {
+                uint32_t tempo = (uint32_t)in.p[0] << 16 | (uint32_t)in.p[1] << 8 | in.p[2];
+                if (tempo > 0) {
+                    song.bpm = (int)std::floor(60e6 / tempo);
+                    haveTempo = true;
+                }
+            }
+            in.skip(len);
+            continue;
+        }
+        if (status == 0xF0 || status == 0xF7) {
+            uint32_t len;
+            if (!in.varlen(len) || !in.skip(len)) return truncated(error);
+            continue;
+        }
+
+        int need = dataLength(status);
+        if (need < 0) {
+            char text[40];
+            snprintf(text, sizeof(text), "undefined status byte 0x%02x", status);
+            error = text;
+            return false;
+        }
+        for (; have < need; have++)
+            if (!in.byte(data[have])) return truncated(error);
+        for (int i = 0; i < need; i++) {
+            if (data[i] > 127) {
+                error = "data byte out of range";
+                return false;
+            }
+        }
+
+        int ch = status & 0x0F;
+        ChannelState& s = conv.state[ch];
+        switch (status & 0xF0) {
+        case 0x80:
+            conv.noteOff(ch, data[0], time);
+            break;
+        case 0x90:
+            if (data[1] > 0) conv.noteOn(ch, data[0], data[1], time);
+            else conv.noteOff(ch, data[0], time);
+            break;
+        case 0xB0:
+            if (data[0] == 10) s.pan = data[1];
+            else if (data[0] == 7) s.volume = data[1];
+            else if (data[0] == 74) s.cc74 = data[1];
+            else if (data[0] == 75) s.cc75 = data[1];
+            else if (data[0] == 76) s.cc76 = data[1];
+            conv.controllerChanged(ch, time);
+            break;
+        case 0xC0:
+            s.program = data[0];
+            conv.controllerChanged(ch, time);
+            break;
+        case 0xE0:
+            s.pitchBend = (data[0] | data[1] << 7) - 8192;
+            conv.controllerChanged(ch, time);
+            break;
+        }
+    }
+    return true;
+}
+
+bool convertMidi(const char* path, SongText& song, std::string& error) {
+    std::vector<uint8_t> data;
+    if (!readFile(path, data)) {
+        error = "cannot read file";
+        return false;
+    }
+
+    ByteReader in{data.data(), data.data() + data.size()};
+    uint32_t magic, len, format, tracks, division;
+    if (!in.u32(magic) || magic != 0x4D546864 || !in.u32(len) || len < 6 || !in.u16(format) ||
+        !in.u16(tracks) || !in.u16(division) || !in.skip(len - 6)) {
+        error = "not a Standard MIDI File";
+        return false;
+    }
+    if (division & 0x8000 || division == 0) {
+        error = "SMPTE time division is not supported";
+        return false;
+    }
+
+    song.bpm = 120;
+    song.rows.clear();
+    std::unique_ptr<Converter> conv(new Converter((int)division, song));
+    bool haveTempo = false;
+
+    for (uint32_t t = 0; t < tracks; t++) {
+        uint32_t id, size;
+        if (!in.u32(id) || !in.u32(size) || (uint32_t)(in.end - in.p) < size) {
+            error = "file is truncated";
+            return false;
+        }
+        ByteReader track{in.p, in.p + size};
+        in.skip(size);
+        // Chunks other than MTrk are allowed by the standard and carry nothing we use
+        if (id != 0x4D54726B) {
+            t--;
+            continue;
+        }
+        if (!convertTrack(track, *conv, haveTempo, song, error)) return false;
+    }
+
+    std::stable_sort(song.rows.begin(), song.rows.end(),
+                     [](const SongRow& a, const SongRow& b) { return a.startDiv < b.startDiv; });
+
+    // Keep the first of identical rows
+    std::unordered_set<SongRow, SongRowHash> seen;
+    seen.reserve(song.rows.size());
+    size_t kept = 0;
+    for (const SongRow& row : song.rows)
+        if (seen.insert(row).second) song.rows[kept++] = row;
+    song.rows.resize(kept);
+    return true;
+}
+
+bool writeSongText(const char* path, const SongText& song) {
+    FILE* f = fopen(path, "w");
+    if (!f) return false;
+    fprintf(f, "BPM:%d\n", song.bpm);
+    for (const SongRow& r : song.rows)
+        fprintf(f, "%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n", r.channel, r.program, r.note, r.velocity,
+                r.startDiv, r.endDiv, r.pan, r.pitchBend, r.volume, r.cc74, r.cc75, r.cc76);
+    bool ok = !ferror(f);
+    return fclose(f) == 0 && ok;
+}
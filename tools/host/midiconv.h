@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// One row of a NuclearSEQ text sequence, as m2text.py writes it. cc74-76 are the raw
+// controller values with 0 written as -1; note is -1 on controller-only rows.
+struct SongRow {
+    int channel, program, note, velocity, startDiv, endDiv;
+    int pan, pitchBend, volume, cc74, cc75, cc76;
+
+    bool operator==(const SongRow& o) const;
+};
+
+struct SongText {
+    int bpm = 120;
+    std::vector<SongRow> rows;  // sorted by startDiv, duplicates removed
+};
+
+// Convert a Standard MIDI File the way m2text.py does, with the same rows in the same order,
+// in time linear in the file size. On failure returns false and describes the problem in error.
+bool convertMidi(const char* path, SongText& song, std::string& error);
+
+// Write "BPM:n" and the rows. Returns false on any I/O error.
+bool writeSongText(const char* path, const SongText& song);
@@ -0,0 +1,88 @@
+#include "psgemu.h"
+
+// libnds DutyCycle values 0-6 are 12.5%-87.5%; 7 is 0% (silent)
+static int dutyHighSteps(int duty) {
+    if (duty < 0 || duty >= 7) return 0;
+    return duty + 1;
+}
+
+static uint64_t ticksPerSample(uint16_t freq) {
+    return ((uint64_t)freq << 32) / PSG_EMU_RATE;
+}
+
+void PsgEmulator::start(Channel& c, uint16_t freq, uint8_t volume, uint8_t pan) {
+    c.volume = volume > 127 ? 127 : volume;
+    c.pan = pan > 127 ? 127 : pan;
+    c.tickStep = ticksPerSample(freq);
+    c.tickPos = 0;
+    c.lfsr = 0x7FFF;
+    c.noiseHigh = false;
+}
+
+void PsgEmulator::playTone(int channel, int duty, uint16_t freq, uint8_t volume, uint8_t pan) {
+    Channel& c = channels[channel];
+    c.tone = true;
+    c.noise = false;
+    c.highSteps = dutyHighSteps(duty);
+    start(c, freq, volume, pan);
+}
+
+void PsgEmulator::playNoise(int channel, uint16_t freq, uint8_t volume, uint8_t pan) {
+    Channel& c = channels[channel];
+    c.tone = false;
+    c.noise = true;
+    start(c, freq, volume, pan);
+}
+
+void PsgEmulator::setFreq(int channel, uint16_t freq) { channels[channel].tickStep = ticksPerSample(freq); }
+void PsgEmulator::setVolume(int channel, uint8_t volume) { channels[channel].volume = volume > 127 ? 127 : volume; }
+void PsgEmulator::setPan(int channel, uint8_t pan) { channels[channel].pan = pan > 127 ? 127 : pan; }
+
+void PsgEmulator::kill(int channel) {
+    channels[channel].tone = false;
+    channels[channel].noise = false;
+}
+
+void PsgEmulator::render(int16_t* out, int frames) {
+    for (int i = 0; i < frames; i++) {
+        int32_t left = 0, right = 0;
+
+        for (int ch = 0; ch < PSG_CHANNELS; ch++) {
+            Channel& c = channels[ch];
+            if (!c.tone && !c.noise) continue;
+
+            uint64_t before = c.tickPos >> 32;
+            c.tickPos += c.tickStep;
+            uint64_t after = c.tickPos >> 32;
+
+            bool high;
+            if (c.tone) {
+                high = (int)(after & 7) < c.highSteps;
+            } else {
+                // Out = low when the bit shifted out is set (GBATEK)
+                for (uint64_t t = before; t < after; t++) {
+                    bool carry = c.lfsr & 1;
+                    c.lfsr >>= 1;
+                    if (carry) c.lfsr ^= 0x6000;
+                    c.noiseHigh = !carry;
+                }
+                high = c.noiseHigh;
+            }
+
+            int32_t s = (high ? 0x7FFF : -0x7FFF) * c.volume / 127;
+            left += s * (128 - c.pan) >> 7;
+            right += s * c.pan >> 7;
+        }
+
+        // Headroom for about eight channels at full volume, then clip like the DS mixer
+        left >>= 3;
+        right >>= 3;
+        if (left > 32767) left = 32767;
+        if (left < -32768) left = -32768;
+        if (right > 32767) right = 32767;
+        if (right < -32768) right = -32768;
+
+        out[i * 2] = (int16_t)left;
+        out[i * 2 + 1] = (int16_t)right;
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+#include "psg.h"
+
+// Sample rate of the DS sound mixer
+#define PSG_EMU_RATE 32768
+
+// Software model of the DS PSG as the player drives it. Each channel has a timer running at
+// the frequency passed to playTone/setFreq. A tone channel steps through an 8-step duty
+// pattern per timer tick, so it sounds at freq / 8 (which is what OCTAVE_SHIFT makes up for).
+// A noise channel clocks the 15-bit LFSR once per tick.
+class PsgEmulator : public PsgBackend {
+public:
+    void playTone(int channel, int duty, uint16_t freq, uint8_t volume, uint8_t pan) override;
+    void playNoise(int channel, uint16_t freq, uint8_t volume, uint8_t pan) override;
+    void setFreq(int channel, uint16_t freq) override;
+    void setVolume(int channel, uint8_t volume) override;
+    void setPan(int channel, uint8_t pan) override;
+    void kill(int channel) override;
+
+    // Mix frames stereo samples (left, right interleaved) at PSG_EMU_RATE
+    void render(int16_t* out, int frames);
+
+private:
+    struct Channel {
+        bool tone = false, noise = false;
+        int highSteps = 0;      // steps of 8 the pulse is high
+        uint8_t volume = 0, pan = 64;
+        uint64_t tickStep = 0;  // timer ticks per output sample (Q32)
+        uint64_t tickPos = 0;   // timer ticks elapsed (Q32)
+        uint16_t lfsr = 0x7FFF;
+        bool noiseHigh = false;
+    };
+
+    void start(Channel& c, uint16_t freq, uint8_t volume, uint8_t pan);
+
+    Channel channels[PSG_CHANNELS];
+};
@@ -0,0 +1,72 @@
+#include "render.h"
+
+#include <cstdio>
+
+#include "clock.h"
+#include "player.h"
+#include "psgemu.h"
+
+// Output samples per sequencer timer step; the mixer rate is an exact multiple of the timer
+#define SAMPLES_PER_STEP (PSG_EMU_RATE / HOST_TIMER_HZ)
+
+void renderSong(const Sequence& seq, const EnvelopeBank& envelopes, const RenderOptions& options,
+                std::vector<int16_t>& samples) {
+    PsgEmulator psg;
+    PsgShadow shadow(&psg);
+    Player player;
+    SeqClock clock;
+    player.setVoiceAllocation(options.allocateVoices, options.stealPolicy);
+    player.start(&seq, &envelopes, &shadow);
+    clock.configure(HOST_BUS_CLOCK, seq.bpm);
+
+    uint32_t lastEvent = seq.size() ? seq.time.back() : 0;
+    uint32_t maxSteps = (uint32_t)options.maxSeconds * HOST_TIMER_HZ;
+    uint32_t tailSteps = (uint32_t)options.tailSeconds * HOST_TIMER_HZ;
+    uint32_t stopAt = maxSteps;
+
+    samples.clear();
+    samples.reserve((size_t)SAMPLES_PER_STEP * 2 * HOST_TIMER_HZ * 60);
+
+    for (uint32_t step = 0; step < stopAt; step++) {
+        clock.advance(HOST_BUS_CLOCK / HOST_TIMER_HZ, player);
+        shadow.flush();
+
+        size_t at = samples.size();
+        samples.resize(at + SAMPLES_PER_STEP * 2);
+        psg.render(&samples[at], SAMPLES_PER_STEP);
+
+        if (stopAt != maxSteps) continue;
+        if (player.hasLoop()) {
+            if (player.loopCount() >= options.loops) stopAt = step + 1;
+        } else if (player.position() > lastEvent) {
+            stopAt = step + 1 + tailSteps;
+            if (stopAt > maxSteps) stopAt = maxSteps;
+        }
+    }
+}
+
+static void put16(FILE* f, uint16_t v) { fputc(v & 0xFF, f); fputc(v >> 8, f); }
+static void put32(FILE* f, uint32_t v) { put16(f, v & 0xFFFF); put16(f, v >> 16); }
+
+bool writeWav(const char* path, const std::vector<int16_t>& samples, int sampleRate) {
+    FILE* f = fopen(path, "wb");
+    if (!f) return false;
+
+    uint32_t dataBytes = (uint32_t)(samples.size() * 2);
+    fwrite("RIFF", 1, 4, f); put32(f, 36 + dataBytes);
+    fwrite("WAVE", 1, 4, f);
+    fwrite("fmt ", 1, 4, f); put32(f, 16);
+    put16(f, 1);                    // PCM
+    put16(f, 2);                    // stereo
+    put32(f, sampleRate);
+    put32(f, sampleRate * 4);       // byte rate
+    put16(f, 4);                    // block align
+    put16(f, 16);                   // bits per sample
+    fwrite("data", 1, 4, f); put32(f, dataBytes);
+
+    // WAV is little-endian, as is every host we build on
+    size_t written = fwrite(samples.data(), 2, samples.size(), f);
+    bool ok = written == samples.size();
+    if (fclose(f) != 0) ok = false;
+    return ok;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "envelope.h"
+#include "sequence.h"
+#include "voices.h"
+
+// The DS sequencer timer, which host runs reproduce step for step
+#define HOST_BUS_CLOCK 33513982
+#define HOST_TIMER_HZ 1024
+
+struct RenderOptions {
+    int loops = 1;          // stop when playback has looped back this many times
+    int tailSeconds = 2;    // keep rendering this long after the last event of an unlooped song
+    int maxSeconds = 600;   // hard limit
+    bool allocateVoices = false;
+    StealPolicy stealPolicy = STEAL_RELEASING;
+};
+
+// Play seq from the start into interleaved 16-bit stereo at PSG_EMU_RATE. The player, clock
+// and shadow registers are set up exactly as on the DS.
+void renderSong(const Sequence& seq, const EnvelopeBank& envelopes, const RenderOptions& options,
+                std::vector<int16_t>& samples);
+
+// Write 16-bit stereo PCM. Returns false on any I/O error.
+bool writeWav(const char* path, const std::vector<int16_t>& samples, int sampleRate);
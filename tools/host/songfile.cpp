@@ -0,0 +1,71 @@
+#include "songfile.h"
+
+#include <cstdio>
+
+#include "loader.h"
+#include "seqbin.h"
+
+static bool endsWith(const std::string& s, const char* suffix) {
+    size_t n = std::char_traits<char>::length(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+bool loadSongFile(const std::string& path, Sequence& seq, std::string& error) {
+    if (endsWith(path, ".nseq")) {
+        SeqBinResult result = loadSequenceBinary(path.c_str(), seq);
+        if (result == SEQBIN_BAD_MAGIC) {
+            PatternSequence song;
+            result = loadPatternBinary(path.c_str(), song);
+            if (result == SEQBIN_OK) expandPatterns(song, seq);
+        }
+        if (result != SEQBIN_OK) {
+            error = seqBinResultString(result);
+            return false;
+        }
+        return true;
+    }
+
+    TextLoadReport report;
+    if (!loadSequenceText(path, seq, &report)) {
+        error = "cannot load text sequence";
+        return false;
+    }
+    if (report.badLines) fprintf(stderr, "warning: %s\n", describeTextLoad(path, report).c_str());
+    return true;
+}
+
+bool loadPatternSongFile(const std::string& path, PatternSequence& song, std::string& error) {
+    if (endsWith(path, ".nseq")) {
+        SeqBinResult result = loadPatternBinary(path.c_str(), song);
+        if (result == SEQBIN_OK) return true;
+        if (result != SEQBIN_BAD_MAGIC) {
+            error = seqBinResultString(result);
+            return false;
+        }
+    }
+
+    Sequence seq;
+    if (!loadSongFile(path, seq, error)) return false;
+    PatternResult result = buildPatterns(seq, song);
+    if (result != PATTERN_OK) {
+        error = patternResultString(result);
+        return false;
+    }
+    return true;
+}
+
+bool parseStealPolicy(const std::string& name, StealPolicy& policy) {
+    if (name == "oldest") policy = STEAL_OLDEST;
+    else if (name == "quietest") policy = STEAL_QUIETEST;
+    else if (name == "releasing") policy = STEAL_RELEASING;
+    else return false;
+    return true;
+}
+
+bool loadEnvelopeFile(const std::string& path, EnvelopeBank& bank) {
+    bank.setDefaults();
+    TextLoadReport report;
+    if (!loadEnvelopesText(path, bank, nullptr, &report)) return false;
+    if (report.badLines) fprintf(stderr, "warning: %s\n", describeTextLoad(path, report).c_str());
+    return true;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+
+#include "envelope.h"
+#include "pattern.h"
+#include "sequence.h"
+#include "voices.h"
+
+// Load a song by extension: .nseq through the binary loader, anything else as text. A .nseq
+// stored as patterns is expanded. On failure returns false and describes the problem in error.
+bool loadSongFile(const std::string& path, Sequence& seq, std::string& error);
+
+// Load a song as patterns: a .nseq stored as patterns as it is, anything else through
+// loadSongFile and buildPatterns
+bool loadPatternSongFile(const std::string& path, PatternSequence& song, std::string& error);
+
+// Defaults plus every envelope in path. Returns false if path cannot be opened.
+bool loadEnvelopeFile(const std::string& path, EnvelopeBank& bank);
+
+// "oldest", "quietest" or "releasing", for the tools' -a option
+bool parseStealPolicy(const std::string& name, StealPolicy& policy);
@@ -0,0 +1,315 @@
+// nseqbench: host benchmark for the player core. Times the text and binary loaders and the
+// envelope loaders, then plays each song through the DS timing path (Player, SeqClock and
+// PsgShadow) into a backend that discards everything, timing each sequencer step. Besides
+// the songs given, two synthetic stress songs are generated. Results are printed as JSON so
+// runs from different versions can be compared by scripts.
+//
+//   nseqbench [-r runs] [-e envelopes.txt] [-o results.json] [--no-stress] [song.txt ...]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "clock.h"
+#include "loader.h"
+#include "player.h"
+#include "render.h"
+#include "seqbin.h"
+#include "songfile.h"
+
+namespace fs = std::filesystem;
+typedef std::chrono::steady_clock BenchClock;
+
+// Bump when the JSON layout changes
+#define BENCH_FORMAT_VERSION 2
+
+// Rows in each generated stress song
+#define STRESS_ROWS 120000
+
+class NullPsg : public PsgBackend {
+public:
+    void playTone(int, int, uint16_t, uint8_t, uint8_t) override {}
+    void playNoise(int, uint16_t, uint8_t, uint8_t) override {}
+    void setFreq(int, uint16_t) override {}
+    void setVolume(int, uint8_t) override {}
+    void setPan(int, uint8_t) override {}
+    void kill(int) override {}
+};
+
+struct Percentiles {
+    double p50 = 0, p90 = 0, p99 = 0, p999 = 0, max = 0;
+};
+
+struct SongResult {
+    std::string name;
+    size_t rows = 0, events = 0, packedBytes = 0;
+    double loadNotesMs = 0, packMs = 0, loadBinaryMs = 0;
+    uint32_t steps = 0;
+    double playMs = 0, eventsPerSecond = 0;
+    Percentiles stepNs;
+    uint32_t writesRequested = 0, writesIssued = 0;
+};
+
+static double msSince(BenchClock::time_point begin) {
+    return std::chrono::duration<double, std::milli>(BenchClock::now() - begin).count();
+}
+
+static double median(std::vector<double> v) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+static Percentiles percentiles(std::vector<double>& v) {
+    Percentiles p;
+    if (v.empty()) return p;
+    std::sort(v.begin(), v.end());
+    auto at = [&](double q) { return v[std::min(v.size() - 1, (size_t)(q * v.size()))]; };
+    p.p50 = at(0.50); p.p90 = at(0.90); p.p99 = at(0.99); p.p999 = at(0.999); p.max = v.back();
+    return p;
+}
+
+// Deterministic, so every run benchmarks the same songs
+static uint32_t lcgState = 12345;
+static int rnd(int lo, int hi) {
+    lcgState = lcgState * 1664525u + 1013904223u;
+    return lo + (int)((lcgState >> 8) % (uint32_t)(hi - lo + 1));
+}
+
+// A scratch file in the temp directory; a missing one only shows when the file is written
+static std::string tempPath(const char* file) {
+    std::error_code ec;
+    fs::path dir = fs::temp_directory_path(ec);
+    return (ec ? fs::path(file) : dir / file).string();
+}
+
+// Short notes on all 8 PSG channels (6 pulse, 2 noise) with random envelopes. False if the
+// file cannot be written.
+static bool writeNoteStress(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    fprintf(f, "BPM:180\n");
+    for (int row = 0; row < STRESS_ROWS; row++) {
+        int ch = 8 + row % 8;
+        int start = (row / 8) * 2;
+        fprintf(f, "%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n", ch, rnd(0, 6), rnd(36, 96), rnd(40, 127),
+                start, start + rnd(1, 8), 64, 0, 127, rnd(0, 5), rnd(0, 4), 0);
+    }
+    return fclose(f) == 0;
+}
+
+// Every 64th, every PSG channel gets new pan, pitch bend and volume, with a note every 16th
+static bool writeControllerStress(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    fprintf(f, "BPM:180\n");
+    for (int row = 0; row < STRESS_ROWS; row++) {
+        int ch = 8 + row % 8;
+        int t = row / 8;
+        int note = (t % 4 == 0) ? rnd(48, 84) : -1;
+        fprintf(f, "%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n", ch, 3, note, 100, t, t + 3, rnd(0, 127),
+                rnd(-8192, 8191), rnd(60, 127), 1, 2, 0);
+    }
+    return fclose(f) == 0;
+}
+
+// Times one song into r. False, with the reason in error, if a step fails, so a failed step
+// is never timed as if it had worked.
+static bool benchSong(const std::string& path, const std::string& name, const EnvelopeBank& envelopes,
+                      int runs, SongResult& r, std::string& error) {
+    r.name = name;
+
+    std::vector<double> loadNotesMs, packMs, loadBinaryMs;
+    Sequence seq;
+    std::string binPath = tempPath("nseqbench.nseq");
+
+    for (int run = 0; run < runs; run++) {
+        seq = Sequence();
+        std::vector<Note> notes;
+        auto begin = BenchClock::now();
+        if (!loadSongText(path, notes, seq.bpm, seq.loopStart64th, seq.loopEnd64th)) {
+            error = "cannot open " + path;
+            return false;
+        }
+        loadNotesMs.push_back(msSince(begin));
+        r.rows = notes.size();
+
+        begin = BenchClock::now();
+        bool packed = packSequence(notes, seq);
+        packMs.push_back(msSince(begin));
+        if (!packed) {
+            error = path + ": " + seqBinResultString(SEQBIN_OUT_OF_RANGE);
+            return false;
+        }
+
+        SeqBinResult result = writeSequenceBinary(binPath.c_str(), seq);
+        if (result != SEQBIN_OK) {
+            error = binPath + ": " + seqBinResultString(result);
+            return false;
+        }
+        Sequence bin;
+        begin = BenchClock::now();
+        result = loadSequenceBinary(binPath.c_str(), bin);
+        loadBinaryMs.push_back(msSince(begin));
+        if (result != SEQBIN_OK) {
+            fs::remove(binPath);
+            error = binPath + ": " + seqBinResultString(result);
+            return false;
+        }
+    }
+    fs::remove(binPath);
+
+    r.loadNotesMs = median(loadNotesMs);
+    r.packMs = median(packMs);
+    r.loadBinaryMs = median(loadBinaryMs);
+    r.events = seq.size();
+    r.packedBytes = seq.memoryBytes();
+
+    // One pass through the song with looping disabled, so every event is dispatched once
+    seq.loopStart64th = -1;
+    seq.loopEnd64th = -1;
+    uint32_t lastEvent = seq.size() ? seq.time.back() : 0;
+
+    // Sized up front so vector growth does not land in a timed step
+    std::vector<double> stepNs;
+    int bpm = seq.bpm > 0 ? seq.bpm : 120;
+    stepNs.reserve((size_t)runs * ((uint64_t)(lastEvent + 2) * HOST_TIMER_HZ * 60 / (bpm * 16) + 16));
+    double totalNs = 0;
+    for (int run = 0; run < runs; run++) {
+        NullPsg out;
+        PsgShadow shadow(&out);
+        Player player;
+        SeqClock clock;
+        player.start(&seq, &envelopes, &shadow);
+        clock.configure(HOST_BUS_CLOCK, seq.bpm);
+
+        uint32_t steps = 0;
+        while (player.position() <= lastEvent) {
+            auto begin = BenchClock::now();
+            clock.advance(HOST_BUS_CLOCK / HOST_TIMER_HZ, player);
+            shadow.flush();
+            double ns = std::chrono::duration<double, std::nano>(BenchClock::now() - begin).count();
+            stepNs.push_back(ns);
+            totalNs += ns;
+            steps++;
+        }
+        r.steps = steps;
+        r.writesRequested = shadow.stats().totalRequested();
+        r.writesIssued = shadow.stats().totalIssued();
+    }
+
+    r.playMs = totalNs / runs / 1e6;
+    r.eventsPerSecond = totalNs > 0 ? (double)r.events * runs / (totalNs / 1e9) : 0;
+    r.stepNs = percentiles(stepNs);
+    return true;
+}
+
+static std::string jsonString(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+int main(int argc, char* argv[]) {
+    int runs = 5;
+    bool stress = true;
+    std::string envPath, outPath;
+    std::vector<std::string> songs;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "-r" && i + 1 < argc) runs = atoi(argv[++i]);
+        else if (a == "-e" && i + 1 < argc) envPath = argv[++i];
+        else if (a == "-o" && i + 1 < argc) outPath = argv[++i];
+        else if (a == "--no-stress") stress = false;
+        else if (a[0] == '-') {
+            fprintf(stderr, "usage: %s [-r runs] [-e envelopes.txt] [-o results.json] [--no-stress] [song.txt ...]\n", argv[0]);
+            return 2;
+        }
+        else songs.push_back(a);
+    }
+    if (runs < 1) runs = 1;
+
+    // Envelope loader
+    static EnvelopeBank envelopes;
+    envelopes.setDefaults();
+    double envelopeMs = 0;
+    if (!envPath.empty()) {
+        std::vector<double> e;
+        for (int run = 0; run < runs; run++) {
+            auto begin = BenchClock::now();
+            if (!loadEnvelopesText(envPath, envelopes)) {
+                fprintf(stderr, "%s: cannot open %s\n", argv[0], envPath.c_str());
+                return 1;
+            }
+            e.push_back(msSince(begin));
+        }
+        envelopeMs = median(e);
+    }
+
+    std::vector<SongResult> results;
+    std::string error;
+    for (const std::string& song : songs) {
+        if (!fs::exists(song)) {
+            fprintf(stderr, "%s: cannot open %s\n", argv[0], song.c_str());
+            return 1;
+        }
+        results.emplace_back();
+        if (!benchSong(song, fs::path(song).filename().string(), envelopes, runs, results.back(), error)) {
+            fprintf(stderr, "%s: %s\n", argv[0], error.c_str());
+            return 1;
+        }
+    }
+
+    if (stress) {
+        std::string path = tempPath("nseqbench-stress.txt");
+        static const char* names[2] = {"stress-notes", "stress-controllers"};
+        for (int i = 0; i < 2; i++) {
+            if (!(i == 0 ? writeNoteStress(path) : writeControllerStress(path))) {
+                fprintf(stderr, "%s: cannot write %s\n", argv[0], path.c_str());
+                return 1;
+            }
+            results.emplace_back();
+            bool ok = benchSong(path, names[i], envelopes, runs, results.back(), error);
+            if (!ok) {
+                fs::remove(path);
+                fprintf(stderr, "%s: %s\n", argv[0], error.c_str());
+                return 1;
+            }
+        }
+        fs::remove(path);
+    }
+
+    FILE* out = stdout;
+    if (!outPath.empty() && !(out = fopen(outPath.c_str(), "w"))) {
+        fprintf(stderr, "%s: cannot write %s\n", argv[0], outPath.c_str());
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"format\": %d,\n  \"runs\": %d,\n  \"timer_hz\": %d,\n", BENCH_FORMAT_VERSION, runs, HOST_TIMER_HZ);
+    fprintf(out, "  \"envelopes\": {\"file\": %s, \"load_ms\": %.4f},\n", jsonString(envPath).c_str(), envelopeMs);
+    fprintf(out, "  \"songs\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const SongResult& r = results[i];
+        fprintf(out, "    {\"name\": %s, \"rows\": %zu, \"events\": %zu, \"packed_bytes\": %zu,\n",
+                jsonString(r.name).c_str(), r.rows, r.events, r.packedBytes);
+        fprintf(out, "     \"load_notes_ms\": %.3f, \"pack_ms\": %.3f, \"load_binary_ms\": %.3f,\n",
+                r.loadNotesMs, r.packMs, r.loadBinaryMs);
+        fprintf(out, "     \"steps\": %u, \"play_ms\": %.3f, \"events_per_sec\": %.0f,\n", r.steps, r.playMs, r.eventsPerSecond);
+        fprintf(out, "     \"step_ns\": {\"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"p999\": %.0f, \"max\": %.0f},\n",
+                r.stepNs.p50, r.stepNs.p90, r.stepNs.p99, r.stepNs.p999, r.stepNs.max);
+        fprintf(out, "     \"psg_writes_requested\": %u, \"psg_writes_issued\": %u}%s\n",
+                r.writesRequested, r.writesIssued, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    if (out != stdout) fclose(out);
+    return 0;
+}
@@ -0,0 +1,145 @@
+// nseqc: compiles a NuclearSEQ text sequence (the 12-column format written by m2text.py)
+// into the binary .nseq format the player loads without any text parsing. Controller lines
+// that change nothing are left out on the way (see optimizeNotes), and runs of them that a
+// straight line hits exactly become ramps (see fitRamps). -g also thins automation to one
+// line per channel every given number of 64ths; -e lets ramps stray that many volume/pan
+// steps (and 1/128 of the bend range per step) from the lines they replace. -p stores
+// repeated blocks once as patterns (see pattern.h) when that takes less memory than the flat
+// layout; the player then loads the file whole instead of streaming it.
+//
+//   nseqc [-p] [-g 64ths] [-e steps] song.txt [song.nseq]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "loader.h"
+#include "optimize.h"
+#include "pattern.h"
+#include "pitch.h"
+#include "seqbin.h"
+#include "seqstream.h"
+
+// Main RAM left for song data on a DS once code, libraries and buffers are loaded
+#define SONG_MEMORY_BUDGET (3 * 1024 * 1024)
+
+static std::string defaultOutput(const std::string& input) {
+    size_t dot = input.find_last_of('.');
+    size_t slash = input.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return input + ".nseq";
+    return input.substr(0, dot) + ".nseq";
+}
+
+static void printLayout(const char* name, size_t bytes, size_t lines) {
+    double perLine = lines ? (double)bytes / lines : 0.0;
+    printf("  %-18s %8zu bytes  %5.1f bytes/line  max ~%zu lines in %d MiB\n", name, bytes, perLine,
+           perLine > 0 ? (size_t)(SONG_MEMORY_BUDGET / perLine) : 0, SONG_MEMORY_BUDGET >> 20);
+}
+
+int main(int argc, char* argv[]) {
+    const char* name = argv[0];
+    uint32_t grid = 0;
+    int tolerance = 0;
+    bool patterned = false;
+    while (argc > 2) {
+        if (strcmp(argv[1], "-p") == 0) {
+            patterned = true;
+            argv++;
+            argc--;
+            continue;
+        }
+        if (strcmp(argv[1], "-g") != 0 && strcmp(argv[1], "-e") != 0) break;
+        if (argv[1][1] == 'g') grid = (uint32_t)atoi(argv[2]);
+        else tolerance = atoi(argv[2]);
+        argv += 2;
+        argc -= 2;
+    }
+    argv[0] = const_cast<char*>(name);
+    if (argc < 2 || argc > 3 || tolerance < 0) {
+        fprintf(stderr, "usage: %s [-p] [-g 64ths] [-e steps] song.txt [song.nseq]\n", argv[0]);
+        return 2;
+    }
+
+    std::string input = argv[1];
+    std::string output = (argc == 3) ? argv[2] : defaultOutput(input);
+
+    Sequence seq;
+    std::vector<Note> notes;
+    TextLoadReport report;
+    if (!loadSongText(input, notes, seq.bpm, seq.loopStart64th, seq.loopEnd64th, &report)) {
+        fprintf(stderr, "%s: cannot open %s\n", argv[0], input.c_str());
+        return 1;
+    }
+    if (report.badLines) {
+        fprintf(stderr, "%s: %s\n", argv[0], describeTextLoad(input, report).c_str());
+        return 1;
+    }
+    size_t lines = notes.size();
+    SeqOptimizeStats optimized;
+    optimizeNotes(notes, grid, &optimized);
+    fitRamps(notes, tolerance, &optimized);
+    if (!packSequence(notes, seq)) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], input.c_str(), seqBinResultString(SEQBIN_OUT_OF_RANGE));
+        return 1;
+    }
+
+    PatternSequence patterns;
+    PatternResult patternResult = PATTERN_OK;
+    if (patterned) {
+        patternResult = buildPatterns(seq, patterns);
+        if (patternResult == PATTERN_OK && patterns.memoryBytes() >= seq.memoryBytes()) patterned = false;
+        else if (patternResult != PATTERN_OK) {
+            fprintf(stderr, "%s: %s: no patterns, %s; writing it flat\n", argv[0], input.c_str(),
+                    patternResultString(patternResult));
+            patterned = false;
+        }
+    }
+
+    SeqBinResult result = patterned ? writePatternBinary(output.c_str(), patterns)
+                                    : writeSequenceBinary(output.c_str(), seq);
+    if (result != SEQBIN_OK) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], output.c_str(), seqBinResultString(result));
+        return 1;
+    }
+
+    // Read it back the same way the player will, so a bad file never leaves the host
+    Sequence check;
+    if (patterned) {
+        PatternSequence loaded;
+        result = loadPatternBinary(output.c_str(), loaded);
+        if (result == SEQBIN_OK) expandPatterns(loaded, check);
+    } else {
+        result = loadSequenceBinary(output.c_str(), check);
+    }
+    if (result != SEQBIN_OK || !sameSequence(seq, check)) {
+        fprintf(stderr, "%s: %s: verification failed (%s)\n", argv[0], output.c_str(),
+                seqBinResultString(result));
+        return 1;
+    }
+
+    printf("%s -> %s: %zu lines, %zu events, BPM %d, loop %d..%d\n", input.c_str(), output.c_str(),
+           lines, seq.size(), seq.bpm, seq.loopStart64th, seq.loopEnd64th);
+    printf("  removed %u controller lines: %u merged, %u unheard, %u thinned, %u folded into %u ramps\n",
+           optimized.total(), optimized.merged, optimized.unheard, optimized.thinned, optimized.ramped,
+           optimized.ramps);
+    if (tolerance)
+        printf("  ramp error at most %d bend units (%.1f cents), %d volume/pan steps\n",
+               optimized.maxBendError, optimized.maxBendError * PITCH_BEND_RANGE_SEMITONES * 100.0 / 8192,
+               optimized.maxLevelError);
+    printLayout("packed:", seq.memoryBytes(), lines);
+    printLayout("std::vector<Note>:", lines * sizeof(Note), lines);
+    if (patternResult == PATTERN_OK && !patterns.patterns.empty()) {
+        printLayout("patterns:", patterns.memoryBytes(), lines);
+        printf("  %zu patterns in %zu places, %zu fixed 64ths%s\n", patterns.patterns.size(),
+               patterns.orders.size(), patterns.fixes.size(), patterned ? "" : "; written flat, as it is smaller");
+    }
+    if (patterned) return 0;
+
+    SeqStream stream;
+    if (stream.open(output.c_str()) == SEQBIN_OK)
+        printf("  %-18s %8zu bytes  resident while streaming\n", "streamed:", stream.memoryBytes());
+    return 0;
+}
@@ -0,0 +1,334 @@
+// nseqdensity: predicts how hard a song works the sequencer, without a DS. It plays the song
+// once through the player core at the DS timer rate, with nothing heard, and counts what each
+// timer tick does: 64ths dispatched and their events, envelope frames and the voices each one
+// updates, and the sound writes left after the shadow registers. A cost model turns those
+// counts into bus clock cycles, and ticks that would not fit in one timer period are flagged.
+// It also reports events per 64th, the busiest envelope frame (at the song's BPM and 59.73
+// frames per second), and notes whose note-off lands in the frame of their note-on, which end
+// before any envelope step.
+//
+//   nseqdensity [-a steal] [-b percent] [-c profile.txt] song.(txt|nseq) [envelopes.txt]
+//
+// -b sets the share of the timer period a tick may use (default 100). -c calibrates the cost
+// model against a profile.txt the DS saved while playing the same song, and prints the
+// calibrated values. Exits with 1 if any tick goes over, so an export script can stop there.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "clock.h"
+#include "player.h"
+#include "render.h"
+#include "songfile.h"
+
+// Longest run analysed for songs that never end
+#define DENSITY_MAX_SECONDS 3600
+
+// Over-budget ticks listed
+#define DENSITY_LIST_MAX 10
+
+// Bus clock cycles of each piece of work. The defaults are estimates for the ARM9; -c
+// replaces them with values measured on a DS.
+struct CostModel {
+    double tick = 400;          // timer IRQ, clock accumulators, shadow flush without writes
+    double write = 250;         // each write the flush sends to the ARM7
+    double sixtyFourth = 300;   // one step64th with no events
+    double event = 900;         // each event dispatched
+    double adsrPass = 200;      // stepFrame's pass over the volume envelopes
+    double adsr = 350;          // each voice with a volume envelope, per frame
+    double pitchPass = 200;     // the pass over the pitch envelopes
+    double pitch = 700;         // each voice with a pitch envelope, per frame
+    double slidePass = 200;     // the pass over the slides
+    double slide = 500;         // each voice sliding, per frame
+};
+
+// What one timer tick did
+struct TickWork {
+    uint32_t sixtyFourths = 0, events = 0;
+    uint32_t frames = 0, adsr = 0, pitch = 0, slide = 0;
+    uint32_t writes = 0;
+
+    double cost(const CostModel& m) const {
+        return m.tick + writes * m.write + sixtyFourths * m.sixtyFourth + events * m.event +
+               frames * (m.adsrPass + m.pitchPass + m.slidePass) + adsr * m.adsr + pitch * m.pitch + slide * m.slide;
+    }
+};
+
+// Counts the writes the shadow registers let through, and passes nothing on
+class CountingPsg : public PsgBackend {
+public:
+    uint32_t writes = 0;
+
+    void playTone(int, int, uint16_t, uint8_t, uint8_t) override { writes++; }
+    void playNoise(int, uint16_t, uint8_t, uint8_t) override { writes++; }
+    void setFreq(int, uint16_t) override { writes++; }
+    void setVolume(int, uint8_t) override { writes++; }
+    void setPan(int, uint8_t) override { writes++; }
+    void kill(int) override { writes++; }
+};
+
+// Stands in for the player in SeqClock::advance, counting each step before passing it on
+struct Meter {
+    Player& player;
+    const std::vector<uint32_t>& eventsAt;  // events dispatched on each 64th
+    TickWork work;
+
+    void step64th() {
+        uint32_t t = player.position();
+        work.sixtyFourths++;
+        if (t < eventsAt.size()) work.events += eventsAt[t];
+        player.step64th();
+    }
+
+    // The voices each of stepFrame's passes will update
+    void stepFrame() {
+        work.frames++;
+        for (int v = 0; v < 16; v++) {
+            const PlayerChannel& pc = player.channel(v);
+            if (pc.slide.active && pc.slide.duration64 > 0) work.slide++;
+            if (!pc.active) continue;
+            if (pc.cc74 >= 0 && pc.cc74 < 16) work.adsr++;
+            if (!pc.slide.active && pc.pitchEnv.active && pc.cc75 >= 0 && pc.cc75 < 16) work.pitch++;
+        }
+        player.stepFrame();
+    }
+};
+
+// Averages over a whole run, for calibration
+struct RunTotals {
+    uint64_t ticks = 0, sixtyFourths = 0, events = 0, frames = 0, adsr = 0, pitch = 0, slide = 0, writes = 0;
+
+    void add(const TickWork& w) {
+        ticks++;
+        sixtyFourths += w.sixtyFourths;
+        events += w.events;
+        frames += w.frames;
+        adsr += w.adsr;
+        pitch += w.pitch;
+        slide += w.slide;
+        writes += w.writes;
+    }
+};
+
+// Average microseconds per call of each section in a saved profile (see printProfile)
+static bool readProfile(const char* path, double avgUs[PROF_SECTIONS]) {
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+    char line[256];
+    int found = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char name[32];
+        unsigned calls;
+        double avg;
+        if (sscanf(line, "%31s %u %lf", name, &calls, &avg) != 3) continue;
+        for (int s = 0; s < PROF_SECTIONS; s++) {
+            if (strcmp(name, profileSectionName(s)) != 0 || avgUs[s] >= 0) continue;
+            avgUs[s] = avg;
+            found++;
+        }
+    }
+    fclose(f);
+    return found == PROF_SECTIONS;
+}
+
+// Scale each section's part of the model so the run's averages reproduce the section's
+// average in the profile. The tick's own part is what the tick measured beyond its 64ths and
+// frames.
+static void calibrate(CostModel& m, const double avgUs[PROF_SECTIONS], const RunTotals& run) {
+    double cyclesPerUs = HOST_BUS_CLOCK / 1e6;
+    auto scale = [&](int section, double calls, double modelled, double& fixed, double& each) {
+        if (calls <= 0 || modelled <= 0 || avgUs[section] <= 0) return;
+        double factor = avgUs[section] * cyclesPerUs * calls / modelled;
+        fixed *= factor;
+        each *= factor;
+    };
+
+    double frames = run.frames;
+    scale(PROF_DISPATCH, run.sixtyFourths, run.sixtyFourths * m.sixtyFourth + run.events * m.event,
+          m.sixtyFourth, m.event);
+    scale(PROF_ADSR, frames, frames * m.adsrPass + run.adsr * m.adsr, m.adsrPass, m.adsr);
+    scale(PROF_PITCH, frames, frames * m.pitchPass + run.pitch * m.pitch, m.pitchPass, m.pitch);
+    scale(PROF_SLIDE, frames, frames * m.slidePass + run.slide * m.slide, m.slidePass, m.slide);
+
+    double inner = run.sixtyFourths * m.sixtyFourth + run.events * m.event +
+                   frames * (m.adsrPass + m.pitchPass + m.slidePass) + run.adsr * m.adsr +
+                   run.pitch * m.pitch + run.slide * m.slide;
+    double own = avgUs[PROF_TICK] * cyclesPerUs * run.ticks - inner;
+    double modelled = run.ticks * m.tick + run.writes * m.write;
+    if (own > 0 && modelled > 0) {
+        m.tick *= own / modelled;
+        m.write *= own / modelled;
+    }
+}
+
+static void printModel(const CostModel& m) {
+    printf("  cycles: tick %.0f + %.0f/write, 64th %.0f + %.0f/event, adsr %.0f + %.0f/voice, pitch %.0f + %.0f/voice, "
+           "slide %.0f + %.0f/voice\n", m.tick, m.write, m.sixtyFourth, m.event, m.adsrPass, m.adsr, m.pitchPass, m.pitch,
+           m.slidePass, m.slide);
+}
+
+int main(int argc, char* argv[]) {
+    const char* name = argv[0];
+    bool allocating = false;
+    StealPolicy policy = STEAL_RELEASING;
+    double budgetPercent = 100;
+    const char* profilePath = nullptr;
+    while (argc > 2 && argv[1][0] == '-') {
+        std::string flag = argv[1];
+        if (flag == "-a" && parseStealPolicy(argv[2], policy)) allocating = true;
+        else if (flag == "-b") budgetPercent = atof(argv[2]);
+        else if (flag == "-c") profilePath = argv[2];
+        else break;
+        argv += 2;
+        argc -= 2;
+    }
+    argv[0] = const_cast<char*>(name);
+    if (argc < 2 || argc > 3 || argv[1][0] == '-' || budgetPercent <= 0) {
+        fprintf(stderr, "usage: %s [-a oldest|quietest|releasing] [-b percent] [-c profile.txt] song.(txt|nseq) [envelopes.txt]\n",
+                argv[0]);
+        return 2;
+    }
+
+    static Sequence seq;
+    std::string error;
+    if (!loadSongFile(argv[1], seq, error)) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[1], error.c_str());
+        return 2;
+    }
+    static EnvelopeBank envelopes;
+    envelopes.setDefaults();
+    if (argc == 3 && !loadEnvelopeFile(argv[2], envelopes)) {
+        fprintf(stderr, "%s: cannot open %s\n", argv[0], argv[2]);
+        return 2;
+    }
+
+    // Events per 64th, as dispatch counts them (a note-on's controller record is part of it),
+    // and the note-ons still waiting for their note-off
+    uint32_t lastTime = seq.size() ? seq.time[seq.size() - 1] : 0;
+    std::vector<uint32_t> eventsAt(lastTime + 1, 0);
+    for (size_t i = 0; i < seq.size(); i++)
+        if (evType(seq.events[i]) != EV_NOTE_CTRL) eventsAt[seq.time[i]]++;
+
+    static Player player;
+    CountingPsg psg;
+    PsgShadow shadow(&psg);
+    player.setVoiceAllocation(allocating, policy);
+    player.start(&seq, &envelopes, &shadow);
+    int32_t framesPer64th = player.framesPer64th();
+    auto frameOf = [&](uint32_t t) { return (uint32_t)((uint64_t)t * framesPer64th >> 16); };
+
+    // Events per envelope frame, and notes over before their first frame
+    std::vector<uint32_t> eventsInFrame(frameOf(lastTime) + 1, 0);
+    for (uint32_t t = 0; t <= lastTime; t++) eventsInFrame[frameOf(t)] += eventsAt[t];
+    uint32_t collapsed = 0;
+    std::vector<uint32_t> onAt[16][128];
+    for (size_t i = 0; i < seq.size(); i++) {
+        uint32_t e = seq.events[i];
+        SeqEventType type = evType(e);
+        if (type == EV_CONTROL || type == EV_NOTE_CTRL) continue;
+        std::vector<uint32_t>& on = onAt[evChannel(e)][evNote(e) & 127];
+        if (type == EV_NOTE_ON) {
+            on.push_back(seq.time[i]);
+        } else if (!on.empty()) {
+            if (frameOf(on.back()) == frameOf(seq.time[i])) collapsed++;
+            on.pop_back();
+        }
+    }
+
+    // Play it through once: to the end of the last note, or once around the loop
+    SeqClock clock;
+    clock.configure(HOST_BUS_CLOCK, player.bpm());
+    CostModel model;
+    double budget = (double)HOST_BUS_CLOCK / HOST_TIMER_HZ * budgetPercent / 100;
+    std::vector<TickWork> ticks;
+    RunTotals totals;
+    Meter meter{player, eventsAt, TickWork()};
+    uint32_t limit = DENSITY_MAX_SECONDS * HOST_TIMER_HZ;
+    while (ticks.size() < limit && !player.finished() && player.loopCount() == 0) {
+        meter.work = TickWork();
+        uint32_t before = psg.writes;
+        clock.advance(HOST_BUS_CLOCK / HOST_TIMER_HZ, meter);
+        shadow.flush();
+        meter.work.writes = psg.writes - before;
+        ticks.push_back(meter.work);
+        totals.add(meter.work);
+    }
+
+    if (profilePath) {
+        double avgUs[PROF_SECTIONS];
+        for (double& a : avgUs) a = -1;
+        if (!readProfile(profilePath, avgUs)) {
+            fprintf(stderr, "%s: %s: not a saved profile\n", argv[0], profilePath);
+            return 2;
+        }
+        calibrate(model, avgUs, totals);
+    }
+
+    // Events per 64th
+    uint32_t busy64ths = 0, peak64th = 0, peakEvents = 0;
+    uint64_t events = 0;
+    for (uint32_t t = 0; t <= lastTime; t++) {
+        if (!eventsAt[t]) continue;
+        busy64ths++;
+        events += eventsAt[t];
+        if (eventsAt[t] > peakEvents) {
+            peakEvents = eventsAt[t];
+            peak64th = t;
+        }
+    }
+    uint32_t peakFrame = 0;
+    for (uint32_t f = 0; f < eventsInFrame.size(); f++)
+        if (eventsInFrame[f] > eventsInFrame[peakFrame]) peakFrame = f;
+    uint32_t frameFirst = 0, frameLast = 0;
+    for (uint32_t t = lastTime + 1; t-- > 0;) {
+        if (frameOf(t) != peakFrame) continue;
+        if (!frameLast) frameLast = t;
+        frameFirst = t;
+    }
+
+    printf("%s: %zu events over %u 64ths, %d BPM (%.3f frames per 64th)\n", argv[1], seq.size(), lastTime + 1,
+           player.bpm(), framesPer64th / 65536.0);
+    printf("  events per 64th: %.2f average over the %u with any, peak %u at 64th %u\n",
+           busy64ths ? (double)events / busy64ths : 0.0, busy64ths, peakEvents, peak64th);
+    printf("  events per frame: peak %u in frame %u (64ths %u-%u)\n", eventsInFrame[peakFrame], peakFrame, frameFirst,
+           std::max(frameFirst, frameLast));
+    printf("  notes ending in the frame they start in: %u\n", collapsed);
+
+    // Cost of each tick
+    std::vector<size_t> over;
+    double worst = 0, sum = 0;
+    size_t worstTick = 0;
+    for (size_t i = 0; i < ticks.size(); i++) {
+        double c = ticks[i].cost(model);
+        sum += c;
+        if (c > worst) {
+            worst = c;
+            worstTick = i;
+        }
+        if (c > budget) over.push_back(i);
+    }
+    printf("  %zu timer ticks at %d Hz, budget %.0f cycles (%.0f%% of %u):\n", ticks.size(), HOST_TIMER_HZ, budget,
+           budgetPercent, HOST_BUS_CLOCK / HOST_TIMER_HZ);
+    printModel(model);
+    printf("  cost per tick: average %.0f cycles, worst %.0f (%.0f%% of budget) at tick %zu\n",
+           ticks.empty() ? 0.0 : sum / ticks.size(), worst, worst * 100 / budget, worstTick);
+    if (over.empty()) {
+        printf("  no tick over budget\n");
+        return 0;
+    }
+
+    // Worst first
+    std::sort(over.begin(), over.end(), [&](size_t a, size_t b) { return ticks[a].cost(model) > ticks[b].cost(model); });
+    printf("  %zu ticks over budget, worst:\n", over.size());
+    for (size_t k = 0; k < over.size() && k < DENSITY_LIST_MAX; k++) {
+        const TickWork& w = ticks[over[k]];
+        printf("    tick %8zu (%7.3f s) %6.0f cycles: %u 64ths, %u events, %u frames, %u adsr, %u pitch, %u slide, %u writes\n",
+               over[k], (double)over[k] / HOST_TIMER_HZ, w.cost(model), w.sixtyFourths, w.events, w.frames, w.adsr,
+               w.pitch, w.slide, w.writes);
+    }
+    return 1;
+}
@@ -0,0 +1,131 @@
+// nseqmidi: converts Standard MIDI Files into NuclearSEQ text sequences, row for row what
+// py/m2text.py writes, without Python, mido or a GUI. Given a directory it converts every
+// .mid/.midi in it, one per core.
+//
+//   nseqmidi [-j jobs] song.mid [song.txt]
+//   nseqmidi [-j jobs] mididir [outdir]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "midiconv.h"
+
+namespace fs = std::filesystem;
+
+struct Job {
+    std::string input, output;
+
+    // Filled in by the worker
+    bool ok = false;
+    std::string error;
+    size_t rows = 0;
+    int bpm = 0;
+    double seconds = 0;
+};
+
+static void runJob(Job& job) {
+    auto begin = std::chrono::steady_clock::now();
+
+    SongText song;
+    if (!convertMidi(job.input.c_str(), song, job.error)) return;
+    if (!writeSongText(job.output.c_str(), song)) {
+        job.error = "cannot write " + job.output;
+        return;
+    }
+
+    job.ok = true;
+    job.rows = song.rows.size();
+    job.bpm = song.bpm;
+    job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static bool isMidi(const fs::path& p) {
+    std::string ext = p.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)tolower(c); });
+    return ext == ".mid" || ext == ".midi";
+}
+
+int main(int argc, char* argv[]) {
+    int jobs = (int)std::thread::hardware_concurrency();
+    int arg = 1;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        std::string flag = argv[arg];
+        if (arg + 1 >= argc) break;
+        if (flag == "-j") jobs = atoi(argv[++arg]);
+        else break;
+    }
+    if (argc - arg < 1 || argc - arg > 2 || argv[arg][0] == '-') {
+        fprintf(stderr, "usage: %s [-j jobs] song.mid|mididir [song.txt|outdir]\n", argv[0]);
+        return 2;
+    }
+    if (jobs < 1) jobs = 1;
+
+    fs::path input = argv[arg];
+    std::vector<Job> work;
+
+    if (fs::is_directory(input)) {
+        fs::path outdir = (argc - arg == 2) ? fs::path(argv[arg + 1]) : input;
+        std::error_code ec;
+        fs::create_directories(outdir, ec);
+
+        std::vector<fs::path> songs;
+        for (const fs::directory_entry& entry : fs::directory_iterator(input))
+            if (entry.is_regular_file() && isMidi(entry.path())) songs.push_back(entry.path());
+        std::sort(songs.begin(), songs.end());
+
+        for (const fs::path& song : songs) {
+            Job job;
+            job.input = song.string();
+            job.output = (outdir / song.filename()).replace_extension(".txt").string();
+            work.push_back(job);
+        }
+    } else {
+        Job job;
+        job.input = input.string();
+        job.output = (argc - arg == 2) ? std::string(argv[arg + 1]) : fs::path(input).replace_extension(".txt").string();
+        work.push_back(job);
+    }
+
+    if (work.empty()) {
+        fprintf(stderr, "%s: no MIDI files in %s\n", argv[0], input.string().c_str());
+        return 1;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+
+    // Workers take the next unclaimed file until none are left
+    std::atomic<size_t> nextJob(0);
+    std::vector<std::thread> threads;
+    int threadCount = jobs < (int)work.size() ? jobs : (int)work.size();
+    for (int t = 0; t < threadCount; t++) {
+        threads.emplace_back([&]() {
+            for (size_t i; (i = nextJob++) < work.size();)
+                runJob(work[i]);
+        });
+    }
+    for (std::thread& t : threads) t.join();
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    int failed = 0;
+    for (const Job& job : work) {
+        if (!job.ok) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], job.input.c_str(), job.error.c_str());
+            failed++;
+            continue;
+        }
+        printf("%s: %zu unique events, BPM=%d, %.3f s\n", job.output.c_str(), job.rows, job.bpm, job.seconds);
+    }
+    if (work.size() > 1)
+        printf("%zu files in %.2f s on %d threads\n", work.size() - failed, wall, threadCount);
+
+    return failed ? 1 : 0;
+}
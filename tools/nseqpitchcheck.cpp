@@ -0,0 +1,56 @@
+// nseqpitchcheck: checks the fixed-point pitch table against the float reference it was
+// derived from. For every note from -60 to 127 and every pitch bend, the frequency the player
+// sends (pitchToFreq) is compared with midiNoteToHz truncated and clamped the way the old
+// float path did. Both round in different places, so they may differ by one; more than that
+// means the table or its interpolation is wrong.
+//
+//   nseqpitchcheck
+//
+// Exits with 1 if any frequency is off by more than one.
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "pitch.h"
+
+// Lowest and highest note checked; slides and pitch envelopes reach well below note 0
+#define CHECK_NOTE_MIN -60
+#define CHECK_NOTE_MAX 127
+
+// Largest difference allowed, in the units soundSetFreq takes
+#define CHECK_TOLERANCE 1
+
+// The old conversion: float Hz truncated to the u16 soundSetFreq takes
+static uint16_t floatFreq(int note, int bend) {
+    float hz = midiNoteToHz(note, bend);
+    if (hz <= 0.0f) return 0;
+    if (hz >= 65535.0f) return 65535;
+    return (uint16_t)hz;
+}
+
+int main() {
+    uint32_t checked = 0, differ = 0, over = 0;
+    int worst = 0, worstNote = 0, worstBend = 0;
+    for (int note = CHECK_NOTE_MIN; note <= CHECK_NOTE_MAX; note++) {
+        for (int bend = -8192; bend <= 8191; bend++) {
+            int diff = abs((int)pitchToFreq(notePitch(note, bend)) - (int)floatFreq(note, bend));
+            checked++;
+            if (diff) differ++;
+            if (diff > CHECK_TOLERANCE) over++;
+            if (diff > worst) {
+                worst = diff;
+                worstNote = note;
+                worstBend = bend;
+            }
+        }
+    }
+
+    printf("%u pitches checked, %u differ, largest difference %d", checked, differ, worst);
+    if (worst) printf(" (note %d, bend %d)", worstNote, worstBend);
+    printf("\n");
+    if (over) {
+        printf("%u off by more than %d\n", over, CHECK_TOLERANCE);
+        return 1;
+    }
+    return 0;
+}
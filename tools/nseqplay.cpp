@@ -0,0 +1,270 @@
+// nseqplay: runs the player core without a DS and logs every PSG write that reaches the
+// hardware, timed exactly as the DS build times them (bus clock, 1024 Hz sequencer timer,
+// shadow registers flushed after each step). The output is deterministic, so two builds can
+// be compared with diff. The last lines count the writes the player asked for against the
+// ones the shadow registers let through.
+//
+// With -s a .nseq is streamed a chunk at a time, as the DS does, with the chunk reads done
+// once every HOST_SERVICE_STEPS steps like the DS main loop does once per vblank. With -a the
+// player allocates voices, stealing by the given policy (oldest, quietest or releasing). With
+// -t playback starts from the given 64th, through Player::seek. With -p the player's hot
+// paths are timed with the host's steady clock and the profile written to the given file;
+// the log itself is unchanged. Each -x plays a sound effect song over the music once the music
+// reaches the given 64th, with the given priority (default 1). -r swaps the music for another
+// text song once it reaches the given 64th, as the DS does when a changed song is reloaded.
+// -w also records the writes to a trace file, for nseqtrace to compare with another build's.
+// -P plays the song stored as patterns: a pattern .nseq as it is, anything else cut into
+// patterns first, so its log can be compared with the flat song's.
+//
+//   nseqplay [-s | -P] [-a steal] [-t 64th] [-p profile.txt] [-x sfx.txt:64th[:priority]]...
+//            [-r song.txt:64th] [-w trace.ntr] song.(txt|nseq) [seconds] [envelopes.txt]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "engine.h"
+#include "player.h"
+#include "profile.h"
+#include "render.h"
+#include "songfile.h"
+#include "trace.h"
+
+// Timer steps per vblank
+#define HOST_SERVICE_STEPS 17
+
+// -x options
+#define HOST_SFX_MAX 16
+
+// Prints each write with the timer step it happened on
+class LogPsg : public PsgBackend {
+public:
+    uint32_t step = 0;
+
+    void playTone(int channel, int duty, uint16_t freq, uint8_t volume, uint8_t pan) override {
+        printf("%8u tone  ch%-2d duty %d freq %5u vol %3u pan %3u\n", step, channel, duty, freq, volume, pan);
+    }
+    void playNoise(int channel, uint16_t freq, uint8_t volume, uint8_t pan) override {
+        printf("%8u noise ch%-2d freq %5u vol %3u pan %3u\n", step, channel, freq, volume, pan);
+    }
+    void setFreq(int channel, uint16_t freq) override { printf("%8u freq  ch%-2d %u\n", step, channel, freq); }
+    void setVolume(int channel, uint8_t volume) override { printf("%8u vol   ch%-2d %u\n", step, channel, volume); }
+    void setPan(int channel, uint8_t pan) override { printf("%8u pan   ch%-2d %u\n", step, channel, pan); }
+    void kill(int channel) override { printf("%8u kill  ch%-2d\n", step, channel); }
+};
+
+// Profiler clock in nanoseconds; only differences are used, so wrapping is harmless
+static uint32_t steadyNanos() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct SfxCue {
+    Sequence seq;
+    uint32_t at = 0;
+    int priority = 1;
+    bool fired = false;
+};
+
+static Sequence seq;
+static SeqStream stream;
+static PatternSequence patternSong;
+static EnvelopeBank envelopes;
+static SfxCue cues[HOST_SFX_MAX];
+static SfxCue reload;   // -r: priority unused
+
+// "file:64th[:priority]" (-r takes no priority)
+static bool parseCue(const char* arg, SfxCue& cue, std::string& error) {
+    std::string text = arg;
+    size_t colon = text.find(':');
+    if (colon == std::string::npos) { error = "expected file:64th[:priority]"; return false; }
+    std::string rest = text.substr(colon + 1);
+    char* end;
+    cue.at = (uint32_t)strtoul(rest.c_str(), &end, 10);
+    if (*end == ':') cue.priority = (int)strtol(end + 1, &end, 10);
+    if (end == rest.c_str() || *end) { error = "expected file:64th[:priority]"; return false; }
+    return loadSongFile(text.substr(0, colon), cue.seq, error);
+}
+
+int main(int argc, char* argv[]) {
+    const char* name = argv[0];
+    bool streaming = false, allocating = false, patterned = false;
+    StealPolicy policy = STEAL_RELEASING;
+    long startAt = -1;
+    const char* profilePath = nullptr;
+    const char* tracePath = nullptr;
+    int cueCount = 0;
+    bool reloadAt = false;
+    while (argc > 1 && argv[1][0] == '-') {
+        std::string flag = argv[1];
+        if (flag == "-s") {
+            streaming = true;
+        } else if (flag == "-P") {
+            patterned = true;
+        } else if (flag == "-a" && argc > 2 && parseStealPolicy(argv[2], policy)) {
+            allocating = true;
+            argv++;
+            argc--;
+        } else if (flag == "-t" && argc > 2) {
+            startAt = atol(argv[2]);
+            argv++;
+            argc--;
+        } else if (flag == "-p" && argc > 2) {
+            profilePath = argv[2];
+            argv++;
+            argc--;
+        } else if (flag == "-w" && argc > 2) {
+            tracePath = argv[2];
+            argv++;
+            argc--;
+        } else if (flag == "-x" && argc > 2 && cueCount < HOST_SFX_MAX) {
+            std::string error;
+            if (!parseCue(argv[2], cues[cueCount], error)) {
+                fprintf(stderr, "%s: %s: %s\n", name, argv[2], error.c_str());
+                return 1;
+            }
+            cueCount++;
+            argv++;
+            argc--;
+        } else if (flag == "-r" && argc > 2) {
+            std::string error;
+            if (!parseCue(argv[2], reload, error)) {
+                fprintf(stderr, "%s: %s: %s\n", name, argv[2], error.c_str());
+                return 1;
+            }
+            reloadAt = true;
+            argv++;
+            argc--;
+        } else {
+            break;
+        }
+        argv++;
+        argc--;
+    }
+    argv[0] = const_cast<char*>(name);
+    if (argc < 2 || argc > 4 || argv[1][0] == '-' || (streaming && patterned)) {
+        fprintf(stderr, "usage: %s [-s | -P] [-a oldest|quietest|releasing] [-t 64th] [-p profile.txt] [-x sfx.txt:64th[:priority]]... [-r song.txt:64th] [-w trace.ntr] song.(txt|nseq) [seconds] [envelopes.txt]\n", argv[0]);
+        return 2;
+    }
+
+    std::string input = argv[1];
+    int seconds = (argc >= 3) ? atoi(argv[2]) : 60;
+
+    std::string error;
+    if (streaming) {
+        SeqBinResult result = stream.open(input.c_str());
+        if (result != SEQBIN_OK) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], input.c_str(), seqBinResultString(result));
+            return 1;
+        }
+    } else if (patterned) {
+        if (!loadPatternSongFile(input, patternSong, error)) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], input.c_str(), error.c_str());
+            return 1;
+        }
+    } else if (!loadSongFile(input, seq, error)) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], input.c_str(), error.c_str());
+        return 1;
+    }
+
+    envelopes.setDefaults();
+    if (argc == 4 && !loadEnvelopeFile(argv[3], envelopes)) {
+        fprintf(stderr, "%s: cannot open %s\n", argv[0], argv[3]);
+        return 1;
+    }
+
+    LogPsg psg;
+    static PsgTrace trace(&psg);
+    PsgShadow shadow(&psg);
+    if (tracePath) {
+        PsgTraceResult result = trace.start(tracePath, HOST_TIMER_HZ);
+        if (result != PSG_TRACE_OK) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], tracePath, psgTraceResultString(result));
+            return 1;
+        }
+        shadow.setOutput(&trace);
+    }
+    static SoundEngine engine;
+    Player& player = engine.music();
+    Profiler profiler;
+    if (profilePath) {
+        profiler.setClock(steadyNanos, 1000000000);
+        profiler.setTickBudget(1000000000 / HOST_TIMER_HZ);
+        player.setProfiler(&profiler);
+    }
+    player.setVoiceAllocation(allocating, policy);
+    engine.begin(&envelopes, &shadow, HOST_BUS_CLOCK);
+    if (streaming) engine.startMusic(&stream);
+    else if (patterned) engine.startMusic(&patternSong);
+    else engine.startMusic(&seq);
+    if (startAt >= 0) player.seek((uint32_t)startAt);
+
+    size_t events = streaming ? stream.size() : patterned ? patternSong.expandedSize() : seq.size();
+    printf("# %s: %zu events, %d BPM, %d steps/s\n", input.c_str(), events, player.bpm(), HOST_TIMER_HZ);
+    for (uint32_t steps = (uint32_t)seconds * HOST_TIMER_HZ; psg.step < steps; psg.step++) {
+        for (int i = 0; i < cueCount; i++) {
+            if (cues[i].fired || player.position() < cues[i].at) continue;
+            cues[i].fired = true;
+            int slot = engine.playSfx(&cues[i].seq, cues[i].priority);
+            printf("# sfx %d at step %u: %s\n", i, psg.step, slot < 0 ? "dropped" : "started");
+        }
+
+        if (reloadAt && !reload.fired && player.position() >= reload.at) {
+            reload.fired = true;
+            engine.replaceMusic(&reload.seq);
+            printf("# reload at step %u: 64th %u\n", psg.step, player.position());
+        }
+
+        uint32_t started = profiler.now();
+        engine.advance(HOST_BUS_CLOCK / HOST_TIMER_HZ);
+        shadow.flush();
+        profiler.end(PROF_TICK, started);
+        trace.advance();
+
+        PsgTraceResult traced = trace.service();
+        if (traced != PSG_TRACE_OK) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], tracePath, psgTraceResultString(traced));
+            return 1;
+        }
+
+        if (streaming && psg.step % HOST_SERVICE_STEPS == 0) {
+            SeqBinResult result = stream.service();
+            if (result != SEQBIN_OK) {
+                fprintf(stderr, "%s: %s: %s\n", argv[0], input.c_str(), seqBinResultString(result));
+                return 1;
+            }
+        }
+    }
+    printf("# end at 64th %u, %d loops\n", player.position(), player.loopCount());
+    if (allocating)
+        printf("# %u voice steals\n", player.voiceSteals());
+    if (streaming)
+        printf("# streamed with %zu bytes resident, %u underruns\n", stream.memoryBytes(), stream.underruns());
+    if (patterned)
+        printf("# %zu patterns in %zu places, %zu bytes\n", patternSong.patterns.size(), patternSong.orders.size(),
+               patternSong.memoryBytes());
+
+    const PsgWriteStats& stats = shadow.stats();
+    for (int kind = 0; kind < PSG_WRITE_KINDS; kind++)
+        printf("# %-6s requested %8u issued %8u\n", psgWriteKindName(kind), stats.requested[kind], stats.issued[kind]);
+    uint32_t requested = stats.totalRequested(), issued = stats.totalIssued();
+    printf("# total  requested %8u issued %8u suppressed %.1f%%\n", requested, issued,
+           requested ? 100.0 * (requested - issued) / requested : 0.0);
+
+    if (tracePath) {
+        uint32_t records = trace.records(), dropped = trace.dropped();
+        PsgTraceResult result = trace.stop();
+        if (result != PSG_TRACE_OK) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], tracePath, psgTraceResultString(result));
+            return 1;
+        }
+        printf("# traced %u writes to %s, %u dropped\n", records, tracePath, dropped);
+    }
+
+    if (profilePath && !saveProfile(profilePath, profiler)) {
+        fprintf(stderr, "%s: cannot write %s\n", argv[0], profilePath);
+        return 1;
+    }
+    return 0;
+}
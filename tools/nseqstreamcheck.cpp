@@ -0,0 +1,177 @@
+// nseqstreamcheck: checks that a streamed song whose chunks arrive late plays the same
+// controller values as the song played from memory. A song of pitch bend, volume and pan ramps
+// over dense controller traffic is generated, compiled to a .nseq and played twice: once from
+// memory, and once through SeqStream with service() called so rarely that most chunks are
+// late. Every time the position moves on, the ramped channels' values are compared with the
+// ones the in-memory run had at the same 64th. An underrun holds the position, and must not
+// move the ramps or change anything else that was reached.
+//
+//   nseqstreamcheck
+//
+// Exits with 1 if any value differs, or if the streamed run never underran.
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "clock.h"
+#include "loader.h"
+#include "player.h"
+#include "render.h"
+#include "seqbin.h"
+
+namespace fs = std::filesystem;
+
+// Length of the generated song, in 64ths, and of each of its ramps
+#define CHECK_LENGTH 4096
+#define CHECK_RAMP 64
+
+// Timer steps between service() calls in the late run; a chunk plays for about a third of this
+#define CHECK_SERVICE_STEPS 8192
+
+// Channels carrying ramps; the ones after them carry unrelated controller lines every 64th
+#define CHECK_RAMP_FIRST 8
+#define CHECK_RAMP_LAST 11
+
+class NullPsg : public PsgBackend {
+public:
+    void playTone(int, int, uint16_t, uint8_t, uint8_t) override {}
+    void playNoise(int, uint16_t, uint8_t, uint8_t) override {}
+    void setFreq(int, uint16_t) override {}
+    void setVolume(int, uint8_t) override {}
+    void setPan(int, uint8_t) override {}
+    void kill(int) override {}
+};
+
+struct RampValues {
+    int pitchBend, volume, pan;
+};
+
+// Deterministic, so every run checks the same song
+static uint32_t lcgState = 12345;
+static int rnd(int lo, int hi) {
+    lcgState = lcgState * 1664525u + 1013904223u;
+    return lo + (int)((lcgState >> 8) % (uint32_t)(hi - lo + 1));
+}
+
+// A scratch file in the temp directory; a missing one only shows when the file is written
+static std::string tempPath(const char* file) {
+    std::error_code ec;
+    fs::path dir = fs::temp_directory_path(ec);
+    return (ec ? fs::path(file) : dir / file).string();
+}
+
+// Each ramp channel plays a note every CHECK_RAMP 64ths and sweeps its controllers in a
+// straight line until the next, which fitRamps stores as one ramp. False if the file cannot be
+// written.
+static bool writeSong(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    fprintf(f, "BPM:180\n");
+    for (int start = 0; start < CHECK_LENGTH; start += CHECK_RAMP) {
+        for (int ch = CHECK_RAMP_FIRST; ch <= CHECK_RAMP_LAST; ch++) {
+            int bend = rnd(-8192, 8191), bendTo = rnd(-8192, 8191);
+            int vol = rnd(20, 127), volTo = rnd(20, 127);
+            int pan = rnd(0, 127), panTo = rnd(0, 127);
+            for (int step = 0; step < CHECK_RAMP; step++) {
+                int t = start + step;
+                fprintf(f, "%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n", ch, 3, step ? -1 : rnd(48, 84), 100,
+                        t, step ? t + 1 : t + CHECK_RAMP, rampValue(pan, panTo, step, CHECK_RAMP),
+                        rampValue(bend, bendTo, step, CHECK_RAMP), rampValue(vol, volTo, step, CHECK_RAMP),
+                        0, 0, 0);
+            }
+        }
+        for (int t = start; t < start + CHECK_RAMP; t++)
+            for (int ch = CHECK_RAMP_LAST + 1; ch < 16; ch++)
+                fprintf(f, "%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n", ch, 3, -1, 100, t, t + 1, rnd(0, 127),
+                        rnd(-8192, 8191), rnd(20, 127), 0, 0, 0);
+    }
+    return fclose(f) == 0;
+}
+
+// Plays until the position passes the song's end, calling service() every serviceSteps timer
+// steps when streaming. values[p] gets the ramp channels' values as they were when the
+// position first moved past p.
+static void play(Player& player, SeqStream* stream, uint32_t serviceSteps, std::vector<RampValues>& values) {
+    const int channels = CHECK_RAMP_LAST - CHECK_RAMP_FIRST + 1;
+    values.assign((size_t)CHECK_LENGTH * channels, RampValues{-1, -1, -1});
+
+    SeqClock clock;
+    clock.configure(HOST_BUS_CLOCK, player.bpm());
+    uint32_t reached = 0;
+    for (uint32_t step = 0; reached < CHECK_LENGTH; step++) {
+        clock.advance(HOST_BUS_CLOCK / HOST_TIMER_HZ, player);
+        if (stream && step % serviceSteps == 0) stream->service();
+
+        uint32_t position = player.position();
+        if (position <= reached) continue;
+        reached = position;
+        if (position > CHECK_LENGTH) continue;
+        for (int ch = 0; ch < channels; ch++) {
+            const PlayerChannel& pc = player.channel(CHECK_RAMP_FIRST + ch);
+            values[(size_t)(position - 1) * channels + ch] = RampValues{pc.pitchBend, pc.volume, pc.pan};
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string textPath = tempPath("nseqstreamcheck.txt"), binPath = tempPath("nseqstreamcheck.nseq");
+    if (!writeSong(textPath)) {
+        fprintf(stderr, "%s: cannot write %s\n", argv[0], textPath.c_str());
+        return 1;
+    }
+    Sequence seq;
+    bool loaded = loadSequenceText(textPath, seq);
+    fs::remove(textPath);
+    if (!loaded) {
+        fprintf(stderr, "%s: cannot read %s\n", argv[0], textPath.c_str());
+        return 1;
+    }
+    SeqBinResult result = writeSequenceBinary(binPath.c_str(), seq);
+    SeqStream stream;
+    if (result == SEQBIN_OK) result = stream.open(binPath.c_str());
+    if (result != SEQBIN_OK) {
+        fs::remove(binPath);
+        fprintf(stderr, "%s: %s: %s\n", argv[0], binPath.c_str(), seqBinResultString(result));
+        return 1;
+    }
+
+    EnvelopeBank envelopes;
+    envelopes.setDefaults();
+    NullPsg out;
+    std::vector<RampValues> expected, streamed;
+
+    static Player memory;
+    memory.start(&seq, &envelopes, &out);
+    play(memory, nullptr, 0, expected);
+
+    static Player late;
+    late.start(&stream, &envelopes, &out);
+    play(late, &stream, CHECK_SERVICE_STEPS, streamed);
+    uint32_t underruns = stream.underruns();
+    stream.close();
+    fs::remove(binPath);
+
+    const int channels = CHECK_RAMP_LAST - CHECK_RAMP_FIRST + 1;
+    uint32_t compared = 0, differ = 0;
+    for (size_t i = 0; i < expected.size(); i++) {
+        const RampValues& a = expected[i];
+        const RampValues& b = streamed[i];
+        if (a.volume < 0 || b.volume < 0) continue;
+        compared++;
+        if (a.pitchBend == b.pitchBend && a.volume == b.volume && a.pan == b.pan) continue;
+        if (differ++ == 0)
+            printf("64th %zu channel %zu: bend %d vol %d pan %d, streamed bend %d vol %d pan %d\n",
+                   i / channels, CHECK_RAMP_FIRST + i % channels, a.pitchBend, a.volume, a.pan,
+                   b.pitchBend, b.volume, b.pan);
+    }
+
+    printf("%u channel positions compared over %u underruns, %u differ\n", compared, underruns, differ);
+    if (!underruns) {
+        printf("the streamed run never underran\n");
+        return 1;
+    }
+    return differ ? 1 : 0;
+}
@@ -0,0 +1,279 @@
+// nseqstress: runs the sequencer and the UI side of a SequencerLink on two threads, the way the
+// DS runs them in the timer IRQ and the main loop, and has the UI side send commands as fast as
+// the queue takes them: seeks, sound effects started and stopped, and the song and envelopes
+// swapped for their spare copies the way a reload does. The sequencer thread plays the given
+// seconds of song at full speed. The UI side checks every status it reads: statuses must come
+// in order, never report more commands carried out than were sent and hold values in range.
+// The sequencer thread must not touch the heap at all, since on the DS it is an IRQ and
+// malloc is not safe there; every allocation it makes is counted. The longest tick is timed
+// too, against the mean, so work that lands on a single tick (a whole seek preroll) shows up
+// even though the host is far faster than the DS. With -s the music is a .nseq streamed the
+// way the DS streams it, with the UI side calling service() between commands, and song swaps
+// are left out as the DS leaves them out for a compiled song. Built with
+// ThreadSanitizer (make -C tools tsan) it also reports any access the two threads share
+// without the ring's or the stream's ordering.
+//
+//   nseqstress [-s] [-a steal] [-r seed] song.(txt|nseq) [seconds] [envelopes.txt]
+//
+// Exits with 1 if a status was wrong, a streamed chunk could not be read or the sequencer
+// thread allocated.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "engine.h"
+#include "link.h"
+#include "render.h"
+#include "songfile.h"
+
+// Writes go nowhere; only the count is kept, by the sequencer thread
+class CountingPsg : public PsgBackend {
+public:
+    uint32_t writes = 0;
+
+    void playTone(int, int, uint16_t, uint8_t, uint8_t) override { writes++; }
+    void playNoise(int, uint16_t, uint8_t, uint8_t) override { writes++; }
+    void setFreq(int, uint16_t) override { writes++; }
+    void setVolume(int, uint8_t) override { writes++; }
+    void setPan(int, uint8_t) override { writes++; }
+    void kill(int) override { writes++; }
+};
+
+// Kinds of command the UI side picks from
+enum StressAction { ACT_SEEK, ACT_SFX, ACT_STOP_SFX, ACT_SONG, ACT_ENVELOPES, ACT_KINDS };
+
+struct UiCounts {
+    uint32_t sent[ACT_KINDS] = {};
+    uint32_t rejected = 0;
+    uint32_t statuses = 0;
+    uint32_t bad = 0;
+    SeqBinResult streamResult = SEQBIN_OK;
+};
+
+static Sequence songs[2];
+static SeqStream stream;
+static bool streaming = false;
+static EnvelopeBank banks[2];
+static SoundEngine engine;
+static SequencerLink seqLink(engine);
+static std::atomic<bool> finished{false};
+
+// Sequencer thread only, read once it has been joined
+static double longestTickUs = 0, totalTickUs = 0;
+static uint32_t longestTick = 0;
+
+// Heap allocations made while onSequencer is set (only the sequencer thread sets it)
+static thread_local bool onSequencer = false;
+static std::atomic<uint32_t> sequencerAllocations{0};
+
+void* operator new(size_t size) {
+    if (onSequencer) sequencerAllocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+static uint32_t random32(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static void sequencerThread(uint32_t ticks, PsgShadow* shadow) {
+    onSequencer = true;
+    for (uint32_t t = 0; t < ticks; t++) {
+        auto begin = std::chrono::steady_clock::now();
+        seqLink.tick(HOST_BUS_CLOCK / HOST_TIMER_HZ);
+        shadow->flush();
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+        totalTickUs += us;
+        if (us > longestTickUs) {
+            longestTickUs = us;
+            longestTick = t;
+        }
+
+        // Let the UI side in between ticks, as the DS main loop runs between timer IRQs
+        std::this_thread::yield();
+    }
+    finished.store(true, std::memory_order_release);
+}
+
+static bool checkStatus(const SeqStatus& s, const SeqStatus& previous, uint32_t sent, const char*& problem) {
+    if (s.published <= previous.published) problem = "status out of order";
+    else if (s.commands < previous.commands) problem = "command count went back";
+    else if (s.commands > sent) problem = "more commands carried out than sent";
+    else if (s.loops < previous.loops) problem = "loop count went back";
+    else if (s.underruns < previous.underruns) problem = "underrun count went back";
+    else if (s.sfxMask >> SFX_SLOTS) problem = "effect slot out of range";
+    else problem = nullptr;
+
+    for (int ch = 0; ch < 16 && !problem; ch++) {
+        const SeqChannelStatus& c = s.channels[ch];
+        if (c.pan > 127 || c.baseVolume > 127 || c.level > 127) problem = "channel value out of range";
+        else if (c.cc74 < -1 || c.cc74 > 15 || c.cc75 < -1 || c.cc75 > 15) problem = "envelope out of range";
+    }
+    return !problem;
+}
+
+// Wait for a swap to be carried out, as main.cpp does, unless the sequencer has stopped
+static bool waitFor(uint32_t ticket) {
+    while (!seqLink.done(ticket)) {
+        if (finished.load(std::memory_order_acquire)) return false;
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+static void uiLoop(uint32_t seed, UiCounts& counts) {
+    uint32_t rng = seed ? seed : 1;
+    uint32_t sent = 0;
+    int song = 0, bank = 0;
+    SeqStatus status, previous;
+    uint32_t length = songs[0].loopEnd64th > 0 ? (uint32_t)songs[0].loopEnd64th : 4096;
+
+    while (!finished.load(std::memory_order_acquire)) {
+        // Read the chunk the sequencer will need next, as the DS main loop does every frame
+        if (streaming && counts.streamResult == SEQBIN_OK) counts.streamResult = stream.service();
+
+        if (seqLink.latest(status)) {
+            counts.statuses++;
+            const char* problem;
+            if (!checkStatus(status, previous, sent, problem)) {
+                if (counts.bad++ == 0)
+                    fprintf(stderr, "status %u: %s\n", status.published, problem);
+            }
+            previous = status;
+        }
+
+        int action = (int)(random32(rng) % ACT_KINDS);
+        if (streaming && action == ACT_SONG) continue;
+        uint32_t ticket = 0;
+        switch (action) {
+            case ACT_SEEK:
+                ticket = seqLink.seek(random32(rng) % length);
+                break;
+            case ACT_SFX:
+                ticket = seqLink.playSfx(&songs[song ^ 1], (int)(random32(rng) % 3));
+                break;
+            case ACT_STOP_SFX:
+                ticket = seqLink.stopSfx((int)(random32(rng) % SFX_SLOTS));
+                break;
+            case ACT_SONG:
+                ticket = seqLink.replaceMusic(&songs[song ^ 1]);
+                if (ticket && waitFor(ticket)) song ^= 1;
+                break;
+            case ACT_ENVELOPES:
+                ticket = seqLink.setEnvelopes(&banks[bank ^ 1]);
+                if (ticket && waitFor(ticket)) bank ^= 1;
+                break;
+        }
+        if (ticket) {
+            counts.sent[action]++;
+            sent++;
+        } else {
+            counts.rejected++;
+            std::this_thread::yield();
+        }
+    }
+
+    // The last status, taken after the final tick's commands
+    if (seqLink.latest(status)) {
+        counts.statuses++;
+        const char* problem;
+        if (!checkStatus(status, previous, sent, problem) && counts.bad++ == 0)
+            fprintf(stderr, "status %u: %s\n", status.published, problem);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const char* name = argv[0];
+    bool allocating = false;
+    StealPolicy policy = STEAL_RELEASING;
+    uint32_t seed = 12345;
+    while (argc > 1 && argv[1][0] == '-') {
+        std::string flag = argv[1];
+        if (flag == "-s") {
+            streaming = true;
+        } else if (flag == "-a" && argc > 2 && parseStealPolicy(argv[2], policy)) {
+            allocating = true;
+            argv++;
+            argc--;
+        } else if (flag == "-r" && argc > 2) {
+            seed = (uint32_t)strtoul(argv[2], nullptr, 10);
+            argv++;
+            argc--;
+        } else {
+            break;
+        }
+        argv++;
+        argc--;
+    }
+    argv[0] = const_cast<char*>(name);
+    if (argc < 2 || argc > 4 || argv[1][0] == '-') {
+        fprintf(stderr, "usage: %s [-s] [-a oldest|quietest|releasing] [-r seed] song.(txt|nseq) [seconds] [envelopes.txt]\n",
+                argv[0]);
+        return 2;
+    }
+
+    std::string error;
+    for (Sequence& s : songs) {
+        if (!loadSongFile(argv[1], s, error)) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], argv[1], error.c_str());
+            return 2;
+        }
+    }
+    if (streaming) {
+        SeqBinResult result = stream.open(argv[1]);
+        if (result != SEQBIN_OK) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], argv[1], seqBinResultString(result));
+            return 2;
+        }
+    }
+    int seconds = (argc >= 3) ? atoi(argv[2]) : 60;
+    for (EnvelopeBank& b : banks) {
+        b.setDefaults();
+        if (argc == 4 && !loadEnvelopeFile(argv[3], b)) {
+            fprintf(stderr, "%s: cannot open %s\n", argv[0], argv[3]);
+            return 2;
+        }
+    }
+
+    CountingPsg psg;
+    PsgShadow shadow(&psg);
+    engine.music().setVoiceAllocation(allocating, policy);
+    engine.begin(&banks[0], &shadow, HOST_BUS_CLOCK);
+    if (streaming) engine.startMusic(&stream);
+    else engine.startMusic(&songs[0]);
+    seqLink.setCounters(nullptr, streaming ? &stream : nullptr);
+
+    uint32_t ticks = (uint32_t)seconds * HOST_TIMER_HZ;
+    UiCounts counts;
+    std::thread sequencer(sequencerThread, ticks, &shadow);
+    uiLoop(seed, counts);
+    sequencer.join();
+
+    static const char* actionNames[ACT_KINDS] = {"seek", "sfx", "stop", "song", "envelopes"};
+    printf("%u ticks, %u writes, %u statuses read\n", ticks, psg.writes, counts.statuses);
+    for (int i = 0; i < ACT_KINDS; i++) printf("  %-10s %8u sent\n", actionNames[i], counts.sent[i]);
+    printf("  %-10s %8u\n", "queue full", counts.rejected);
+    printf("longest tick %.1f us (tick %u), mean %.2f us\n", longestTickUs, longestTick,
+           ticks ? totalTickUs / ticks : 0.0);
+    if (streaming) printf("streamed with %u underruns\n", stream.underruns());
+    if (counts.streamResult != SEQBIN_OK)
+        printf("%s: %s\n", argv[1], seqBinResultString(counts.streamResult));
+    uint32_t allocations = sequencerAllocations.load();
+    if (allocations) printf("%u heap allocations on the sequencer thread\n", allocations);
+    if (counts.bad) printf("%u bad statuses\n", counts.bad);
+    if (counts.bad || allocations || counts.streamResult != SEQBIN_OK) return 1;
+    printf("all statuses consistent, no allocations on the sequencer thread\n");
+    return 0;
+}
@@ -0,0 +1,167 @@
+// nseqtrace: prints or compares PSG write traces (.ntr), as recorded by the DS player or by
+// nseqplay -w. Given one trace it prints every write in nseqplay's log format. Given two
+// traces of the same song it reports the first write that differs, the writes of each kind in
+// both, and for how long each channel was left in a different state: a build that sends fewer
+// writes for the same sound shows differing writes but no differing state.
+//
+//   nseqtrace trace.ntr
+//   nseqtrace old.ntr new.ntr
+//
+// Comparing exits with 0 if the writes are identical, 1 if they differ and 2 on errors.
+
+#include <cstdio>
+#include <vector>
+
+#include "trace.h"
+
+struct Trace {
+    const char* path;
+    PsgTraceHeader header;
+    std::vector<PsgTraceRecord> records;
+};
+
+static bool load(const char* name, const char* path, Trace& trace) {
+    trace.path = path;
+    PsgTraceResult result = loadTrace(path, trace.header, trace.records);
+    if (result != PSG_TRACE_OK) {
+        fprintf(stderr, "%s: %s: %s\n", name, path, psgTraceResultString(result));
+        return false;
+    }
+    if (trace.header.dropped)
+        fprintf(stderr, "%s: %s: %u writes were dropped while recording\n", name, path, trace.header.dropped);
+    return true;
+}
+
+// Same layout as nseqplay's log
+static void printRecord(FILE* out, const char* prefix, const PsgTraceRecord& r) {
+    fputs(prefix, out);
+    switch (r.kind) {
+        case PSG_WRITE_TONE:
+            fprintf(out, "%8u tone  ch%-2d duty %d freq %5u vol %3u pan %3u\n", r.tick, r.channel, r.duty, r.freq,
+                    r.volume, r.pan);
+            break;
+        case PSG_WRITE_NOISE:
+            fprintf(out, "%8u noise ch%-2d freq %5u vol %3u pan %3u\n", r.tick, r.channel, r.freq, r.volume, r.pan);
+            break;
+        case PSG_WRITE_FREQ:   fprintf(out, "%8u freq  ch%-2d %u\n", r.tick, r.channel, r.freq); break;
+        case PSG_WRITE_VOLUME: fprintf(out, "%8u vol   ch%-2d %u\n", r.tick, r.channel, r.volume); break;
+        case PSG_WRITE_PAN:    fprintf(out, "%8u pan   ch%-2d %u\n", r.tick, r.channel, r.pan); break;
+        case PSG_WRITE_KILL:   fprintf(out, "%8u kill  ch%-2d\n", r.tick, r.channel); break;
+    }
+}
+
+// Arguments a kind does not have are always 0 in a loaded record
+static bool sameRecord(const PsgTraceRecord& a, const PsgTraceRecord& b) {
+    return a.tick == b.tick && a.kind == b.kind && a.channel == b.channel && a.duty == b.duty &&
+           a.volume == b.volume && a.pan == b.pan && a.freq == b.freq;
+}
+
+// What can be heard: a silent channel is the same whatever it last held
+static bool sameVoice(const PsgVoiceState& a, const PsgVoiceState& b) {
+    if (a.mode != b.mode) return false;
+    if (a.mode == PsgMirror::MODE_OFF) return true;
+    return a.duty == b.duty && a.freq == b.freq && a.volume == b.volume && a.pan == b.pan;
+}
+
+static double seconds(uint32_t tick, const Trace& t) {
+    return t.header.clockHz ? (double)tick / t.header.clockHz : 0.0;
+}
+
+static void summarize(const Trace& t) {
+    const std::vector<PsgTraceRecord>& r = t.records;
+    uint32_t last = r.empty() ? 0 : r.back().tick;
+    printf("%s: %zu writes over %u ticks (%.1f s) at %u Hz\n", t.path, r.size(), last, seconds(last, t),
+           t.header.clockHz);
+}
+
+static int compare(const Trace& a, const Trace& b) {
+    summarize(a);
+    summarize(b);
+    if (a.header.clockHz != b.header.clockHz)
+        printf("warning: recorded at different timer rates\n");
+
+    // First write that differs
+    const std::vector<PsgTraceRecord>& ra = a.records;
+    const std::vector<PsgTraceRecord>& rb = b.records;
+    size_t i = 0;
+    while (i < ra.size() && i < rb.size() && sameRecord(ra[i], rb[i])) i++;
+    if (i == ra.size() && i == rb.size()) {
+        printf("identical\n");
+        return 0;
+    }
+    uint32_t at = i < ra.size() ? ra[i].tick : rb[i].tick;
+    if (i < ra.size() && i < rb.size() && rb[i].tick < at) at = rb[i].tick;
+    printf("first difference at write %zu, tick %u (%.3f s):\n", i, at, seconds(at, a));
+    if (i < ra.size()) printRecord(stdout, "  a:", ra[i]);
+    else printf("  a: ends after %zu writes\n", ra.size());
+    if (i < rb.size()) printRecord(stdout, "  b:", rb[i]);
+    else printf("  b: ends after %zu writes\n", rb.size());
+
+    uint32_t kindsA[PSG_WRITE_KINDS] = {}, kindsB[PSG_WRITE_KINDS] = {};
+    for (const PsgTraceRecord& r : ra) kindsA[r.kind]++;
+    for (const PsgTraceRecord& r : rb) kindsB[r.kind]++;
+    printf("%-8s %10s %10s\n", "writes", "a", "b");
+    for (int kind = 0; kind < PSG_WRITE_KINDS; kind++)
+        printf("%-8s %10u %10u\n", psgWriteKindName(kind), kindsA[kind], kindsB[kind]);
+
+    // Replay both tick by tick and measure how long each channel holds something different
+    PsgMirror ma, mb;
+    uint32_t end = 0;
+    if (!ra.empty()) end = ra.back().tick + 1;
+    if (!rb.empty() && rb.back().tick + 1 > end) end = rb.back().tick + 1;
+    uint32_t differing[PSG_CHANNELS] = {}, anyDiffering = 0;
+    bool diverged = false;
+    uint32_t firstDivergence = 0;
+    size_t ia = 0, ib = 0;
+    while (ia < ra.size() || ib < rb.size()) {
+        uint32_t tick = end;
+        if (ia < ra.size()) tick = ra[ia].tick;
+        if (ib < rb.size() && rb[ib].tick < tick) tick = rb[ib].tick;
+        for (; ia < ra.size() && ra[ia].tick == tick; ia++) replayTraceRecord(ra[ia], ma);
+        for (; ib < rb.size() && rb[ib].tick == tick; ib++) replayTraceRecord(rb[ib], mb);
+
+        uint32_t next = end;
+        if (ia < ra.size()) next = ra[ia].tick;
+        if (ib < rb.size() && rb[ib].tick < next) next = rb[ib].tick;
+
+        bool any = false;
+        for (int ch = 0; ch < PSG_CHANNELS; ch++) {
+            if (sameVoice(ma.state()[ch], mb.state()[ch])) continue;
+            differing[ch] += next - tick;
+            any = true;
+        }
+        if (any) {
+            anyDiffering += next - tick;
+            if (!diverged) firstDivergence = tick;
+            diverged = true;
+        }
+    }
+
+    if (!diverged) {
+        printf("hardware state is the same on every tick\n");
+        return 1;
+    }
+    printf("hardware state differs on %u of %u ticks (%.1f s), first at tick %u:\n", anyDiffering, end,
+           seconds(anyDiffering, a), firstDivergence);
+    for (int ch = 0; ch < PSG_CHANNELS; ch++)
+        if (differing[ch]) printf("  ch%-2d %10u ticks\n", ch, differing[ch]);
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s trace.ntr [other.ntr]\n", argv[0]);
+        return 2;
+    }
+
+    Trace a;
+    if (!load(argv[0], argv[1], a)) return 2;
+    if (argc == 2) {
+        for (const PsgTraceRecord& r : a.records) printRecord(stdout, "", r);
+        return 0;
+    }
+
+    Trace b;
+    if (!load(argv[0], argv[2], b)) return 2;
+    return compare(a, b);
+}
@@ -0,0 +1,163 @@
+// nseqwav: renders songs to WAV on the host through an emulated DS PSG, using the same
+// player, clock and shadow registers as the ROM. Given a directory it renders every song in
+// it, one per core.
+//
+//   nseqwav [-j jobs] [-l loops] [-e envelopes.txt] [-a steal] song.(txt|nseq) [song.wav]
+//   nseqwav [-j jobs] [-l loops] [-e envelopes.txt] [-a steal] songdir [outdir]
+//
+// Without -e, envelopes.txt next to each song is used if there is one. -a lets the player
+// allocate voices, stealing by the given policy (oldest, quietest or releasing).
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "psgemu.h"
+#include "render.h"
+#include "songfile.h"
+
+namespace fs = std::filesystem;
+
+struct Job {
+    std::string input, output;
+
+    // Filled in by the worker
+    bool ok = false;
+    std::string error;
+    double audioSeconds = 0, renderSeconds = 0;
+};
+
+static std::string envelopeOverride;
+static RenderOptions options;
+
+static void runJob(Job& job) {
+    auto begin = std::chrono::steady_clock::now();
+
+    // Both are too large to want one per thread on the stack
+    std::unique_ptr<Sequence> seq(new Sequence);
+    std::unique_ptr<EnvelopeBank> envelopes(new EnvelopeBank);
+
+    if (!loadSongFile(job.input, *seq, job.error)) return;
+
+    std::string envPath = envelopeOverride;
+    if (envPath.empty()) {
+        fs::path sibling = fs::path(job.input).parent_path() / "envelopes.txt";
+        if (fs::exists(sibling)) envPath = sibling.string();
+    }
+    if (envPath.empty()) {
+        envelopes->setDefaults();
+    } else if (!loadEnvelopeFile(envPath, *envelopes)) {
+        job.error = "cannot open " + envPath;
+        return;
+    }
+
+    std::vector<int16_t> samples;
+    renderSong(*seq, *envelopes, options, samples);
+    if (!writeWav(job.output.c_str(), samples, PSG_EMU_RATE)) {
+        job.error = "cannot write " + job.output;
+        return;
+    }
+
+    job.ok = true;
+    job.audioSeconds = (double)samples.size() / 2 / PSG_EMU_RATE;
+    job.renderSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static bool isSong(const fs::path& p) {
+    std::string ext = p.extension().string();
+    if (ext == ".nseq") return true;
+    return ext == ".txt" && p.filename() != "envelopes.txt";
+}
+
+int main(int argc, char* argv[]) {
+    int jobs = (int)std::thread::hardware_concurrency();
+    int arg = 1;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        std::string flag = argv[arg];
+        if (arg + 1 >= argc) break;
+        if (flag == "-j") jobs = atoi(argv[++arg]);
+        else if (flag == "-l") options.loops = atoi(argv[++arg]);
+        else if (flag == "-e") envelopeOverride = argv[++arg];
+        else if (flag == "-a" && parseStealPolicy(argv[arg + 1], options.stealPolicy)) {
+            options.allocateVoices = true;
+            arg++;
+        }
+        else break;
+    }
+    if (argc - arg < 1 || argc - arg > 2 || argv[arg][0] == '-') {
+        fprintf(stderr, "usage: %s [-j jobs] [-l loops] [-e envelopes.txt] [-a oldest|quietest|releasing] song.(txt|nseq)|songdir [out.wav|outdir]\n", argv[0]);
+        return 2;
+    }
+    if (jobs < 1) jobs = 1;
+
+    fs::path input = argv[arg];
+    std::vector<Job> work;
+
+    if (fs::is_directory(input)) {
+        fs::path outdir = (argc - arg == 2) ? fs::path(argv[arg + 1]) : input;
+        std::error_code ec;
+        fs::create_directories(outdir, ec);
+
+        std::vector<fs::path> songs;
+        for (const fs::directory_entry& entry : fs::directory_iterator(input))
+            if (entry.is_regular_file() && isSong(entry.path())) songs.push_back(entry.path());
+        std::sort(songs.begin(), songs.end());
+
+        for (const fs::path& song : songs) {
+            Job job;
+            job.input = song.string();
+            job.output = (outdir / song.filename()).replace_extension(".wav").string();
+            work.push_back(job);
+        }
+    } else {
+        Job job;
+        job.input = input.string();
+        job.output = (argc - arg == 2) ? std::string(argv[arg + 1]) : fs::path(input).replace_extension(".wav").string();
+        work.push_back(job);
+    }
+
+    if (work.empty()) {
+        fprintf(stderr, "%s: no songs in %s\n", argv[0], input.string().c_str());
+        return 1;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+
+    // Workers take the next unclaimed song until none are left
+    std::atomic<size_t> nextJob(0);
+    std::vector<std::thread> threads;
+    int threadCount = jobs < (int)work.size() ? jobs : (int)work.size();
+    for (int t = 0; t < threadCount; t++) {
+        threads.emplace_back([&]() {
+            for (size_t i; (i = nextJob++) < work.size();)
+                runJob(work[i]);
+        });
+    }
+    for (std::thread& t : threads) t.join();
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    int failed = 0;
+    double audio = 0;
+    for (const Job& job : work) {
+        if (!job.ok) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], job.input.c_str(), job.error.c_str());
+            failed++;
+            continue;
+        }
+        audio += job.audioSeconds;
+        printf("%s: %.1f s audio in %.2f s (%.0fx real time)\n", job.output.c_str(), job.audioSeconds,
+               job.renderSeconds, job.renderSeconds > 0 ? job.audioSeconds / job.renderSeconds : 0.0);
+    }
+    printf("%zu songs, %.1f s audio in %.2f s on %d threads\n", work.size() - failed, audio, wall, threadCount);
+
+    return failed ? 1 : 0;
+}